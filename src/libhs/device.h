@@ -75,7 +75,6 @@ static const char *const hs_device_type_strings[] = {
 struct hs_device {
     /** @cond */
     unsigned int refcount;
-    _hs_htable_head hnode;
     char *key;
     /** @endcond */
 
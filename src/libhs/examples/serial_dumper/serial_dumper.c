@@ -11,6 +11,7 @@
 #include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #ifdef _WIN32
     #define WIN32_LEAN_AND_MEAN
     #include <windows.h>
@@ -163,13 +164,122 @@ static int refresh_read_rate(void)
     return 1;
 }
 
-int main(void)
+/* Probe mode: send timestamped lines to the first serial device, which must echo them back
+   (e.g. a simple loopback sketch), and print a round-trip latency histogram. */
+
+#define PROBE_TIMEOUT 1000
+#define PROBE_BUCKETS 24
+
+static int run_probe(unsigned int count)
+{
+    static const hs_match_spec match = HS_MATCH_TYPE(HS_DEVICE_TYPE_SERIAL, NULL);
+    static const hs_serial_config config = {
+        .latency = HS_SERIAL_CONFIG_LATENCY_LOW
+    };
+    hs_device *dev = NULL;
+    hs_port *port = NULL;
+    unsigned int buckets[PROBE_BUCKETS] = {0};
+    unsigned int received = 0;
+    uint64_t total = 0, min = UINT64_MAX, max = 0;
+    int r;
+
+    r = hs_find(&match, 1, &dev);
+    if (r < 0)
+        goto cleanup;
+    if (!r) {
+        r = hs_error(HS_ERROR_NOT_FOUND, "No serial device available");
+        goto cleanup;
+    }
+
+    r = hs_port_open(dev, HS_PORT_MODE_RW, &port);
+    if (r < 0)
+        goto cleanup;
+    r = hs_serial_set_config(port, &config);
+    if (r < 0)
+        goto cleanup;
+
+    printf("Probing '%s' (%u probes)\n", dev->path, count);
+
+    for (unsigned int seq = 0; seq < count; seq++) {
+        char msg[64], buf[1024];
+        size_t msg_len, buf_len = 0;
+        uint64_t start, latency = 0;
+        int found = 0;
+
+        start = hs_micros();
+        msg_len = (size_t)sprintf(msg, "#hs-probe %u %" PRIu64 "\n", seq, start);
+        r = (int)hs_serial_write(port, (uint8_t *)msg, msg_len, PROBE_TIMEOUT);
+        if (r < 0)
+            goto cleanup;
+
+        // Wait for our line to come back, anything else is ignored
+        while (!found) {
+            int timeout = PROBE_TIMEOUT - (int)((hs_micros() - start) / 1000);
+            ssize_t len;
+
+            if (timeout <= 0)
+                break;
+            if (buf_len == sizeof(buf) - 1)
+                buf_len = 0;
+
+            len = hs_serial_read(port, (uint8_t *)buf + buf_len, sizeof(buf) - buf_len - 1, timeout);
+            if (len < 0) {
+                r = (int)len;
+                goto cleanup;
+            }
+            buf_len += (size_t)len;
+            buf[buf_len] = 0;
+
+            if (strstr(buf, msg)) {
+                latency = hs_micros() - start;
+                found = 1;
+            }
+        }
+        if (!found)
+            continue;
+
+        {
+            unsigned int bucket = 0;
+            while (bucket < PROBE_BUCKETS - 1 && latency >= (uint64_t)2 << bucket)
+                bucket++;
+            buckets[bucket]++;
+        }
+        if (latency < min)
+            min = latency;
+        if (latency > max)
+            max = latency;
+        total += latency;
+        received++;
+    }
+
+    printf("%u probes, %u echoed, %u lost\n", count, received, count - received);
+    if (received) {
+        printf("Latency (us): min %" PRIu64 ", avg %" PRIu64 ", max %" PRIu64 "\n",
+               min, total / received, max);
+        for (unsigned int i = 0; i < PROBE_BUCKETS; i++) {
+            if (buckets[i])
+                printf("  %8" PRIu64 " - %8" PRIu64 " us  %u\n", i ? (uint64_t)1 << i : 0,
+                       ((uint64_t)2 << i) - 1, buckets[i]);
+        }
+    }
+
+    r = 0;
+cleanup:
+    hs_port_close(port);
+    hs_device_unref(dev);
+    return -r;
+}
+
+int main(int argc, char *argv[])
 {
     // We want serial devices only, you can match multiple devices with an array of matches
     static const hs_match_spec match = HS_MATCH_TYPE(HS_DEVICE_TYPE_SERIAL, NULL);
     hs_monitor *monitor = NULL;
     int r;
 
+    if (argc >= 2 && !strcmp(argv[1], "--probe"))
+        return run_probe(argc >= 3 ? (unsigned int)strtoul(argv[2], NULL, 10) : 1000);
+
     r = hs_monitor_new(&match, 1, &monitor);
     if (r < 0)
         goto cleanup;
@@ -11,60 +11,108 @@
 #include "common_priv.h"
 #include "htable.h"
 
-int _hs_htable_init(_hs_htable *table, unsigned int size)
+#define HTABLE_MIN_CAPACITY 16
+
+static int rehash(_hs_htable *table, size_t capacity)
 {
-    table->heads = (void **)malloc(size * sizeof(*table->heads));
-    if (!table->heads)
+    _hs_htable_slot *slots;
+
+    slots = (_hs_htable_slot *)calloc(capacity, sizeof(*slots));
+    if (!slots)
         return hs_error(HS_ERROR_MEMORY, NULL);
-    table->size = size;
 
-    _hs_htable_clear(table);
+    for (size_t i = 0; i < table->capacity; i++) {
+        _hs_htable_slot *slot = &table->slots[i];
+
+        if (slot->value && slot->value != _HS_HTABLE_DELETED) {
+            size_t j = slot->hash & (capacity - 1);
+            while (slots[j].value)
+                j = (j + 1) & (capacity - 1);
+            slots[j] = *slot;
+        }
+    }
+
+    free(table->slots);
+    table->slots = slots;
+    table->capacity = capacity;
+    table->deleted = 0;
 
     return 0;
 }
 
-void _hs_htable_release(_hs_htable *table)
+int _hs_htable_init(_hs_htable *table, size_t size)
 {
-    free(table->heads);
+    size_t capacity = HTABLE_MIN_CAPACITY;
+    while (capacity / 4 * 3 < size)
+        capacity *= 2;
+
+    table->slots = NULL;
+    table->capacity = 0;
+    table->count = 0;
+    table->deleted = 0;
+
+    return rehash(table, capacity);
 }
 
-_hs_htable_head *_hs_htable_get_head(_hs_htable *table, uint32_t key)
+void _hs_htable_release(_hs_htable *table)
 {
-    return (_hs_htable_head *)&table->heads[key % table->size];
+    free(table->slots);
+    table->slots = NULL;
+    table->capacity = 0;
+    table->count = 0;
+    table->deleted = 0;
 }
 
-void _hs_htable_add(_hs_htable *table, uint32_t key, _hs_htable_head *n)
+int _hs_htable_add(_hs_htable *table, uint32_t hash, void *value)
 {
-    _hs_htable_head *head = _hs_htable_get_head(table, key);
+    assert(value && value != _HS_HTABLE_DELETED);
 
-    n->key = key;
+    size_t i;
 
-    n->next = head->next;
-    head->next = n;
-}
+    // Keep the load factor (deleted slots included) under 75%
+    if ((table->count + table->deleted + 1) > table->capacity / 4 * 3) {
+        size_t capacity = table->capacity ? table->capacity : HTABLE_MIN_CAPACITY;
+        while ((table->count + 1) > capacity / 2)
+            capacity *= 2;
 
-void _hs_htable_insert(_hs_htable_head *prev, _hs_htable_head *n)
-{
-    n->key = prev->key;
+        int r = rehash(table, capacity);
+        if (r < 0)
+            return r;
+    }
+
+    i = hash & (table->capacity - 1);
+    while (table->slots[i].value && table->slots[i].value != _HS_HTABLE_DELETED)
+        i = (i + 1) & (table->capacity - 1);
 
-    n->next = prev->next;
-    prev->next = n;
+    if (table->slots[i].value == _HS_HTABLE_DELETED)
+        table->deleted--;
+    table->slots[i].hash = hash;
+    table->slots[i].value = value;
+    table->count++;
+
+    return 0;
 }
 
-void _hs_htable_remove(_hs_htable_head *head)
+bool _hs_htable_remove(_hs_htable *table, uint32_t hash, const void *value)
 {
-    for (_hs_htable_head *prev = head->next; prev != head; prev = prev->next) {
-        if (prev->next == head) {
-            prev->next = head->next;
-            head->next = NULL;
-
-            break;
+    for (size_t i = _hs_htable_next_hash(table, hash, hash); i != SIZE_MAX;
+         i = _hs_htable_next_hash(table, hash, i + 1)) {
+        if (table->slots[i].value == value) {
+            table->slots[i].value = _HS_HTABLE_DELETED;
+            table->count--;
+            table->deleted++;
+
+            return true;
         }
     }
+
+    return false;
 }
 
 void _hs_htable_clear(_hs_htable *table)
 {
-    for (unsigned int i = 0; i < table->size; i++)
-        table->heads[i] = (_hs_htable_head *)&table->heads[i];
+    if (table->slots)
+        memset(table->slots, 0, table->capacity * sizeof(*table->slots));
+    table->count = 0;
+    table->deleted = 0;
 }
@@ -15,55 +15,105 @@
 
 HS_BEGIN_C
 
-typedef struct _hs_htable_head {
-    // Keep first!
-    struct _hs_htable_head *next;
-    uint32_t key;
-} _hs_htable_head;
+/* Open-addressing multimap from 32-bit hashes to non-NULL pointers, using linear probing.
+   Values are not owned by the table. Several values can share the same hash, and callers
+   are expected to compare the actual keys inside _hs_htable_foreach_hash(). */
+
+typedef struct _hs_htable_slot {
+    uint32_t hash;
+    void *value;
+} _hs_htable_slot;
 
 typedef struct _hs_htable {
-    unsigned int size;
-    void **heads;
+    _hs_htable_slot *slots;
+    size_t capacity;
+    size_t count;
+    size_t deleted;
 } _hs_htable;
 
-int _hs_htable_init(_hs_htable *table, unsigned int size);
-void _hs_htable_release(_hs_htable *table);
+// Marks removed slots, so that probe sequences (and running loops) stay valid
+#define _HS_HTABLE_DELETED ((void *)(uintptr_t)1)
 
-_hs_htable_head *_hs_htable_get_head(_hs_htable *table, uint32_t key);
+int _hs_htable_init(_hs_htable *table, size_t size);
+void _hs_htable_release(_hs_htable *table);
 
-void _hs_htable_add(_hs_htable *table, uint32_t key, _hs_htable_head *head);
-void _hs_htable_insert(_hs_htable_head *prev, _hs_htable_head *head);
-void _hs_htable_remove(_hs_htable_head *head);
+int _hs_htable_add(_hs_htable *table, uint32_t hash, void *value);
+bool _hs_htable_remove(_hs_htable *table, uint32_t hash, const void *value);
 
 void _hs_htable_clear(_hs_htable *table);
 
 static inline uint32_t _hs_htable_hash_str(const char *s)
 {
-    uint32_t hash = 0;
-    while (*s)
-        hash = hash * 101 + (unsigned char)*s++;
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    while (*s) {
+        hash ^= (unsigned char)*s++;
+        hash *= 16777619u;
+    }
 
     return hash;
 }
 
 static inline uint32_t _hs_htable_hash_ptr(const void *p)
 {
-    return (uint32_t)((uintptr_t)p >> 3);
+    // MurmurHash3 finalizer, the low bits of pointers are mostly zero
+    uint64_t u = (uint64_t)(uintptr_t)p;
+    uint32_t hash = (uint32_t)(u ^ (u >> 32));
+
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6bu;
+    hash ^= hash >> 13;
+    hash *= 0xc2b2ae35u;
+    hash ^= hash >> 16;
+
+    return hash;
+}
+
+static inline size_t _hs_htable_next(const _hs_htable *table, size_t i)
+{
+    for (; i < table->capacity; i++) {
+        const void *value = table->slots[i].value;
+        if (value && value != _HS_HTABLE_DELETED)
+            return i;
+    }
+
+    return SIZE_MAX;
+}
+
+static inline size_t _hs_htable_next_hash(const _hs_htable *table, uint32_t hash, size_t i)
+{
+    if (!table->capacity)
+        return SIZE_MAX;
+
+    // There is always at least one empty slot, so this ends
+    for (;; i++) {
+        const _hs_htable_slot *slot = &table->slots[i & (table->capacity - 1)];
+
+        if (!slot->value)
+            return SIZE_MAX;
+        if (slot->value != _HS_HTABLE_DELETED && slot->hash == hash)
+            return i & (table->capacity - 1);
+    }
 }
 
-/* While a break will only end the inner loop, the outer loop will subsequently fail
-   the cur == HS_UNIQUE_ID(head) test and thus break out of the outer loop too. */
+/* The inner loop runs once per slot and resets the flag when it completes, so a break
+   in the body leaves it set and ends the outer loop too. Removing the current value
+   with _hs_htable_remove() is allowed, adding values while iterating is not. */
 #define _hs_htable_foreach(cur, table) \
-    for (_hs_htable_head *_HS_UNIQUE_ID(head) = (_hs_htable_head *)(table)->heads, *cur = _HS_UNIQUE_ID(head), *_HS_UNIQUE_ID(next); \
-            cur == _HS_UNIQUE_ID(head) && _HS_UNIQUE_ID(head) < (_hs_htable_head *)((table)->heads + (table)->size); \
-            _HS_UNIQUE_ID(head) = (_hs_htable_head *)((_hs_htable_head **)_HS_UNIQUE_ID(head) + 1), cur = (_hs_htable_head *)((_hs_htable_head **)cur + 1)) \
-        for (cur = cur->next, _HS_UNIQUE_ID(next) = cur->next; cur != _HS_UNIQUE_ID(head); cur = _HS_UNIQUE_ID(next), _HS_UNIQUE_ID(next) = cur->next) \
+    for (size_t _HS_UNIQUE_ID(i) = _hs_htable_next((table), 0), _HS_UNIQUE_ID(brk) = 0; \
+         !_HS_UNIQUE_ID(brk) && _HS_UNIQUE_ID(i) != SIZE_MAX; \
+         _HS_UNIQUE_ID(i) = _hs_htable_next((table), _HS_UNIQUE_ID(i) + 1)) \
+        for (void *cur = (_HS_UNIQUE_ID(brk) = 1, (table)->slots[_HS_UNIQUE_ID(i)].value); \
+             _HS_UNIQUE_ID(brk); _HS_UNIQUE_ID(brk) = 0)
 
 #define _hs_htable_foreach_hash(cur, table, k) \
-    if ((table)->size) \
-        for (_hs_htable_head *_HS_UNIQUE_ID(head) = _hs_htable_get_head((table), (k)), *cur = _HS_UNIQUE_ID(head)->next, *_HS_UNIQUE_ID(next) = cur->next; \
-             cur != _HS_UNIQUE_ID(head); cur = _HS_UNIQUE_ID(next), _HS_UNIQUE_ID(next) = cur->next) \
-            if (cur->key == (k))
+    for (size_t _HS_UNIQUE_ID(hash) = (k), \
+                _HS_UNIQUE_ID(i) = _hs_htable_next_hash((table), (uint32_t)_HS_UNIQUE_ID(hash), _HS_UNIQUE_ID(hash)), \
+                _HS_UNIQUE_ID(brk) = 0; \
+         !_HS_UNIQUE_ID(brk) && _HS_UNIQUE_ID(i) != SIZE_MAX; \
+         _HS_UNIQUE_ID(i) = _hs_htable_next_hash((table), (uint32_t)_HS_UNIQUE_ID(hash), _HS_UNIQUE_ID(i) + 1)) \
+        for (void *cur = (_HS_UNIQUE_ID(brk) = 1, (table)->slots[_HS_UNIQUE_ID(i)].value); \
+             _HS_UNIQUE_ID(brk); _HS_UNIQUE_ID(brk) = 0)
 
 HS_END_C
 
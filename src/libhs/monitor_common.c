@@ -30,7 +30,7 @@ int hs_find(const hs_match_spec *matches, unsigned int count, hs_device **rdev)
 void _hs_monitor_clear_devices(_hs_htable *devices)
 {
     _hs_htable_foreach(cur, devices) {
-        hs_device *dev = _hs_container_of(cur, hs_device, hnode);
+        hs_device *dev = cur;
         hs_device_unref(dev);
     }
     _hs_htable_clear(devices);
@@ -39,7 +39,7 @@ void _hs_monitor_clear_devices(_hs_htable *devices)
 bool _hs_monitor_has_device(_hs_htable *devices, const char *key, uint8_t iface)
 {
     _hs_htable_foreach_hash(cur, devices, _hs_htable_hash_str(key)) {
-        hs_device *dev = _hs_container_of(cur, hs_device, hnode);
+        hs_device *dev = cur;
 
         if (strcmp(dev->key, key) == 0 && dev->iface_number == iface)
             return true;
@@ -50,11 +50,15 @@ bool _hs_monitor_has_device(_hs_htable *devices, const char *key, uint8_t iface)
 
 int _hs_monitor_add(_hs_htable *devices, hs_device *dev, hs_enumerate_func *f, void *udata)
 {
+    int r;
+
     if (_hs_monitor_has_device(devices, dev->key, dev->iface_number))
         return 0;
 
+    r = _hs_htable_add(devices, _hs_htable_hash_str(dev->key), dev);
+    if (r < 0)
+        return r;
     hs_device_ref(dev);
-    _hs_htable_add(devices, _hs_htable_hash_str(dev->key), &dev->hnode);
 
     _hs_device_log(dev, "Add");
 
@@ -68,8 +72,10 @@ int _hs_monitor_add(_hs_htable *devices, hs_device *dev, hs_enumerate_func *f, v
 void _hs_monitor_remove(_hs_htable *devices, const char *key, hs_enumerate_func *f,
                         void *udata)
 {
-    _hs_htable_foreach_hash(cur, devices, _hs_htable_hash_str(key)) {
-        hs_device *dev = _hs_container_of(cur, hs_device, hnode);
+    uint32_t hash = _hs_htable_hash_str(key);
+
+    _hs_htable_foreach_hash(cur, devices, hash) {
+        hs_device *dev = cur;
 
         if (strcmp(dev->key, key) == 0) {
             dev->status = HS_DEVICE_STATUS_DISCONNECTED;
@@ -79,7 +85,7 @@ void _hs_monitor_remove(_hs_htable *devices, const char *key, hs_enumerate_func
             if (f)
                 (*f)(dev, udata);
 
-            _hs_htable_remove(&dev->hnode);
+            _hs_htable_remove(devices, hash, dev);
             hs_device_unref(dev);
         }
     }
@@ -88,7 +94,7 @@ void _hs_monitor_remove(_hs_htable *devices, const char *key, hs_enumerate_func
 int _hs_monitor_list(_hs_htable *devices, hs_enumerate_func *f, void *udata)
 {
     _hs_htable_foreach(cur, devices) {
-        hs_device *dev = _hs_container_of(cur, hs_device, hnode);
+        hs_device *dev = cur;
         int r;
 
         r = (*f)(dev, udata);
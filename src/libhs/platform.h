@@ -79,6 +79,17 @@ typedef struct hs_poll_source {
  */
 uint64_t hs_millis(void);
 
+/**
+ * @ingroup misc
+ * @brief Get time from a high-resolution monotonic clock.
+ *
+ * Same as hs_millis(), with microsecond precision. Use it to measure short durations such
+ * as I/O latency, the value is not comparable with hs_millis().
+ *
+ * @return This function returns a mononotic time value in microseconds.
+ */
+uint64_t hs_micros(void);
+
 /**
  * @ingroup misc
  * @brief Adjust a timeout over a time period.
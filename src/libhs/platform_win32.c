@@ -52,6 +52,23 @@ uint64_t hs_millis(void)
     return GetTickCount64_();
 }
 
+uint64_t hs_micros(void)
+{
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER now;
+    BOOL success _HS_POSSIBLY_UNUSED;
+
+    if (!freq.QuadPart) {
+        success = QueryPerformanceFrequency(&freq);
+        assert(success);
+    }
+    success = QueryPerformanceCounter(&now);
+    assert(success);
+
+    return (uint64_t)now.QuadPart / (uint64_t)freq.QuadPart * 1000000 +
+           (uint64_t)now.QuadPart % (uint64_t)freq.QuadPart * 1000000 / (uint64_t)freq.QuadPart;
+}
+
 int hs_poll(hs_poll_source *sources, unsigned int count, int timeout)
 {
     assert(sources);
@@ -137,6 +137,26 @@ typedef enum hs_serial_config_xonxoff {
     HS_SERIAL_CONFIG_XONXOFF_INOUT
 } hs_serial_config_xonxoff;
 
+/**
+ * @ingroup serial
+ * @brief Supported serial latency modes.
+ *
+ * Low latency mode asks the driver to push received bytes to the application immediately
+ * instead of batching them (ASYNC_LOW_LATENCY on Linux). This is only supported by some
+ * drivers and is silently ignored otherwise, and on other platforms.
+ *
+ * @sa hs_serial_config
+ */
+typedef enum hs_serial_config_latency {
+    /** Leave this setting unchanged. */
+    HS_SERIAL_CONFIG_LATENCY_INVALID = 0,
+
+    /** Let the driver batch received data. */
+    HS_SERIAL_CONFIG_LATENCY_DEFAULT,
+    /** Favor latency over throughput. */
+    HS_SERIAL_CONFIG_LATENCY_LOW
+} hs_serial_config_latency;
+
 /**
  * @ingroup serial
  * @brief Serial device configuration.
@@ -164,6 +184,9 @@ typedef struct hs_serial_config {
     hs_serial_config_dtr dtr;
     /** Serial XON/XOFF (software) flow control. */
     hs_serial_config_xonxoff xonxoff;
+
+    /** Driver latency mode. */
+    hs_serial_config_latency latency;
 } hs_serial_config;
 
 /**
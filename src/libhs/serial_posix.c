@@ -13,10 +13,53 @@
 #include <sys/ioctl.h>
 #include <termios.h>
 #include <unistd.h>
+#ifdef __linux__
+    #include <linux/serial.h>
+#endif
 #include "device_priv.h"
 #include "platform.h"
 #include "serial.h"
 
+#ifdef __linux__
+
+static int set_low_latency(hs_port *port, bool enable)
+{
+    struct serial_struct ss;
+    int r;
+
+    r = ioctl(port->u.file.fd, TIOCGSERIAL, &ss);
+    if (r < 0) {
+        // Many USB serial drivers don't implement this, there is nothing to change then
+        if (errno == ENOTTY || errno == EINVAL) {
+            hs_log(HS_LOG_DEBUG, "Driver for '%s' does not support low latency mode", port->path);
+            return 0;
+        }
+        return hs_error(HS_ERROR_SYSTEM, "Unable to get serial latency mode of '%s': %s",
+                        port->path, strerror(errno));
+    }
+
+    if (enable) {
+        ss.flags = (int)((unsigned int)ss.flags | ASYNC_LOW_LATENCY);
+    } else {
+        ss.flags = (int)((unsigned int)ss.flags & ~(unsigned int)ASYNC_LOW_LATENCY);
+    }
+
+    r = ioctl(port->u.file.fd, TIOCSSERIAL, &ss);
+    if (r < 0) {
+        if (errno == ENOTTY || errno == EINVAL || errno == EPERM) {
+            hs_log(HS_LOG_DEBUG, "Cannot change latency mode of '%s': %s", port->path,
+                   strerror(errno));
+            return 0;
+        }
+        return hs_error(HS_ERROR_SYSTEM, "Unable to set serial latency mode of '%s': %s",
+                        port->path, strerror(errno));
+    }
+
+    return 0;
+}
+
+#endif
+
 int hs_serial_set_config(hs_port *port, const hs_serial_config *config)
 {
     assert(port);
@@ -162,6 +205,16 @@ int hs_serial_set_config(hs_port *port, const hs_serial_config *config)
         }
     }
 
+    switch (config->latency) {
+        case 0: {} break;
+        case HS_SERIAL_CONFIG_LATENCY_DEFAULT:
+        case HS_SERIAL_CONFIG_LATENCY_LOW: {} break;
+
+        default: {
+            return hs_error(HS_ERROR_SYSTEM, "Invalid latency setting: %d", config->latency);
+        } break;
+    }
+
     r = ioctl(port->u.file.fd, TIOCMSET, &modem_bits);
     if (r < 0)
         return hs_error(HS_ERROR_SYSTEM, "Unable to set modem bits of '%s': %s",
@@ -171,6 +224,14 @@ int hs_serial_set_config(hs_port *port, const hs_serial_config *config)
         return hs_error(HS_ERROR_SYSTEM, "Unable to change serial port settings of '%s': %s",
                         port->path, strerror(errno));
 
+#ifdef __linux__
+    if (config->latency) {
+        r = set_low_latency(port, config->latency == HS_SERIAL_CONFIG_LATENCY_LOW);
+        if (r < 0)
+            return r;
+    }
+#endif
+
     return 0;
 }
 
@@ -266,6 +327,17 @@ int hs_serial_get_config(hs_port *port, hs_serial_config *config)
         case IXOFF | IXON: { config->xonxoff = HS_SERIAL_CONFIG_XONXOFF_INOUT; } break;
     }
 
+#ifdef __linux__
+    {
+        struct serial_struct ss;
+
+        if (!ioctl(port->u.file.fd, TIOCGSERIAL, &ss)) {
+            config->latency = ((unsigned int)ss.flags & ASYNC_LOW_LATENCY) ? HS_SERIAL_CONFIG_LATENCY_LOW
+                                                            : HS_SERIAL_CONFIG_LATENCY_DEFAULT;
+        }
+    }
+#endif
+
     return 0;
 }
 
@@ -65,6 +65,10 @@ void ty_board_unref(ty_board *board)
         free(board->description);
 
         ty_mutex_release(&board->ifaces_lock);
+        ty_cond_release(&board->wait_cond);
+        for (size_t i = 0; i < board->wait_tasks.count; i++)
+            ty_task_unref(board->wait_tasks.values[i]);
+        _hs_array_release(&board->wait_tasks);
 
         for (size_t i = 0; i < board->ifaces.count; i++) {
             ty_board_interface *iface = board->ifaces.values[i];
@@ -307,7 +311,7 @@ int ty_board_wait_for(ty_board *board, ty_board_capability capability, int timeo
     ctx.board = board;
     ctx.capability = capability;
 
-    return ty_monitor_wait(monitor, wait_for_callback, &ctx, timeout);
+    return _ty_monitor_wait_board(monitor, board, wait_for_callback, &ctx, timeout);
 }
 
 ssize_t ty_board_serial_read(ty_board *board, char *buf, size_t size, int timeout)
@@ -339,6 +343,11 @@ ssize_t ty_board_serial_write(ty_board *board, const char *buf, size_t size)
     ty_board_interface *iface;
     ssize_t r;
 
+    // Don't keep writing to a board nobody wants anymore
+    r = _ty_task_check(ty_task_get_current());
+    if (r < 0)
+        return r;
+
     r = ty_board_open_interface(board, TY_BOARD_CAPABILITY_SERIAL, &iface);
     if (r < 0)
         return r;
@@ -351,11 +360,22 @@ ssize_t ty_board_serial_write(ty_board *board, const char *buf, size_t size)
     return r;
 }
 
-int ty_board_upload(ty_board *board, ty_firmware *fw, ty_board_upload_progress_func *pf, void *udata)
+static const struct _ty_class_vtable *get_board_class(ty_board *board)
 {
-    assert(board);
-    assert(fw);
+    const struct _ty_class_vtable *vtable = NULL;
+
+    ty_mutex_lock(&board->ifaces_lock);
+    if (board->ifaces.count)
+        vtable = board->ifaces.values[0]->class_vtable;
+    ty_mutex_unlock(&board->ifaces_lock);
+
+    return vtable;
+}
 
+// The plan is (re)computed if missing or made for another model
+static int upload_plan(ty_board *board, ty_firmware *fw, _ty_upload_plan **pplan,
+                       ty_board_upload_progress_func *pf, void *udata)
+{
     ty_board_interface *iface = NULL;
     int r;
 
@@ -368,13 +388,36 @@ int ty_board_upload(ty_board *board, ty_firmware *fw, ty_board_upload_progress_f
     }
     assert(board->model);
 
-    r = (*iface->class_vtable->upload)(iface, fw, pf, udata);
+    if (!*pplan || (*pplan)->model != iface->model || (*pplan)->fw != fw) {
+        _ty_upload_plan_free(*pplan);
+        *pplan = NULL;
+
+        r = (*iface->class_vtable->prepare_upload)(iface->model, fw, pplan);
+        if (r < 0)
+            goto cleanup;
+    }
+
+    r = (*iface->class_vtable->upload)(iface, *pplan, pf, udata);
 
 cleanup:
     ty_board_interface_close(iface);
     return r;
 }
 
+int ty_board_upload(ty_board *board, ty_firmware *fw, ty_board_upload_progress_func *pf, void *udata)
+{
+    assert(board);
+    assert(fw);
+
+    _ty_upload_plan *plan = NULL;
+    int r;
+
+    r = upload_plan(board, fw, &plan, pf, udata);
+    _ty_upload_plan_free(plan);
+
+    return r;
+}
+
 int ty_board_reset(ty_board *board)
 {
     assert(board);
@@ -524,29 +567,18 @@ static int new_board_task(ty_board *board, const char *action, int (*run)(ty_tas
     ty_task *task = NULL;
     int r;
 
-    if (board->current_task)
-        return ty_error(TY_ERROR_BUSY, "Board '%s' is busy on task '%s'", board->tag,
-                        board->current_task->name);
-
     snprintf(task_name_buf, sizeof(task_name_buf), "%s@%s", action, board->tag);
     r = ty_task_new(task_name_buf, run, &task);
     if (r < 0)
         return r;
 
-    board->current_task = ty_task_ref(task);
+    // Tasks for the same board run one after the other, in the order they are started
+    task->serial_key = board;
 
     *rtask = task;
     return 0;
 }
 
-static void cleanup_task_board(ty_board **board_ptr)
-{
-    ty_task_unref((*board_ptr)->current_task);
-    (*board_ptr)->current_task = NULL;
-    ty_board_unref(*board_ptr);
-    *board_ptr = NULL;
-}
-
 static int select_compatible_firmware(ty_board *board, ty_firmware **fws, unsigned int fws_count,
                                       ty_firmware **rfw)
 {
@@ -612,72 +644,169 @@ static void unref_upload_firmware(void *ptr)
     ty_firmware_unref(ptr);
 }
 
+/* Board tasks are state machines: when they need to wait for the board, they ask the
+   monitor to resume them on the next change to this board and return, so that waiting
+   does not hold a pool thread. The step functions below are simply called again. */
+enum board_task_state {
+    BOARD_TASK_START,
+    BOARD_TASK_WAIT_REBOOT,
+    BOARD_TASK_WAIT_FINAL
+};
+
+#define WAIT_SUSPENDED 2
+
+static void unwatch_board(ty_task *task, ty_board *board)
+{
+    if (board->monitor)
+        _ty_monitor_unwatch_board(board->monitor, board, task);
+}
+
+/* Returns 1 once the board has the capability, 0 if the timeout (started at start) has
+   expired, or WAIT_SUSPENDED if the task must return and will run again later. */
+static int wait_for_step(ty_task *task, ty_board *board, ty_board_capability capability,
+                         int timeout, uint64_t start)
+{
+    ty_monitor *monitor = board->monitor;
+    int r;
+
+    // We may be running again because of the timeout, don't stay registered twice
+    unwatch_board(task, board);
+
+    if (board->status == TY_BOARD_STATUS_DROPPED)
+        return ty_error(TY_ERROR_NOT_FOUND, "Board '%s' has disappeared", board->tag);
+    if (ty_board_has_capability(board, capability))
+        return 1;
+    timeout = _ty_task_adjust_timeout(task, ty_adjust_timeout(timeout, start));
+    if (!timeout)
+        return _ty_task_check(task);
+    if (!monitor)
+        return ty_error(TY_ERROR_NOT_FOUND, "Cannot wait on unmonitored board '%s'", board->tag);
+
+    // Tasks running inline (e.g. in ty_task_join) have to block
+    if (!_ty_task_suspend(task, timeout))
+        return ty_board_wait_for(board, capability, timeout);
+
+    /* Run again right away if the monitor cannot track us, and check the board in case
+       it changed before we got registered. */
+    r = _ty_monitor_watch_board(monitor, board, task);
+    if (r < 0 || board->status == TY_BOARD_STATUS_DROPPED ||
+            ty_board_has_capability(board, capability))
+        _ty_task_resume(task);
+
+    return WAIT_SUSPENDED;
+}
+
 static int run_upload(ty_task *task)
 {
     ty_board *board = task->u.upload.board;
-    ty_firmware *fw;
-    int flags = task->u.upload.flags, r;
+    ty_firmware *fw = task->u.upload.fw;
+    int r;
 
-    if (flags & TY_UPLOAD_NOCHECK) {
-        fw = task->u.upload.fws[0];
-    } else if (ty_models[board->model].mcu) {
-        r = select_compatible_firmware(board, task->u.upload.fws, task->u.upload.fws_count, &fw);
-        if (r < 0)
-            return r;
-    } else {
-        // Maybe we can identify the board and test the firmwares in bootloader mode?
-        fw = NULL;
-    }
+    switch ((enum board_task_state)task->u.upload.state) {
+        case BOARD_TASK_START: {
+            if (task->u.upload.flags & TY_UPLOAD_NOCHECK) {
+                fw = task->u.upload.fws[0];
+            } else if (ty_models[board->model].mcu) {
+                r = select_compatible_firmware(board, task->u.upload.fws,
+                                               task->u.upload.fws_count, &fw);
+                if (r < 0)
+                    return r;
+            } else {
+                // Maybe we can identify the board and test the firmwares in bootloader mode?
+                fw = NULL;
+            }
+            task->u.upload.fw = fw;
+
+            ty_log(TY_LOG_INFO, "Uploading to board '%s' (%s)", board->tag,
+                   ty_models[board->model].name);
+
+            // Can't upload directly, should we try to reboot or wait?
+            if (!ty_board_has_capability(board, TY_BOARD_CAPABILITY_UPLOAD)) {
+                if (task->u.upload.flags & TY_UPLOAD_WAIT) {
+                    ty_log(TY_LOG_INFO, "Waiting for device (press button to reboot)...");
+                } else {
+                    ty_log(TY_LOG_INFO, "Triggering board reboot");
+                    r = ty_board_reboot(board);
+                    if (r < 0)
+                        return r;
+                }
+            }
+            task->u.upload.wait_start = ty_millis();
 
-    ty_log(TY_LOG_INFO, "Uploading to board '%s' (%s)", board->tag, ty_models[board->model].name);
+            /* The board needs hundreds of milliseconds to reboot, prepare the upload in the
+               meantime. This is only possible if we know the model already. */
+            if (fw && ty_models[board->model].mcu) {
+                const struct _ty_class_vtable *vtable = get_board_class(board);
 
-    // Can't upload directly, should we try to reboot or wait?
-    if (!ty_board_has_capability(board, TY_BOARD_CAPABILITY_UPLOAD)) {
-        if (flags & TY_UPLOAD_WAIT) {
-            ty_log(TY_LOG_INFO, "Waiting for device (press button to reboot)...");
-        } else {
-            ty_log(TY_LOG_INFO, "Triggering board reboot");
-            r = ty_board_reboot(board);
+                if (vtable && vtable->prepare_upload) {
+                    uint64_t start = ty_micros();
+
+                    r = (*vtable->prepare_upload)(board->model, fw, &task->u.upload.plan);
+                    if (r < 0)
+                        return r;
+
+                    ty_log(TY_LOG_DEBUG, "Prepared %zu blocks (%u blank blocks skipped) in %.1f ms",
+                           task->u.upload.plan->blocks.count, task->u.upload.plan->skipped_count,
+                           (double)(ty_micros() - start) / 1000.0);
+                }
+            }
+
+            task->u.upload.state = BOARD_TASK_WAIT_REBOOT;
+        } // fallthrough
+
+        case BOARD_TASK_WAIT_REBOOT: {
+            r = wait_for_step(task, board, TY_BOARD_CAPABILITY_UPLOAD,
+                              task->u.upload.flags & TY_UPLOAD_WAIT ? -1 : MANUAL_REBOOT_DELAY,
+                              task->u.upload.wait_start);
             if (r < 0)
                 return r;
-        }
-    }
+            if (r == WAIT_SUSPENDED)
+                return 0;
+            if (!r) {
+                ty_log(TY_LOG_INFO, "Reboot didn't work, press button manually");
+                task->u.upload.flags |= TY_UPLOAD_WAIT;
 
-wait:
-    r = ty_board_wait_for(board, TY_BOARD_CAPABILITY_UPLOAD,
-                           flags & TY_UPLOAD_WAIT ? -1 : MANUAL_REBOOT_DELAY);
-    if (r < 0)
-        return r;
-    if (!r) {
-        ty_log(TY_LOG_INFO, "Reboot didn't work, press button manually");
-        flags |= TY_UPLOAD_WAIT;
+                return run_upload(task);
+            }
+            ty_log(TY_LOG_DEBUG, "Bootloader ready after %"PRIu64" ms",
+                   ty_millis() - task->u.upload.wait_start);
+
+            if (!fw) {
+                r = select_compatible_firmware(board, task->u.upload.fws,
+                                               task->u.upload.fws_count, &fw);
+                if (r < 0)
+                    return r;
+                task->u.upload.fw = fw;
+            }
 
-        goto wait;
-    }
+            r = upload_plan(board, fw, &task->u.upload.plan, upload_progress_callback, NULL);
+            if (r < 0)
+                return r;
 
-    if (!fw) {
-        r = select_compatible_firmware(board, task->u.upload.fws, task->u.upload.fws_count, &fw);
-        if (r < 0)
-            return r;
-    }
+            if (task->u.upload.flags & TY_UPLOAD_NORESET) {
+                ty_log(TY_LOG_INFO, "Firmware uploaded, reset the board to use it");
+                break;
+            }
 
-    r = ty_board_upload(board, fw, upload_progress_callback, NULL);
-    if (r < 0)
-        return r;
+            ty_log(TY_LOG_INFO, "Sending reset command");
+            r = ty_board_reset(board);
+            if (r < 0)
+                return r;
 
-    if (!(flags & TY_UPLOAD_NORESET)) {
-        ty_log(TY_LOG_INFO, "Sending reset command");
-        r = ty_board_reset(board);
-        if (r < 0)
-            return r;
+            task->u.upload.state = BOARD_TASK_WAIT_FINAL;
+            task->u.upload.wait_start = ty_millis();
+        } // fallthrough
 
-        r = ty_board_wait_for(board, TY_BOARD_CAPABILITY_RUN, FINAL_TASK_TIMEOUT);
-        if (r < 0)
-            return r;
-        if (!r)
-            return ty_error(TY_ERROR_TIMEOUT, "Failed to reset board '%s'", board->tag);
-    } else {
-        ty_log(TY_LOG_INFO, "Firmware uploaded, reset the board to use it");
+        case BOARD_TASK_WAIT_FINAL: {
+            r = wait_for_step(task, board, TY_BOARD_CAPABILITY_RUN, FINAL_TASK_TIMEOUT,
+                              task->u.upload.wait_start);
+            if (r < 0)
+                return r;
+            if (r == WAIT_SUSPENDED)
+                return 0;
+            if (!r)
+                return ty_error(TY_ERROR_TIMEOUT, "Failed to reset board '%s'", board->tag);
+        } break;
     }
 
     task->result = ty_firmware_ref(fw);
@@ -687,11 +816,14 @@ wait:
 
 static void finalize_upload(ty_task *task)
 {
+    unwatch_board(task, task->u.upload.board);
+    _ty_upload_plan_free(task->u.upload.plan);
+
     for (unsigned int i = 0; i < task->u.upload.fws_count; i++)
         ty_firmware_unref(task->u.upload.fws[i]);
     free(task->u.upload.fws);
 
-    cleanup_task_board(&task->u.upload.board);
+    ty_board_unref(task->u.upload.board);
 }
 
 int ty_upload(ty_board *board, ty_firmware **fws, unsigned int fws_count, int flags,
@@ -742,37 +874,62 @@ static int run_reset(ty_task *task)
     ty_board *board = task->u.reset.board;
     int r;
 
-    ty_log(TY_LOG_INFO, "Resetting board '%s' (%s)", board->tag, ty_models[board->model].name);
+    switch ((enum board_task_state)task->u.reset.state) {
+        case BOARD_TASK_START: {
+            ty_log(TY_LOG_INFO, "Resetting board '%s' (%s)", board->tag,
+                   ty_models[board->model].name);
 
-    if (!ty_board_has_capability(board, TY_BOARD_CAPABILITY_RESET) &&
-            ty_board_has_capability(board, TY_BOARD_CAPABILITY_REBOOT)) {
-        ty_log(TY_LOG_INFO, "Triggering board reboot");
-        r = ty_board_reboot(board);
-        if (r < 0)
-            return r;
+            if (!ty_board_has_capability(board, TY_BOARD_CAPABILITY_RESET) &&
+                    ty_board_has_capability(board, TY_BOARD_CAPABILITY_REBOOT)) {
+                ty_log(TY_LOG_INFO, "Triggering board reboot");
+                r = ty_board_reboot(board);
+                if (r < 0)
+                    return r;
 
-        r = ty_board_wait_for(board, TY_BOARD_CAPABILITY_RESET, MANUAL_REBOOT_DELAY);
-        if (r <= 0)
-            return ty_error(TY_ERROR_TIMEOUT, "Failed to reboot board '%s'", board->tag);
-    }
+                task->u.reset.state = BOARD_TASK_WAIT_REBOOT;
+                task->u.reset.wait_start = ty_millis();
+            } else {
+                goto reset;
+            }
+        } // fallthrough
 
-    ty_log(TY_LOG_INFO, "Sending reset command");
-    r = ty_board_reset(board);
-    if (r < 0)
-        return r;
+        case BOARD_TASK_WAIT_REBOOT: {
+            r = wait_for_step(task, board, TY_BOARD_CAPABILITY_RESET, MANUAL_REBOOT_DELAY,
+                              task->u.reset.wait_start);
+            if (r == WAIT_SUSPENDED)
+                return 0;
+            if (r <= 0)
+                return ty_error(TY_ERROR_TIMEOUT, "Failed to reboot board '%s'", board->tag);
 
-    r = ty_board_wait_for(board, TY_BOARD_CAPABILITY_RUN, FINAL_TASK_TIMEOUT);
-    if (r < 0)
-        return r;
-    if (!r)
-        return ty_error(TY_ERROR_TIMEOUT, "Failed to reset board '%s'", board->tag);
+reset:
+            ty_log(TY_LOG_INFO, "Sending reset command");
+            r = ty_board_reset(board);
+            if (r < 0)
+                return r;
+
+            task->u.reset.state = BOARD_TASK_WAIT_FINAL;
+            task->u.reset.wait_start = ty_millis();
+        } // fallthrough
+
+        case BOARD_TASK_WAIT_FINAL: {
+            r = wait_for_step(task, board, TY_BOARD_CAPABILITY_RUN, FINAL_TASK_TIMEOUT,
+                              task->u.reset.wait_start);
+            if (r < 0)
+                return r;
+            if (r == WAIT_SUSPENDED)
+                return 0;
+            if (!r)
+                return ty_error(TY_ERROR_TIMEOUT, "Failed to reset board '%s'", board->tag);
+        } break;
+    }
 
     return 0;
 }
 
 static void finalize_reset(ty_task *task)
 {
-    cleanup_task_board(&task->u.reset.board);
+    unwatch_board(task, task->u.reset.board);
+    ty_board_unref(task->u.reset.board);
 }
 
 int ty_reset(ty_board *board, ty_task **rtask)
@@ -798,30 +955,45 @@ static int run_reboot(ty_task *task)
     ty_board *board = task->u.reboot.board;
     int r;
 
-    ty_log(TY_LOG_INFO, "Rebooting board '%s' (%s)", board->tag, ty_models[board->model].name);
+    switch ((enum board_task_state)task->u.reboot.state) {
+        case BOARD_TASK_START: {
+            ty_log(TY_LOG_INFO, "Rebooting board '%s' (%s)", board->tag,
+                   ty_models[board->model].name);
 
-    if (ty_board_has_capability(board, TY_BOARD_CAPABILITY_UPLOAD)) {
-        ty_log(TY_LOG_INFO, "Board is already in bootloader mode");
-        return 0;
-    }
+            if (ty_board_has_capability(board, TY_BOARD_CAPABILITY_UPLOAD)) {
+                ty_log(TY_LOG_INFO, "Board is already in bootloader mode");
+                return 0;
+            }
 
-    ty_log(TY_LOG_INFO, "Triggering board reboot");
-    r = ty_board_reboot(board);
-    if (r < 0)
-        return r;
+            ty_log(TY_LOG_INFO, "Triggering board reboot");
+            r = ty_board_reboot(board);
+            if (r < 0)
+                return r;
 
-    r = ty_board_wait_for(board, TY_BOARD_CAPABILITY_UPLOAD, FINAL_TASK_TIMEOUT);
-    if (r < 0)
-        return r;
-    if (!r)
-        return ty_error(TY_ERROR_TIMEOUT, "Failed to reboot board '%s", board->tag);
+            task->u.reboot.state = BOARD_TASK_WAIT_FINAL;
+            task->u.reboot.wait_start = ty_millis();
+        } // fallthrough
+
+        case BOARD_TASK_WAIT_REBOOT:
+        case BOARD_TASK_WAIT_FINAL: {
+            r = wait_for_step(task, board, TY_BOARD_CAPABILITY_UPLOAD, FINAL_TASK_TIMEOUT,
+                              task->u.reboot.wait_start);
+            if (r < 0)
+                return r;
+            if (r == WAIT_SUSPENDED)
+                return 0;
+            if (!r)
+                return ty_error(TY_ERROR_TIMEOUT, "Failed to reboot board '%s", board->tag);
+        } break;
+    }
 
     return 0;
 }
 
 static void finalize_reboot(ty_task *task)
 {
-    cleanup_task_board(&task->u.reboot.board);
+    unwatch_board(task, task->u.reboot.board);
+    ty_board_unref(task->u.reboot.board);
 }
 
 int ty_reboot(ty_board *board, ty_task **rtask)
@@ -869,7 +1041,7 @@ static int run_send(ty_task *task)
 static void finalize_send(ty_task *task)
 {
     free(task->u.send.buf);
-    cleanup_task_board(&task->u.send.board);
+    ty_board_unref(task->u.send.board);
 }
 
 int ty_send(ty_board *board, const char *buf, size_t size, ty_task **rtask)
@@ -949,7 +1121,7 @@ static void finalize_send_file(ty_task *task)
     free(task->u.send_file.filename);
     if (task->u.send_file.fp)
         fclose(task->u.send_file.fp);
-    cleanup_task_board(&task->u.send_file.board);
+    ty_board_unref(task->u.send_file.board);
 }
 
 int ty_send_file(ty_board *board, const char *filename, ty_task **rtask)
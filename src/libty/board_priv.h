@@ -17,6 +17,7 @@
 #include "../libhs/array.h"
 #include "../libhs/device.h"
 #include "../libhs/htable.h"
+#include "monitor.h"
 #include "task.h"
 #include "thread.h"
 
@@ -26,7 +27,6 @@ struct ty_board_interface {
     const struct _ty_class_vtable *class_vtable;
     unsigned int refcount;
 
-    _hs_htable_head monitor_hnode;
     ty_board *board;
 
     const char *name;
@@ -61,9 +61,18 @@ struct ty_board {
     int capabilities;
     ty_board_interface *cap2iface[16];
 
-    ty_task *current_task;
+    // Protected by the monitor refresh mutex
+    ty_cond wait_cond;
+    unsigned int waiters;
+    _HS_ARRAY(ty_task *) wait_tasks;
+    bool wait_notify;
 };
 
+int _ty_monitor_wait_board(struct ty_monitor *monitor, ty_board *board,
+                           ty_monitor_wait_func *f, void *udata, int timeout);
+int _ty_monitor_watch_board(struct ty_monitor *monitor, ty_board *board, ty_task *task);
+void _ty_monitor_unwatch_board(struct ty_monitor *monitor, ty_board *board, ty_task *task);
+
 TY_C_END
 
 #endif
@@ -250,3 +250,13 @@ ty_model ty_models_find(const char *name)
 
     return 0;
 }
+
+void _ty_upload_plan_free(_ty_upload_plan *plan)
+{
+    if (plan) {
+        _hs_array_release(&plan->blocks);
+        _hs_array_release(&plan->data);
+    }
+
+    free(plan);
+}
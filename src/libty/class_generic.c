@@ -155,7 +155,8 @@ static ssize_t generic_serial_read(ty_board_interface *iface, char *buf, size_t
 
 static ssize_t generic_serial_write(ty_board_interface *iface, const char *buf, size_t size)
 {
-    ssize_t r = hs_serial_write(iface->port, (uint8_t *)buf, size, 5000);
+    ssize_t r = hs_serial_write(iface->port, (uint8_t *)buf, size,
+                                _ty_task_adjust_timeout(ty_task_get_current(), 5000));
     if (r < 0)
         return ty_libhs_translate_error((int)r);
     if (!r)
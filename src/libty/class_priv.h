@@ -14,10 +14,33 @@
 #include "common_priv.h"
 #include "board.h"
 #include "class.h"
+#include "../libhs/array.h"
 #include "../libhs/match.h"
 
 TY_C_BEGIN
 
+typedef struct _ty_upload_block {
+    uint32_t address;
+    // Offset of the padded block in _ty_upload_plan.data
+    size_t offset;
+    // Firmware bytes up to the end of this block, including skipped blocks
+    size_t progress;
+} _ty_upload_block;
+
+/* Everything an upload needs that only depends on the model and the firmware, so that it can
+   be computed while the board reboots to its bootloader. */
+typedef struct _ty_upload_plan {
+    ty_model model;
+    struct ty_firmware *fw;
+
+    size_t block_size;
+    _HS_ARRAY(_ty_upload_block) blocks;
+    _HS_ARRAY(uint8_t) data;
+    size_t total_size;
+
+    unsigned int skipped_count;
+} _ty_upload_plan;
+
 struct _ty_class_vtable {
     int (*load_interface)(ty_board_interface *iface);
     int (*update_board)(ty_board_interface *iface, ty_board *board, bool new_board);
@@ -28,7 +51,8 @@ struct _ty_class_vtable {
     void (*close_interface)(ty_board_interface *iface);
     ssize_t (*serial_read)(ty_board_interface *iface, char *buf, size_t size, int timeout);
     ssize_t (*serial_write)(ty_board_interface *iface, const char *buf, size_t size);
-    int (*upload)(ty_board_interface *iface, struct ty_firmware *fw,
+    int (*prepare_upload)(ty_model model, struct ty_firmware *fw, _ty_upload_plan **rplan);
+    int (*upload)(ty_board_interface *iface, const _ty_upload_plan *plan,
                   ty_board_upload_progress_func *pf, void *udata);
     int (*reset)(ty_board_interface *iface);
     int (*reboot)(ty_board_interface *iface);
@@ -45,6 +69,8 @@ extern const unsigned int _ty_classes_count;
 extern const hs_match_spec *_ty_class_match_specs;
 extern unsigned int _ty_class_match_specs_count;
 
+void _ty_upload_plan_free(_ty_upload_plan *plan);
+
 TY_C_END
 
 #endif
@@ -338,15 +338,46 @@ static uint64_t read_uint64_le(const uint8_t *ptr)
            ((uint64_t)ptr[7] << 56);
 }
 
+struct teensy3_layout {
+    ty_model model;
+
+    uint32_t stack_addr;
+    uint32_t vectors_size;
+};
+
+/* Teensy 3.x models are recognized by the initial stack pointer and the size of the interrupt
+   vector table, see teensy_identify_models(). Some layouts match several models. */
+static const struct teensy3_layout teensy3_layouts[] = {
+    {TY_MODEL_TEENSY_30, 0x20002000, 0xF8},
+    {TY_MODEL_TEENSY_31, 0x20008000, 0x1BC},
+    {TY_MODEL_TEENSY_32, 0x20008000, 0x1BC},
+    {TY_MODEL_TEENSY_LC, 0x20001800, 0xC0},
+    {TY_MODEL_TEENSY_35, 0x20020000, 0x198},
+    {TY_MODEL_TEENSY_35, 0x2002FFFC, 0x198},
+    {TY_MODEL_TEENSY_35, 0x2002FFF8, 0x198},
+    {TY_MODEL_TEENSY_36, 0x20030000, 0x1D0}
+};
+
+// Model-specific machine code in _reboot_Teensyduino_() (jmp 0x7E00/0x3F00/0xFE00 + cli)
+static const ty_firmware_signature teensy_avr_signatures[] = {
+    {TY_MODEL_TEENSY_PP_10, {0x0C, 0x94, 0x00, 0x7E, 0xFF, 0xCF, 0xF8, 0x94}, 8},
+    {TY_MODEL_TEENSY_20,    {0x0C, 0x94, 0x00, 0x3F, 0xFF, 0xCF, 0xF8, 0x94}, 8},
+    {TY_MODEL_TEENSY_PP_20, {0x0C, 0x94, 0x00, 0xFE, 0xFF, 0xCF, 0xF8, 0x94}, 8}
+};
+
+static const ty_firmware_signature teensy3_padding_signature =
+    {TY_MODEL_GENERIC, {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF}, 8};
+
 static unsigned int teensy_identify_models(const ty_firmware *fw, ty_model *rmodels,
                                            unsigned int max_models)
 {
-    const ty_firmware_segment *segment0 = ty_firmware_find_segment(fw, 0);
-    const ty_firmware_segment *teensy4_segment = ty_firmware_find_segment(fw, 0x60000000);
+    uint8_t teensy4_header[8];
+    uint8_t teensy3_startup[0x400];
 
     // First, try the Teensy 4.0
-    if (teensy4_segment && teensy4_segment->size >= sizeof(uint64_t)) {
-        uint64_t flash_config_8 = read_uint64_le(teensy4_segment->data);
+    if (ty_firmware_extract(fw, 0x60000000, teensy4_header,
+                            sizeof(teensy4_header)) == sizeof(teensy4_header)) {
+        uint64_t flash_config_8 = read_uint64_le(teensy4_header);
 
         if (flash_config_8 == 0x5601000042464346) {
             unsigned int models_count = 0;
@@ -371,75 +402,54 @@ static unsigned int teensy_identify_models(const ty_firmware *fw, ty_model *rmod
 
        We combine the size of _VectorsFlash[] and the initial stack pointer value to
        differenciate models. */
-    if (segment0) {
-        const uint32_t teensy3_startup_size = 0x400;
-        if (segment0->size >= teensy3_startup_size) {
-            uint32_t stack_addr;
-            uint32_t end_vector_addr;
-            unsigned int arm_models_count = 0;
-
-            stack_addr = read_uint32_le(segment0->data);
-            end_vector_addr = read_uint32_le(segment0->data + 4) & ~1u;
-            if (end_vector_addr >= teensy3_startup_size) {
-                for (uint32_t i = 0; i < teensy3_startup_size - sizeof(uint64_t); i += 4) {
-                    if (read_uint64_le(segment0->data + i) == 0xFFFFFFFFFFFFFFFF) {
-                        end_vector_addr = i;
-                        break;
-                    }
+    if (ty_firmware_extract(fw, 0, teensy3_startup,
+                            sizeof(teensy3_startup)) == sizeof(teensy3_startup)) {
+        const uint32_t teensy3_startup_size = sizeof(teensy3_startup);
+        uint32_t stack_addr;
+        uint32_t end_vector_addr;
+        unsigned int arm_models_count = 0;
+
+        stack_addr = read_uint32_le(teensy3_startup);
+        end_vector_addr = read_uint32_le(teensy3_startup + 4) & ~1u;
+        if (end_vector_addr >= teensy3_startup_size) {
+            size_t offset = 0;
+
+            // Vector entries are 4-byte aligned, the padding after them is too
+            while (offset < teensy3_startup_size) {
+                size_t found;
+
+                if (!ty_firmware_search_signatures(teensy3_startup + offset,
+                                                   teensy3_startup_size - offset,
+                                                   &teensy3_padding_signature, 1, &found))
+                    break;
+
+                offset += found;
+                if (!(offset % 4)) {
+                    end_vector_addr = (uint32_t)offset;
+                    break;
                 }
+                offset = (offset + 3) & ~(size_t)3;
             }
+        }
 
-            switch (((uint64_t)stack_addr << 32) | end_vector_addr) {
-                case 0x20002000000000F8: {
-                    rmodels[arm_models_count++] = TY_MODEL_TEENSY_30;
-                } break;
-                case 0x20008000000001BC: {
-                    rmodels[arm_models_count++] = TY_MODEL_TEENSY_31;
-                    if (max_models >= 2)
-                        rmodels[arm_models_count++] = TY_MODEL_TEENSY_32;
-                } break;
-                case 0x20001800000000C0: {
-                    rmodels[arm_models_count++] = TY_MODEL_TEENSY_LC;
-                } break;
-                case 0x2002000000000198:
-                case 0x2002FFFC00000198:
-                case 0x2002FFF800000198: {
-                    rmodels[arm_models_count++] = TY_MODEL_TEENSY_35;
-                } break;
-                case 0x20030000000001D0: {
-                    rmodels[arm_models_count++] = TY_MODEL_TEENSY_36;
-                } break;
-            }
-            if (arm_models_count)
-                return arm_models_count;
+        for (unsigned int i = 0; i < TY_COUNTOF(teensy3_layouts); i++) {
+            const struct teensy3_layout *layout = &teensy3_layouts[i];
+
+            if (layout->stack_addr == stack_addr && layout->vectors_size == end_vector_addr &&
+                    arm_models_count < max_models)
+                rmodels[arm_models_count++] = layout->model;
         }
+        if (arm_models_count)
+            return arm_models_count;
     }
 
-    /* Now try AVR Teensies. We search for machine code that matches model-specific code in
-       _reboot_Teensyduino_(). Not elegant, but it does the work. */
+    // Now try AVR Teensies
     if (fw->max_address <= 130048) {
-        for (unsigned int i = 0; i < fw->segments_count; i++) {
-            const ty_firmware_segment *segment = &fw->segments[i];
-            if (segment->size < sizeof(uint64_t))
-                continue;
-
-            for (size_t j = 0; j < segment->size - sizeof(uint64_t); j++) {
-                uint64_t magic_value = read_uint64_le(segment->data + j);
-                switch (magic_value) {
-                    case 0x94F8CFFF7E00940C: {
-                        rmodels[0] = TY_MODEL_TEENSY_PP_10;
-                        return 1;
-                    } break;
-                    case 0x94F8CFFF3F00940C: {
-                        rmodels[0] = TY_MODEL_TEENSY_20;
-                        return 1;
-                    } break;
-                    case 0x94F8CFFFFE00940C: {
-                        rmodels[0] = TY_MODEL_TEENSY_PP_20;
-                        return 1;
-                    } break;
-                }
-            }
+        const ty_firmware_signature *sig = ty_firmware_find_signature(fw, teensy_avr_signatures,
+                                                                      TY_COUNTOF(teensy_avr_signatures));
+        if (sig) {
+            rmodels[0] = sig->model;
+            return 1;
         }
     }
 
@@ -484,7 +494,8 @@ static ssize_t teensy_serial_write(ty_board_interface *iface, const char *buf, s
 
     switch (iface->dev->type) {
         case HS_DEVICE_TYPE_SERIAL: {
-            r = hs_serial_write(iface->port, (uint8_t *)buf, size, 5000);
+            r = hs_serial_write(iface->port, (uint8_t *)buf, size,
+                                _ty_task_adjust_timeout(ty_task_get_current(), 5000));
             if (r < 0)
                 return ty_libhs_translate_error((int)r);
             if (!r)
@@ -522,6 +533,7 @@ static ssize_t teensy_serial_write(ty_board_interface *iface, const char *buf, s
 static int halfkay_send(hs_port *port, unsigned int halfkay_version, size_t block_size,
                         size_t addr, const void *data, size_t size, unsigned int timeout)
 {
+    ty_task *task = ty_task_get_current();
     uint8_t buf[2048] = {0};
     uint64_t start;
 
@@ -571,6 +583,13 @@ static int halfkay_send(hs_port *port, unsigned int halfkay_version, size_t bloc
 restart:
     r = hs_hid_write(port, buf, size);
     if (r == HS_ERROR_IO && ty_millis() - start < timeout) {
+        // Give up right away on boards the task owner has abandoned
+        int r2 = _ty_task_check(task);
+        if (r2 < 0) {
+            hs_error_unmask();
+            return r2;
+        }
+
         ty_delay(20);
         goto restart;
     }
@@ -668,46 +687,119 @@ static int get_halfkay_settings(ty_model model, unsigned int *rhalfkay_version,
     return 0;
 }
 
-static int teensy_upload(ty_board_interface *iface, ty_firmware *fw,
+static bool is_block_blank(const uint8_t *block, size_t size)
+{
+    for (size_t i = 0; i < size; i++) {
+        if (block[i] != 0xFF)
+            return false;
+    }
+
+    return true;
+}
+
+/* Like teensy_loader_cli, we skip blocks without any data and blank blocks (all 0xFF):
+   HalfKay erases the whole flash when it receives the first block. */
+static int teensy_prepare_upload(ty_model model, ty_firmware *fw, _ty_upload_plan **rplan)
+{
+    unsigned int halfkay_version;
+    size_t min_address, max_address, block_size;
+    _ty_upload_plan *plan = NULL;
+    int r;
+
+    r = get_halfkay_settings(model, &halfkay_version, &min_address, &max_address, &block_size);
+    if (r < 0)
+        goto error;
+
+    if (fw->max_address > max_address) {
+        r = ty_error(TY_ERROR_RANGE, "Firmware is too big for %s", ty_models[model].name);
+        goto error;
+    }
+
+    plan = calloc(1, sizeof(*plan));
+    if (!plan) {
+        r = ty_error(TY_ERROR_MEMORY, NULL);
+        goto error;
+    }
+    plan->model = model;
+    plan->fw = fw;
+    plan->block_size = block_size;
+
+    for (size_t address = min_address; address < fw->max_address; address += block_size) {
+        _ty_upload_block *block;
+        uint8_t *data;
+        size_t data_len;
+
+        r = _hs_array_grow(&plan->data, block_size);
+        if (r < 0) {
+            r = ty_libhs_translate_error(r);
+            goto error;
+        }
+        data = plan->data.values + plan->data.count;
+
+        memset(data, 0xFF, block_size);
+        data_len = ty_firmware_extract(fw, (uint32_t)address, data, block_size);
+        if (!data_len)
+            continue;
+        plan->total_size += data_len;
+
+        if (plan->blocks.count && is_block_blank(data, block_size)) {
+            plan->blocks.values[plan->blocks.count - 1].progress = plan->total_size;
+            plan->skipped_count++;
+            continue;
+        }
+
+        r = _hs_array_grow(&plan->blocks, 1);
+        if (r < 0) {
+            r = ty_libhs_translate_error(r);
+            goto error;
+        }
+        block = &plan->blocks.values[plan->blocks.count++];
+        block->address = (uint32_t)address;
+        block->offset = plan->data.count;
+        block->progress = plan->total_size;
+
+        plan->data.count += block_size;
+    }
+
+    *rplan = plan;
+    return 0;
+
+error:
+    _ty_upload_plan_free(plan);
+    return r;
+}
+
+static int teensy_upload(ty_board_interface *iface, const _ty_upload_plan *plan,
                          ty_board_upload_progress_func *pf, void *udata)
 {
     unsigned int halfkay_version;
     size_t min_address, max_address, block_size;
     int r;
 
+    assert(plan->model == iface->model);
+
     r = get_halfkay_settings(iface->model, &halfkay_version, &min_address, &max_address, &block_size);
     if (r < 0)
         return r;
 
-    if (fw->max_address > max_address)
-        return ty_error(TY_ERROR_RANGE, "Firmware is too big for %s",
-                        ty_models[iface->model].name);
-
     if (pf) {
-        r = (*pf)(iface->board, fw, 0, max_address - min_address, udata);
+        r = (*pf)(iface->board, plan->fw, 0, max_address - min_address, udata);
         if (r)
             return r;
     }
 
-    size_t uploaded_len = 0;
-    for (size_t address = min_address; address < fw->max_address; address += block_size) {
-        uint8_t buf[8192];
-        size_t buf_len;
+    for (size_t i = 0; i < plan->blocks.count; i++) {
+        const _ty_upload_block *block = &plan->blocks.values[i];
 
-        memset(buf, 0, sizeof(buf));
-        buf_len = ty_firmware_extract(fw, (uint32_t)address, buf, block_size);
+        r = halfkay_send(iface->port, halfkay_version, plan->block_size, block->address,
+                         plan->data.values + block->offset, plan->block_size, 3000);
+        if (r < 0)
+            return r;
 
-        if (buf_len) {
-            r = halfkay_send(iface->port, halfkay_version, block_size, address, buf, buf_len, 3000);
-            if (r < 0)
+        if (pf) {
+            r = (*pf)(iface->board, plan->fw, block->progress, max_address - min_address, udata);
+            if (r)
                 return r;
-            uploaded_len += buf_len;
-
-            if (pf) {
-                r = (*pf)(iface->board, fw, uploaded_len, max_address - min_address, udata);
-                if (r)
-                    return r;
-            }
         }
     }
 
@@ -769,6 +861,7 @@ const struct _ty_class_vtable _ty_teensy_class_vtable = {
     .close_interface = teensy_close_interface,
     .serial_read = teensy_serial_read,
     .serial_write = teensy_serial_write,
+    .prepare_upload = teensy_prepare_upload,
     .upload = teensy_upload,
     .reset = teensy_reset,
     .reboot = teensy_reboot
@@ -23,6 +23,7 @@ int ty_config_verbosity = TY_LOG_INFO;
 
 static ty_message_func *message_handler = ty_message_default_handler;
 static void *message_handler_udata = NULL;
+static ty_message_queue *message_queue = NULL;
 
 static TY_THREAD_LOCAL ty_err error_masks[16];
 static TY_THREAD_LOCAL unsigned int error_masks_count;
@@ -153,6 +154,7 @@ static const char *generic_error(int err)
         case TY_ERROR_RANGE: { return "Out of range error"; } break;
         case TY_ERROR_SYSTEM: { return "System error"; } break;
         case TY_ERROR_PARSE: { return "Parse error"; } break;
+        case TY_ERROR_CANCELED: { return "Canceled"; } break;
 
         case TY_ERROR_OTHER: {} break;
     }
@@ -237,6 +239,354 @@ void ty_progress(const char *action, uint64_t value, uint64_t max)
     ty_message(&msg);
 }
 
+/* Messages are copied to a ring of message_slot. Producers claim slots with a CAS on
+   push_pos, and the sequence number of each slot tells who owns it: pos when it is
+   free for producer pos, pos + 1 once the message is ready for the consumer. When the
+   ring is full, progress messages are dropped and other messages go to an unbounded
+   lock-free stack, which keeps receiving them until the consumer has emptied it to
+   preserve ordering. */
+
+struct message_copy {
+    ty_message_data msg;
+    char ctx[64];
+    char text[sizeof(last_error_msg)];
+};
+
+struct message_slot {
+    unsigned int sequence;
+    struct message_copy copy;
+};
+
+struct overflow_message {
+    struct overflow_message *next;
+    struct message_copy copy;
+};
+
+struct ty_message_queue {
+    struct message_slot *slots;
+    unsigned int mask;
+
+    unsigned int push_pos;
+    unsigned int pop_pos;
+
+    struct overflow_message *overflow;
+    unsigned int overflow_count;
+
+    unsigned int notified;
+    unsigned int dropped;
+
+    void (*notify)(void *udata);
+    void *notify_udata;
+};
+
+static inline unsigned int load_uint(unsigned int *ptr)
+{
+#ifdef _MSC_VER
+    return (unsigned int)InterlockedOr((LONG volatile *)ptr, 0);
+#else
+    return __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
+#endif
+}
+
+static inline void store_uint(unsigned int *ptr, unsigned int value)
+{
+#ifdef _MSC_VER
+    InterlockedExchange((LONG volatile *)ptr, (LONG)value);
+#else
+    __atomic_store_n(ptr, value, __ATOMIC_RELEASE);
+#endif
+}
+
+static inline unsigned int exchange_uint(unsigned int *ptr, unsigned int value)
+{
+#ifdef _MSC_VER
+    return (unsigned int)InterlockedExchange((LONG volatile *)ptr, (LONG)value);
+#else
+    return __atomic_exchange_n(ptr, value, __ATOMIC_ACQ_REL);
+#endif
+}
+
+static inline unsigned int add_uint(unsigned int *ptr, unsigned int value)
+{
+#ifdef _MSC_VER
+    return (unsigned int)InterlockedExchangeAdd((LONG volatile *)ptr, (LONG)value) + value;
+#else
+    return __atomic_add_fetch(ptr, value, __ATOMIC_ACQ_REL);
+#endif
+}
+
+static inline bool cas_uint(unsigned int *ptr, unsigned int expected, unsigned int value)
+{
+#ifdef _MSC_VER
+    return (unsigned int)InterlockedCompareExchange((LONG volatile *)ptr, (LONG)value,
+                                                   (LONG)expected) == expected;
+#else
+    return __atomic_compare_exchange_n(ptr, &expected, value, false, __ATOMIC_ACQ_REL,
+                                       __ATOMIC_RELAXED);
+#endif
+}
+
+static inline bool cas_ptr(void **ptr, void *expected, void *value)
+{
+#ifdef _MSC_VER
+    return InterlockedCompareExchangePointer(ptr, value, expected) == expected;
+#else
+    return __atomic_compare_exchange_n(ptr, &expected, value, false, __ATOMIC_ACQ_REL,
+                                       __ATOMIC_RELAXED);
+#endif
+}
+
+static inline void *exchange_ptr(void **ptr, void *value)
+{
+#ifdef _MSC_VER
+    return InterlockedExchangePointer(ptr, value);
+#else
+    return __atomic_exchange_n(ptr, value, __ATOMIC_ACQ_REL);
+#endif
+}
+
+static void copy_message(struct message_copy *copy, const ty_message_data *msg)
+{
+    copy->msg = *msg;
+
+    if (msg->ctx) {
+        strncpy(copy->ctx, msg->ctx, sizeof(copy->ctx) - 1);
+        copy->ctx[sizeof(copy->ctx) - 1] = 0;
+        copy->msg.ctx = copy->ctx;
+    }
+
+    switch (msg->type) {
+        case TY_MESSAGE_LOG: {
+            strncpy(copy->text, msg->u.log.msg, sizeof(copy->text) - 1);
+            copy->text[sizeof(copy->text) - 1] = 0;
+            copy->msg.u.log.msg = copy->text;
+        } break;
+        case TY_MESSAGE_PROGRESS: {
+            strncpy(copy->text, msg->u.progress.action, sizeof(copy->text) - 1);
+            copy->text[sizeof(copy->text) - 1] = 0;
+            copy->msg.u.progress.action = copy->text;
+        } break;
+        case TY_MESSAGE_STATUS: {
+        } break;
+    }
+
+    // The consumer drops this reference once the message is dispatched
+    if (msg->task)
+        ty_task_ref(msg->task);
+}
+
+static bool push_ring(ty_message_queue *queue, const ty_message_data *msg)
+{
+    unsigned int pos = load_uint(&queue->push_pos);
+    struct message_slot *slot;
+
+    while (true) {
+        int diff;
+
+        slot = &queue->slots[pos & queue->mask];
+        diff = (int)(load_uint(&slot->sequence) - pos);
+
+        if (!diff) {
+            if (cas_uint(&queue->push_pos, pos, pos + 1))
+                break;
+        } else if (diff < 0) {
+            return false;
+        }
+        pos = load_uint(&queue->push_pos);
+    }
+
+    copy_message(&slot->copy, msg);
+    store_uint(&slot->sequence, pos + 1);
+
+    return true;
+}
+
+static bool push_overflow(ty_message_queue *queue, const ty_message_data *msg)
+{
+    struct overflow_message *node;
+
+    node = malloc(sizeof(*node));
+    if (!node)
+        return false;
+    copy_message(&node->copy, msg);
+
+    do {
+        node->next = queue->overflow;
+    } while (!cas_ptr((void **)&queue->overflow, node->next, node));
+
+    return true;
+}
+
+// Returns false if the message must be dispatched synchronously
+static bool push_message(ty_message_queue *queue, const ty_message_data *msg)
+{
+    bool overflow;
+
+    // Stay on the overflow stack until the consumer has emptied it
+    overflow = load_uint(&queue->overflow_count) || !push_ring(queue, msg);
+    if (overflow) {
+        if (msg->type == TY_MESSAGE_PROGRESS) {
+            add_uint(&queue->dropped, 1);
+            return true;
+        }
+
+        add_uint(&queue->overflow_count, 1);
+        if (!push_overflow(queue, msg)) {
+            add_uint(&queue->overflow_count, (unsigned int)-1);
+            return false;
+        }
+    }
+
+    if (!exchange_uint(&queue->notified, 1) && queue->notify)
+        (*queue->notify)(queue->notify_udata);
+
+    return true;
+}
+
+static void dispatch_message(ty_message_data *msg)
+{
+    ty_task *task = msg->task;
+
+    (*message_handler)(msg, message_handler_udata);
+    if (task && task->user_callback)
+        (*task->user_callback)(msg, task->user_callback_udata);
+}
+
+int ty_message_queue_new(unsigned int size, void (*notify)(void *udata), void *udata,
+                         ty_message_queue **rqueue)
+{
+    assert(size);
+    assert(rqueue);
+
+    ty_message_queue *queue;
+    unsigned int capacity;
+
+    capacity = 2;
+    while (capacity < size && capacity < (1u << 20))
+        capacity *= 2;
+
+    queue = calloc(1, sizeof(*queue));
+    if (!queue)
+        return ty_error(TY_ERROR_MEMORY, NULL);
+    queue->slots = malloc(capacity * sizeof(*queue->slots));
+    if (!queue->slots) {
+        free(queue);
+        return ty_error(TY_ERROR_MEMORY, NULL);
+    }
+    for (unsigned int i = 0; i < capacity; i++)
+        queue->slots[i].sequence = i;
+    queue->mask = capacity - 1;
+
+    queue->notify = notify;
+    queue->notify_udata = udata;
+
+    *rqueue = queue;
+    return 0;
+}
+
+void ty_message_queue_free(ty_message_queue *queue)
+{
+    if (queue) {
+        assert(message_queue != queue);
+
+        while (queue->slots[queue->pop_pos & queue->mask].sequence == queue->pop_pos + 1) {
+            ty_task_unref(queue->slots[queue->pop_pos & queue->mask].copy.msg.task);
+            queue->pop_pos++;
+        }
+        while (queue->overflow) {
+            struct overflow_message *node = queue->overflow;
+
+            queue->overflow = node->next;
+            ty_task_unref(node->copy.msg.task);
+            free(node);
+        }
+
+        free(queue->slots);
+    }
+
+    free(queue);
+}
+
+unsigned int ty_message_queue_dispatch(ty_message_queue *queue, unsigned int max)
+{
+    assert(queue);
+
+    unsigned int count = 0;
+
+    // Producers notify again if they push something after this point
+    store_uint(&queue->notified, 0);
+
+    while (count < max) {
+        struct message_slot *slot = &queue->slots[queue->pop_pos & queue->mask];
+        struct message_copy copy;
+
+        if (load_uint(&slot->sequence) != queue->pop_pos + 1)
+            break;
+
+        // Free the slot before calling the handlers, they may log more messages
+        copy = slot->copy;
+        store_uint(&slot->sequence, queue->pop_pos + queue->mask + 1);
+        queue->pop_pos++;
+
+        if (copy.msg.ctx)
+            copy.msg.ctx = copy.ctx;
+        if (copy.msg.type == TY_MESSAGE_LOG) {
+            copy.msg.u.log.msg = copy.text;
+        } else if (copy.msg.type == TY_MESSAGE_PROGRESS) {
+            copy.msg.u.progress.action = copy.text;
+        }
+        dispatch_message(&copy.msg);
+        ty_task_unref(copy.msg.task);
+
+        count++;
+    }
+
+    // Overflow messages are more recent than anything in the ring
+    if (count < max && load_uint(&queue->overflow_count)) {
+        struct overflow_message *nodes, *reversed = NULL;
+        unsigned int taken = 0;
+
+        nodes = exchange_ptr((void **)&queue->overflow, NULL);
+        while (nodes) {
+            struct overflow_message *next = nodes->next;
+
+            nodes->next = reversed;
+            reversed = nodes;
+            nodes = next;
+            taken++;
+        }
+        add_uint(&queue->overflow_count, (unsigned int)-(int)taken);
+
+        while (reversed) {
+            struct overflow_message *node = reversed;
+
+            reversed = node->next;
+            dispatch_message(&node->copy.msg);
+            ty_task_unref(node->copy.msg.task);
+            free(node);
+
+            count++;
+        }
+    }
+
+    // Ask for another round if we stopped early
+    if (count >= max && !exchange_uint(&queue->notified, 1) && queue->notify)
+        (*queue->notify)(queue->notify_udata);
+
+    return count;
+}
+
+unsigned int ty_message_queue_get_dropped(ty_message_queue *queue)
+{
+    assert(queue);
+    return load_uint(&queue->dropped);
+}
+
+void ty_message_redirect_queue(ty_message_queue *queue)
+{
+    message_queue = queue;
+}
+
 void ty_message(ty_message_data *msg)
 {
     ty_task *task = msg->task;
@@ -247,9 +597,10 @@ void ty_message(ty_message_data *msg)
     if (!msg->ctx && task)
         msg->ctx = task->name;
 
-    (*message_handler)(msg, message_handler_udata);
-    if (task && task->user_callback)
-        (*task->user_callback)(msg, task->user_callback_udata);
+    if (message_queue && push_message(message_queue, msg))
+        return;
+
+    dispatch_message(msg);
 }
 
 int ty_libhs_translate_error(int err)
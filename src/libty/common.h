@@ -105,7 +105,8 @@ typedef enum ty_err {
     TY_ERROR_RANGE         = -11,
     TY_ERROR_SYSTEM        = -12,
     TY_ERROR_PARSE         = -13,
-    TY_ERROR_OTHER         = -14
+    TY_ERROR_OTHER         = -14,
+    TY_ERROR_CANCELED      = -15
 } ty_err;
 
 typedef enum ty_message_type {
@@ -152,6 +153,8 @@ typedef struct ty_message_data {
 
 typedef void ty_message_func(const ty_message_data *msg, void *udata);
 
+typedef struct ty_message_queue ty_message_queue;
+
 extern int ty_config_verbosity;
 
 const char *ty_version_string(void);
@@ -159,6 +162,13 @@ const char *ty_version_string(void);
 void ty_message_default_handler(const ty_message_data *msg, void *udata);
 void ty_message_redirect(ty_message_func *f, void *udata);
 
+int ty_message_queue_new(unsigned int size, void (*notify)(void *udata), void *udata,
+                         ty_message_queue **rqueue);
+void ty_message_queue_free(ty_message_queue *queue);
+unsigned int ty_message_queue_dispatch(ty_message_queue *queue, unsigned int max);
+unsigned int ty_message_queue_get_dropped(ty_message_queue *queue);
+void ty_message_redirect_queue(ty_message_queue *queue);
+
 void ty_error_mask(ty_err err);
 void ty_error_unmask(void);
 bool ty_error_is_masked(int err);
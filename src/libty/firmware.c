@@ -13,10 +13,12 @@
 #include "class_priv.h"
 #include "firmware.h"
 #include "system.h"
+#include "task.h"
 
 const ty_firmware_format ty_firmware_formats[] = {
-    {"elf",  ".elf", ty_firmware_load_elf},
-    {"ihex", ".hex", ty_firmware_load_ihex}
+    {"elf",   ".elf", ty_firmware_load_elf, NULL, ty_firmware_load_elf_file},
+    {"ihex",  ".hex", ty_firmware_load_ihex, ty_firmware_load_ihex_stream},
+    {"image", ".tyi", ty_firmware_load_image}
 };
 const unsigned int ty_firmware_formats_count = TY_COUNTOF(ty_firmware_formats);
 
@@ -106,6 +108,164 @@ static int find_format(const char *filename, const char *format_name,
     return 0;
 }
 
+/* Signatures are bucketed by first byte: each byte value maps to the set of signatures that
+   start with it. When they all share the same first byte (common for machine code), memchr()
+   finds candidates, and it is vectorized by every libc we care about. Otherwise we look up
+   each byte in the table. Candidates are then checked with memcmp(). */
+const ty_firmware_signature *ty_firmware_search_signatures(const uint8_t *mem, size_t len,
+                                                           const ty_firmware_signature *sigs,
+                                                           unsigned int sigs_count, size_t *roffset)
+{
+    assert(mem || !len);
+    assert(sigs);
+    assert(sigs_count <= TY_FIRMWARE_MAX_SIGNATURES);
+
+    uint64_t buckets[256] = {0};
+    size_t min_size = SIZE_MAX;
+    int single_byte = -1;
+
+    for (unsigned int i = 0; i < sigs_count; i++) {
+        const ty_firmware_signature *sig = &sigs[i];
+
+        assert(sig->size && sig->size <= TY_FIRMWARE_MAX_SIGNATURE_SIZE);
+
+        buckets[sig->magic[0]] |= (uint64_t)1 << i;
+        min_size = TY_MIN(min_size, sig->size);
+
+        if (!i) {
+            single_byte = sig->magic[0];
+        } else if (single_byte != sig->magic[0]) {
+            single_byte = -1;
+        }
+    }
+    if (!sigs_count || len < min_size)
+        return NULL;
+
+    for (size_t offset = 0; offset <= len - min_size; offset++) {
+        uint64_t candidates;
+
+        if (single_byte >= 0) {
+            const uint8_t *ptr = memchr(mem + offset, single_byte, len - min_size - offset + 1);
+            if (!ptr)
+                break;
+            offset = (size_t)(ptr - mem);
+        }
+
+        candidates = buckets[mem[offset]];
+        for (unsigned int i = 0; candidates; i++, candidates >>= 1) {
+            const ty_firmware_signature *sig = &sigs[i];
+
+            if (!(candidates & 1))
+                continue;
+
+            if (sig->size <= len - offset && !memcmp(mem + offset, sig->magic, sig->size)) {
+                if (roffset)
+                    *roffset = offset;
+                return sig;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+const ty_firmware_signature *ty_firmware_find_signature(const ty_firmware *fw,
+                                                        const ty_firmware_signature *sigs,
+                                                        unsigned int sigs_count)
+{
+    assert(fw);
+
+    const size_t overlap = TY_FIRMWARE_MAX_SIGNATURE_SIZE - 1;
+
+    for (size_t i = 0; i < fw->pages_count; i++) {
+        const ty_firmware_page *page = &fw->pages[i];
+        const ty_firmware_page *next = i + 1 < fw->pages_count ? &fw->pages[i + 1] : NULL;
+        const ty_firmware_signature *sig;
+
+        sig = ty_firmware_search_signatures(page->data + page->start, page->end - page->start,
+                                            sigs, sigs_count, NULL);
+        if (sig)
+            return sig;
+
+        // Look for signatures that straddle two contiguous pages
+        if (next && page->end == TY_FIRMWARE_PAGE_SIZE && !next->start &&
+                next->address == page->address + TY_FIRMWARE_PAGE_SIZE) {
+            uint8_t buf[2 * (TY_FIRMWARE_MAX_SIGNATURE_SIZE - 1)];
+            size_t tail_len = TY_MIN(overlap, page->end - page->start);
+            size_t head_len = TY_MIN(overlap, next->end);
+
+            memcpy(buf, page->data + page->end - tail_len, tail_len);
+            memcpy(buf + tail_len, next->data, head_len);
+
+            sig = ty_firmware_search_signatures(buf, tail_len + head_len, sigs, sigs_count, NULL);
+            if (sig)
+                return sig;
+        }
+    }
+
+    return NULL;
+}
+
+static unsigned int scan_models(const ty_firmware *fw, ty_model *rmodels, unsigned int max_models)
+{
+    unsigned int guesses_count = 0;
+
+    for (unsigned int i = 0; i < _ty_classes_count; i++) {
+        ty_model partial_guesses[16];
+        unsigned int partial_count;
+
+        if (!_ty_classes[i].vtable->identify_models)
+            continue;
+
+        partial_count = (*_ty_classes[i].vtable->identify_models)(fw, partial_guesses,
+                                                                  TY_COUNTOF(partial_guesses));
+
+        for (unsigned int j = 0; j < partial_count; j++) {
+            if (guesses_count < max_models)
+                rmodels[guesses_count++] = partial_guesses[j];
+        }
+    }
+
+    return guesses_count;
+}
+
+/* Scanning big images is expensive, and the same firmware is usually checked against many
+   boards. Loaded firmwares are shared by tasks but not modified anymore, so doing it once at
+   load time is enough and does not need any locking. */
+static void identify_models(ty_firmware *fw)
+{
+    fw->models_count = scan_models(fw, fw->models, TY_COUNTOF(fw->models));
+    fw->identified = true;
+}
+
+struct file_stream {
+    FILE *fp;
+    const char *filename;
+};
+
+static int read_error(const char *filename)
+{
+    if (errno == EIO) {
+        return ty_error(TY_ERROR_IO, "I/O error while reading from '%s'", filename);
+    } else {
+        return ty_error(TY_ERROR_SYSTEM, "fread('%s') failed: %s", filename, strerror(errno));
+    }
+}
+
+static ssize_t read_file_stream(void *udata, uint8_t *buf, size_t size)
+{
+    struct file_stream *stream = udata;
+    size_t len;
+
+    len = fread(buf, 1, size, stream->fp);
+    if (!len && ferror(stream->fp))
+        return read_error(stream->filename);
+
+    return (ssize_t)len;
+}
+
+/* Formats that support it are parsed as the file is read, so the whole file never has to
+   be in memory. This matters when reading from a pipe, e.g. 'tycmd upload -'. */
 int ty_firmware_load_file(const char *filename, FILE *fp, const char *format_name,
                           ty_firmware **rfw)
 {
@@ -151,35 +311,49 @@ int ty_firmware_load_file(const char *filename, FILE *fp, const char *format_nam
         close_fp = true;
     }
 
-    // Load file to memory
-    while (!feof(fp)) {
-        r = _hs_array_grow(&buf, 128 * 1024);
+    r = ty_firmware_new(filename, &fw);
+    if (r < 0)
+        goto cleanup;
+
+    // Only seek in files we opened ourselves, a FILE given by the caller may be a pipe
+    if (format->load_file && close_fp) {
+        r = (*format->load_file)(fw, fp);
         if (r < 0)
             goto cleanup;
+    } else if (format->load_stream) {
+        struct file_stream stream;
 
-        buf.count += fread(buf.values + buf.count, 1, 131072, fp);
-        if (ferror(fp)) {
-            if (errno == EIO) {
-                r = ty_error(TY_ERROR_IO, "I/O error while reading from '%s'", filename);
-            } else {
-                r = ty_error(TY_ERROR_SYSTEM, "fread('%s') failed: %s", filename, strerror(errno));
-            }
+        stream.fp = fp;
+        stream.filename = filename;
+
+        r = (*format->load_stream)(fw, read_file_stream, &stream);
+        if (r < 0)
             goto cleanup;
+    } else {
+        // Load file to memory
+        while (!feof(fp)) {
+            r = _hs_array_grow(&buf, 128 * 1024);
+            if (r < 0)
+                goto cleanup;
+
+            buf.count += fread(buf.values + buf.count, 1, 131072, fp);
+            if (ferror(fp)) {
+                r = read_error(filename);
+                goto cleanup;
+            }
+            if (buf.count > 8 * 1024 * 1024) {
+                r = ty_error(TY_ERROR_RANGE, "Firmware '%s' is too big to load", filename);
+                goto cleanup;
+            }
         }
-        if (buf.count > 8 * 1024 * 1024) {
-            r = ty_error(TY_ERROR_RANGE, "Firmware '%s' is too big to load", filename);
+        _hs_array_shrink(&buf);
+
+        r = (*format->load)(fw, buf.values, buf.count);
+        if (r < 0)
             goto cleanup;
-        }
     }
-    _hs_array_shrink(&buf);
-
-    r = ty_firmware_new(filename, &fw);
-    if (r < 0)
-        goto cleanup;
-
-    r = (*format->load)(fw, buf.values, buf.count);
-    if (r < 0)
-        goto cleanup;
+    if (!fw->identified)
+        identify_models(fw);
 
     *rfw = fw;
     fw = NULL;
@@ -214,6 +388,8 @@ int ty_firmware_load_mem(const char *filename, const uint8_t *mem, size_t len,
     r = (*format->load)(fw, mem, len);
     if (r < 0)
         goto cleanup;
+    if (!fw->identified)
+        identify_models(fw);
 
     *rfw = fw;
     fw = NULL;
@@ -223,6 +399,69 @@ cleanup:
     return r;
 }
 
+static void unref_loaded_firmware(void *ptr)
+{
+    ty_firmware_unref(ptr);
+}
+
+static int run_load_firmware(ty_task *task)
+{
+    ty_firmware *fw;
+    int r;
+
+    r = ty_firmware_load_file(task->u.load_firmware.filename, task->u.load_firmware.fp,
+                              task->u.load_firmware.format_name, &fw);
+    if (r < 0)
+        return r;
+
+    task->result = fw;
+    task->result_cleanup = unref_loaded_firmware;
+    return 0;
+}
+
+static void finalize_load_firmware(ty_task *task)
+{
+    free(task->u.load_firmware.filename);
+    free(task->u.load_firmware.format_name);
+}
+
+/* Loading runs in the task pool, so that multiple firmwares can be read, parsed and
+   identified concurrently. The task result is the loaded ty_firmware. */
+int ty_load_firmware(const char *filename, FILE *fp, const char *format_name, ty_task **rtask)
+{
+    assert(filename);
+    assert(rtask);
+
+    ty_task *task = NULL;
+    int r;
+
+    r = ty_task_new("load", run_load_firmware, &task);
+    if (r < 0)
+        goto error;
+    task->task_finalize = finalize_load_firmware;
+
+    task->u.load_firmware.filename = strdup(filename);
+    if (!task->u.load_firmware.filename) {
+        r = ty_error(TY_ERROR_MEMORY, NULL);
+        goto error;
+    }
+    task->u.load_firmware.fp = fp;
+    if (format_name) {
+        task->u.load_firmware.format_name = strdup(format_name);
+        if (!task->u.load_firmware.format_name) {
+            r = ty_error(TY_ERROR_MEMORY, NULL);
+            goto error;
+        }
+    }
+
+    *rtask = task;
+    return 0;
+
+error:
+    ty_task_unref(task);
+    return r;
+}
+
 ty_firmware *ty_firmware_ref(ty_firmware *fw)
 {
     assert(fw);
@@ -237,8 +476,9 @@ void ty_firmware_unref(ty_firmware *fw)
         if (_ty_refcount_decrease(&fw->refcount))
             return;
 
-        for (unsigned int i = 0; i < fw->segments_count; i++)
-            free(fw->segments[i].data);
+        for (size_t i = 0; i < fw->pages_count; i++)
+            free(fw->pages[i].data);
+        free(fw->pages);
         free(fw->name);
         free(fw->filename);
     }
@@ -246,15 +486,38 @@ void ty_firmware_unref(ty_firmware *fw)
     free(fw);
 }
 
-const ty_firmware_segment *ty_firmware_find_segment(const ty_firmware *fw, uint32_t address)
+// Returns the index of the first page at or after address
+static size_t find_page_index(const ty_firmware *fw, uint32_t address)
+{
+    size_t start = 0;
+    size_t end = fw->pages_count;
+
+    while (start < end) {
+        size_t mid = start + (end - start) / 2;
+
+        if (fw->pages[mid].address < address) {
+            start = mid + 1;
+        } else {
+            end = mid;
+        }
+    }
+
+    return start;
+}
+
+const ty_firmware_page *ty_firmware_find_page(const ty_firmware *fw, uint32_t address)
 {
     assert(fw);
 
-    for (unsigned int i = fw->segments_count; i-- > 0;) {
-        const ty_firmware_segment *segment = &fw->segments[i];
+    uint32_t page_address = address & ~(uint32_t)(TY_FIRMWARE_PAGE_SIZE - 1);
+    size_t idx = find_page_index(fw, page_address);
+
+    if (idx < fw->pages_count && fw->pages[idx].address == page_address) {
+        const ty_firmware_page *page = &fw->pages[idx];
+        uint32_t offset = address - page_address;
 
-        if (address >= segment->address && address < segment->address + segment->size)
-            return segment;
+        if (offset >= page->start && offset < page->end)
+            return page;
     }
 
     return NULL;
@@ -263,22 +526,21 @@ const ty_firmware_segment *ty_firmware_find_segment(const ty_firmware *fw, uint3
 size_t ty_firmware_extract(const ty_firmware *fw, uint32_t address, uint8_t *buf, size_t size)
 {
     assert(fw);
+    assert(buf || !size);
 
-    size_t total_len = 0;
-    for (unsigned int i = 0; i < fw->segments_count; i++) {
-        const ty_firmware_segment *segment = &fw->segments[i];
+    uint64_t end_address = (uint64_t)address + size;
+    size_t idx = find_page_index(fw, address & ~(uint32_t)(TY_FIRMWARE_PAGE_SIZE - 1));
 
-        if (address >= segment->address && address < segment->address + segment->size) {
-            size_t delta = address - segment->address;
-            size_t len = TY_MIN(segment->size - delta, size);
+    size_t total_len = 0;
+    for (; idx < fw->pages_count && fw->pages[idx].address < end_address; idx++) {
+        const ty_firmware_page *page = &fw->pages[idx];
+        uint64_t start = TY_MAX((uint64_t)page->address + page->start, address);
+        uint64_t end = TY_MIN((uint64_t)page->address + page->end, end_address);
 
-            memcpy(buf, segment->data + delta, len);
-            total_len += len;
-        } else if (address < segment->address && address + size > segment->address) {
-            size_t delta = segment->address - address;
-            size_t len = TY_MIN(segment->size, size - delta);
+        if (start < end) {
+            size_t len = (size_t)(end - start);
 
-            memcpy(buf + delta, segment->data, len);
+            memcpy(buf + (size_t)(start - address), page->data + (size_t)(start - page->address), len);
             total_len += len;
         }
     }
@@ -286,52 +548,87 @@ size_t ty_firmware_extract(const ty_firmware *fw, uint32_t address, uint8_t *buf
     return total_len;
 }
 
-int ty_firmware_add_segment(ty_firmware *fw, uint32_t address, size_t size,
-                            ty_firmware_segment **rsegment)
+static int get_page(ty_firmware *fw, uint32_t address, ty_firmware_page **rpage)
 {
-    assert(fw);
+    size_t idx = find_page_index(fw, address);
+    ty_firmware_page *page;
 
-    ty_firmware_segment *segment;
-    int r;
+    if (idx < fw->pages_count && fw->pages[idx].address == address) {
+        *rpage = &fw->pages[idx];
+        return 0;
+    }
 
-    if (fw->segments_count >= TY_FIRMWARE_MAX_SEGMENTS)
-        return ty_error(TY_ERROR_RANGE, "Firmware '%s' has too many segments", fw->filename);
+    if (fw->pages_count == fw->pages_alloc) {
+        size_t alloc = fw->pages_alloc ? fw->pages_alloc * 2 : 16;
+        ty_firmware_page *tmp;
 
-    segment = &fw->segments[fw->segments_count];
-    segment->address = address;
+        tmp = realloc(fw->pages, alloc * sizeof(*fw->pages));
+        if (!tmp)
+            return ty_error(TY_ERROR_MEMORY, NULL);
+        fw->pages = tmp;
+        fw->pages_alloc = alloc;
+    }
 
-    r = ty_firmware_expand_segment(fw, segment, size);
-    if (r < 0)
-        return r;
+    // Loaders mostly write in ascending order, so this is usually an append
+    page = &fw->pages[idx];
+    memmove(page + 1, page, (fw->pages_count - idx) * sizeof(*page));
+    memset(page, 0, sizeof(*page));
+    page->address = address;
 
-    fw->segments_count++;
+    page->data = malloc(TY_FIRMWARE_PAGE_SIZE);
+    if (!page->data) {
+        memmove(page, page + 1, (fw->pages_count - idx) * sizeof(*page));
+        return ty_error(TY_ERROR_MEMORY, NULL);
+    }
+    memset(page->data, 0xFF, TY_FIRMWARE_PAGE_SIZE);
+    fw->pages_count++;
 
-    if (rsegment)
-        *rsegment = segment;
+    *rpage = page;
     return 0;
 }
 
-int ty_firmware_expand_segment(ty_firmware *fw, ty_firmware_segment *segment, size_t size)
+int ty_firmware_write(ty_firmware *fw, uint32_t address, const uint8_t *data, size_t size)
 {
-    const size_t step_size = 65536;
+    assert(fw);
+    assert(data || !size);
 
-    if (size > segment->alloc_size) {
-        uint8_t *tmp;
-        size_t alloc_size;
+    if (size > (uint64_t)UINT32_MAX - address + 1)
+        return ty_error(TY_ERROR_RANGE, "Firmware '%s' goes beyond the 32-bit address space",
+                        fw->filename);
 
-        if (size > TY_FIRMWARE_MAX_SEGMENT_SIZE)
-            return ty_error(TY_ERROR_RANGE, "Firmware '%s' has excessive segment size (max %u bytes)",
-                            fw->filename, TY_FIRMWARE_MAX_SEGMENT_SIZE);
+    fw->identified = false;
 
-        alloc_size = (size + (step_size - 1)) / step_size * step_size;
-        tmp = realloc(segment->data, alloc_size);
-        if (!tmp)
-            return ty_error(TY_ERROR_MEMORY, NULL);
+    while (size) {
+        uint32_t page_address = address & ~(uint32_t)(TY_FIRMWARE_PAGE_SIZE - 1);
+        unsigned int offset = (unsigned int)(address - page_address);
+        unsigned int len = (unsigned int)TY_MIN(size, (size_t)(TY_FIRMWARE_PAGE_SIZE - offset));
+        ty_firmware_page *page = NULL;
+        size_t end_address;
+        int r;
+
+        r = get_page(fw, page_address, &page);
+        if (r < 0)
+            return r;
+
+        memcpy(page->data + offset, data, len);
+
+        fw->total_size -= page->end - page->start;
+        if (page->start == page->end) {
+            page->start = offset;
+            page->end = offset + len;
+        } else {
+            page->start = TY_MIN(page->start, offset);
+            page->end = TY_MAX(page->end, offset + len);
+        }
+        fw->total_size += page->end - page->start;
 
-        segment->data = tmp;
-        segment->alloc_size = alloc_size;
+        end_address = (size_t)page->address + page->end;
+        fw->max_address = TY_MAX(fw->max_address, end_address);
+
+        address += len;
+        data += len;
+        size -= len;
     }
-    segment->size = size;
 
     return 0;
 }
@@ -343,23 +640,14 @@ unsigned int ty_firmware_identify(const ty_firmware *fw, ty_model *rmodels,
     assert(rmodels);
     assert(max_models);
 
-    unsigned int guesses_count = 0;
-
-    for (unsigned int i = 0; i < _ty_classes_count; i++) {
-        ty_model partial_guesses[16];
-        unsigned int partial_count;
-
-        if (!_ty_classes[i].vtable->identify_models)
-            continue;
+    unsigned int count;
 
-        partial_count = (*_ty_classes[i].vtable->identify_models)(fw, partial_guesses,
-                                                                  TY_COUNTOF(partial_guesses));
+    // Firmwares built by hand (or modified since) are scanned each time
+    if (!fw->identified)
+        return scan_models(fw, rmodels, max_models);
 
-        for (unsigned int j = 0; j < partial_count; j++) {
-            if (rmodels && guesses_count < max_models)
-                rmodels[guesses_count++] = partial_guesses[j];
-        }
-    }
+    count = TY_MIN(fw->models_count, max_models);
+    memcpy(rmodels, fw->models, count * sizeof(*rmodels));
 
-    return guesses_count;
+    return count;
 }
@@ -16,15 +16,24 @@
 
 TY_C_BEGIN
 
-#define TY_FIRMWARE_MAX_SEGMENTS 16
-#define TY_FIRMWARE_MAX_SEGMENT_SIZE (2 * 1024 * 1024)
+struct ty_task;
+
+#define TY_FIRMWARE_PAGE_SIZE 4096
+#define TY_FIRMWARE_MAX_MODELS 32
+#define TY_FIRMWARE_MAX_SIGNATURES 64
+#define TY_FIRMWARE_MAX_SIGNATURE_SIZE 16
+#define TY_FIRMWARE_STREAM_CHUNK_SIZE (64 * 1024)
+
+/* Firmware images are sparse: only the pages that hold data are allocated, and bytes between
+   start and end are valid. Unwritten bytes inside this range are set to 0xFF, like erased
+   flash memory. */
+typedef struct ty_firmware_page {
+    uint32_t address;
+    unsigned int start;
+    unsigned int end;
 
-typedef struct ty_firmware_segment {
     uint8_t *data;
-    size_t size;
-    size_t alloc_size;
-    uint32_t address;
-} ty_firmware_segment;
+} ty_firmware_page;
 
 typedef struct ty_firmware {
     unsigned int refcount;
@@ -32,20 +41,43 @@ typedef struct ty_firmware {
     char *name;
     char *filename;
 
-    ty_firmware_segment segments[TY_FIRMWARE_MAX_SEGMENTS];
-    unsigned int segments_count;
+    // Sorted by address
+    ty_firmware_page *pages;
+    size_t pages_count;
+    size_t pages_alloc;
 
     size_t max_address;
     size_t total_size;
+
+    // Compatible models, identified once the firmware is loaded
+    ty_model models[TY_FIRMWARE_MAX_MODELS];
+    unsigned int models_count;
+    bool identified;
 } ty_firmware;
 
+typedef struct ty_firmware_signature {
+    ty_model model;
+
+    uint8_t magic[TY_FIRMWARE_MAX_SIGNATURE_SIZE];
+    unsigned int size;
+} ty_firmware_signature;
+
+// Returns the number of bytes read, 0 at the end of the stream or a negative error code
+typedef ssize_t ty_firmware_read_func(void *udata, uint8_t *buf, size_t size);
+
 typedef struct ty_firmware_format {
     const char *name;
     const char *ext;
 
     int (*load)(ty_firmware *fw, const uint8_t *mem, size_t len);
+    // Optional, for formats that can be parsed as the data comes in
+    int (*load_stream)(ty_firmware *fw, ty_firmware_read_func *f, void *udata);
+    // Optional, for formats that only need some parts of seekable files
+    int (*load_file)(ty_firmware *fw, FILE *fp);
 } ty_firmware_format;
 
+typedef struct ty_firmware_ihex_parser ty_firmware_ihex_parser;
+
 extern const ty_firmware_format ty_firmware_formats[];
 extern const unsigned int ty_firmware_formats_count;
 
@@ -55,23 +87,40 @@ int ty_firmware_load_file(const char *filename, FILE *fp, const char *format_nam
 int ty_firmware_load_mem(const char *filename, const uint8_t *mem, size_t len,
                          const char *format_name, ty_firmware **rfw);
 
+int ty_load_firmware(const char *filename, FILE *fp, const char *format_name,
+                     struct ty_task **rtask);
+
 int ty_firmware_load_elf(ty_firmware *fw, const uint8_t *mem, size_t len);
+int ty_firmware_load_elf_file(ty_firmware *fw, FILE *fp);
 int ty_firmware_load_ihex(ty_firmware *fw, const uint8_t *mem, size_t len);
+int ty_firmware_load_ihex_stream(ty_firmware *fw, ty_firmware_read_func *f, void *udata);
+int ty_firmware_load_image(ty_firmware *fw, const uint8_t *mem, size_t len);
+
+int ty_firmware_build_image(ty_firmware *fw, ty_model model, uint8_t **rimage, size_t *rsize);
+
+int ty_firmware_ihex_parser_new(ty_firmware *fw, ty_firmware_ihex_parser **rparser);
+void ty_firmware_ihex_parser_free(ty_firmware_ihex_parser *parser);
+int ty_firmware_ihex_parser_feed(ty_firmware_ihex_parser *parser, const uint8_t *mem, size_t len);
+int ty_firmware_ihex_parser_finish(ty_firmware_ihex_parser *parser);
 
 ty_firmware *ty_firmware_ref(ty_firmware *fw);
 void ty_firmware_unref(ty_firmware *fw);
 
-const ty_firmware_segment *ty_firmware_find_segment(const ty_firmware *fw, uint32_t address);
+const ty_firmware_page *ty_firmware_find_page(const ty_firmware *fw, uint32_t address);
 size_t ty_firmware_extract(const ty_firmware *fw, uint32_t address, uint8_t *buf, size_t size);
 
-int ty_firmware_add_segment(ty_firmware *fw, uint32_t address, size_t size,
-                            ty_firmware_segment **rsegment);
-int ty_firmware_expand_segment(ty_firmware *fw, ty_firmware_segment *segment, size_t size);
-
+int ty_firmware_write(ty_firmware *fw, uint32_t address, const uint8_t *data, size_t size);
 
 unsigned int ty_firmware_identify(const ty_firmware *fw, ty_model *rmodels,
                                   unsigned int max_models);
 
+const ty_firmware_signature *ty_firmware_find_signature(const ty_firmware *fw,
+                                                        const ty_firmware_signature *sigs,
+                                                        unsigned int sigs_count);
+const ty_firmware_signature *ty_firmware_search_signatures(const uint8_t *mem, size_t len,
+                                                           const ty_firmware_signature *sigs,
+                                                           unsigned int sigs_count, size_t *roffset);
+
 TY_C_END
 
 #endif
@@ -9,7 +9,6 @@
    See the LICENSE file for more details. */
 
 #include "common_priv.h"
-#include <sys/types.h>
 #include "firmware.h"
 
 #define EI_NIDENT 16
@@ -56,144 +55,227 @@ typedef struct Elf32_Phdr {
 #define PT_NULL 0
 #define PT_LOAD 1
 
+#define ELF_EHDR_SIZE 52
+#define ELF_PHDR_SIZE 32
+#define ELF_CHUNK_SIZE (64 * 1024)
+
+/* The whole file is either in memory, or we only read the headers and the PT_LOAD data
+   from a seekable file. Debug builds can be tens of times bigger than their flash
+   content, so this is much faster than reading the DWARF sections for nothing. */
 struct loader_context {
     ty_firmware *fw;
 
     const uint8_t *mem;
     size_t len;
+    FILE *fp;
 
+    bool big_endian;
     Elf32_Ehdr ehdr;
 };
 
-// The compiler will reduce this to a simple conditional branch
-static inline bool is_endianness_reversed(struct loader_context *ctx)
+static uint16_t decode_uint16(const struct loader_context *ctx, const uint8_t *ptr)
 {
-    union { uint16_t u; uint8_t raw[2]; } u;
-    u.raw[0] = 0;
-    u.raw[1] = 1;
-
-    return (u.u == 1) == (ctx->ehdr.e_ident[EI_DATA] == ELFDATA2LSB);
+    if (ctx->big_endian) {
+        return (uint16_t)((ptr[0] << 8) | ptr[1]);
+    } else {
+        return (uint16_t)(ptr[0] | (ptr[1] << 8));
+    }
 }
 
-static inline void reverse_uint16(uint16_t *u)
+static uint32_t decode_uint32(const struct loader_context *ctx, const uint8_t *ptr)
 {
-    *u = (uint16_t)(((*u & 0xFF) << 8) | ((*u & 0xFF00) >> 8));
+    if (ctx->big_endian) {
+        return ((uint32_t)ptr[0] << 24) | ((uint32_t)ptr[1] << 16) |
+               ((uint32_t)ptr[2] << 8) | (uint32_t)ptr[3];
+    } else {
+        return (uint32_t)ptr[0] | ((uint32_t)ptr[1] << 8) |
+               ((uint32_t)ptr[2] << 16) | ((uint32_t)ptr[3] << 24);
+    }
 }
 
-static inline void reverse_uint32(uint32_t *u)
+static int elf_malformed_error(struct loader_context *ctx)
 {
-    *u = ((*u & 0xFF) << 24) | ((*u & 0xFF00) << 8)
-            | ((*u & 0xFF0000) >> 8) | ((*u & 0xFF000000) >> 24);
+    return ty_error(TY_ERROR_PARSE, "ELF file '%s' is malformed or truncated", ctx->fw->filename);
 }
 
-static int read_chunk(struct loader_context *ctx, off_t offset, size_t size, void *buf)
+static int read_chunk(struct loader_context *ctx, uint32_t offset, size_t size, void *buf)
 {
-    if (offset < 0 || (size_t)offset > ctx->len - size)
-        return ty_error(TY_ERROR_PARSE, "ELF file '%s' is malformed or truncated",
-                        ctx->fw->filename);
+    if (ctx->fp) {
+        size_t len;
+        int r;
+
+#ifdef _WIN32
+        r = _fseeki64(ctx->fp, (__int64)offset, SEEK_SET);
+#else
+        r = fseeko(ctx->fp, (off_t)offset, SEEK_SET);
+#endif
+        if (r < 0)
+            return ty_error(TY_ERROR_SYSTEM, "fseek('%s') failed: %s", ctx->fw->filename,
+                            strerror(errno));
+
+        len = fread(buf, 1, size, ctx->fp);
+        if (len < size) {
+            if (ferror(ctx->fp)) {
+                if (errno == EIO)
+                    return ty_error(TY_ERROR_IO, "I/O error while reading from '%s'",
+                                    ctx->fw->filename);
+                return ty_error(TY_ERROR_SYSTEM, "fread('%s') failed: %s", ctx->fw->filename,
+                                strerror(errno));
+            }
+            return elf_malformed_error(ctx);
+        }
+    } else {
+        if (size > ctx->len || offset > ctx->len - size)
+            return elf_malformed_error(ctx);
+
+        memcpy(buf, ctx->mem + offset, size);
+    }
 
-    memcpy(buf, ctx->mem + offset, size);
     return 0;
 }
 
-static int load_program_header(struct loader_context *ctx, unsigned int i, Elf32_Phdr *rphdr)
+static int load_segment_data(struct loader_context *ctx, const Elf32_Phdr *phdr)
 {
+    uint8_t *buf = NULL;
     int r;
 
-    r = read_chunk(ctx, (off_t)(ctx->ehdr.e_phoff + i * ctx->ehdr.e_phentsize), sizeof(*rphdr), rphdr);
-    if (r < 0)
-        return r;
+    if (!ctx->fp) {
+        if (phdr->p_filesz > ctx->len || phdr->p_offset > ctx->len - phdr->p_filesz)
+            return elf_malformed_error(ctx);
 
-    if (is_endianness_reversed(ctx)) {
-        reverse_uint32(&rphdr->p_type);
-        reverse_uint32(&rphdr->p_offset);
-        reverse_uint32(&rphdr->p_vaddr);
-        reverse_uint32(&rphdr->p_paddr);
-        reverse_uint32(&rphdr->p_filesz);
-        reverse_uint32(&rphdr->p_memsz);
-        reverse_uint32(&rphdr->p_flags);
-        reverse_uint32(&rphdr->p_align);
+        return ty_firmware_write(ctx->fw, phdr->p_paddr, ctx->mem + phdr->p_offset,
+                                 phdr->p_filesz);
     }
+    // The end of the segment must not wrap around, the file size is checked by read_chunk()
+    if ((uint64_t)phdr->p_offset + phdr->p_filesz > UINT32_MAX)
+        return elf_malformed_error(ctx);
 
-    return 0;
+    buf = malloc(TY_MIN(phdr->p_filesz, ELF_CHUNK_SIZE));
+    if (!buf)
+        return ty_error(TY_ERROR_MEMORY, NULL);
+
+    for (uint32_t offset = 0; offset < phdr->p_filesz;) {
+        uint32_t len = TY_MIN(phdr->p_filesz - offset, ELF_CHUNK_SIZE);
+
+        r = read_chunk(ctx, phdr->p_offset + offset, len, buf);
+        if (r < 0)
+            goto cleanup;
+        r = ty_firmware_write(ctx->fw, phdr->p_paddr + offset, buf, len);
+        if (r < 0)
+            goto cleanup;
+
+        offset += len;
+    }
+
+    r = 0;
+cleanup:
+    free(buf);
+    return r;
 }
 
-static int load_segment(struct loader_context *ctx, unsigned int i)
+static int load_elf(struct loader_context *ctx)
 {
-    Elf32_Phdr phdr;
-    ty_firmware_segment *segment;
+    uint8_t raw_ehdr[ELF_EHDR_SIZE];
+    uint8_t *raw_phdrs = NULL;
+    size_t phdrs_size;
     int r;
 
-    r = load_program_header(ctx, i ,&phdr);
+    r = read_chunk(ctx, 0, sizeof(raw_ehdr), raw_ehdr);
     if (r < 0)
-        return (int)r;
+        return r;
 
-    if (phdr.p_type != PT_LOAD || !phdr.p_filesz)
-        return 0;
+    if (memcmp(raw_ehdr, ELFMAG, SELFMAG) != 0)
+        return ty_error(TY_ERROR_PARSE, "Missing ELF signature in '%s'", ctx->fw->filename);
 
-    r = ty_firmware_add_segment(ctx->fw, phdr.p_paddr, phdr.p_filesz, &segment);
-    if (r < 0)
-        return r;
-    r = read_chunk(ctx, phdr.p_offset, phdr.p_filesz, segment->data);
-    if (r < 0)
-        return r;
+    if (raw_ehdr[EI_CLASS] != ELFCLASS32)
+        return ty_error(TY_ERROR_UNSUPPORTED, "ELF object '%s' is not supported (not 32-bit)",
+                        ctx->fw->filename);
+    ctx->big_endian = (raw_ehdr[EI_DATA] == ELFDATA2MSB);
+
+    memcpy(ctx->ehdr.e_ident, raw_ehdr, EI_NIDENT);
+    ctx->ehdr.e_type = decode_uint16(ctx, raw_ehdr + 16);
+    ctx->ehdr.e_machine = decode_uint16(ctx, raw_ehdr + 18);
+    ctx->ehdr.e_version = decode_uint32(ctx, raw_ehdr + 20);
+    ctx->ehdr.e_entry = decode_uint32(ctx, raw_ehdr + 24);
+    ctx->ehdr.e_phoff = decode_uint32(ctx, raw_ehdr + 28);
+    ctx->ehdr.e_shoff = decode_uint32(ctx, raw_ehdr + 32);
+    ctx->ehdr.e_flags = decode_uint32(ctx, raw_ehdr + 36);
+    ctx->ehdr.e_ehsize = decode_uint16(ctx, raw_ehdr + 40);
+    ctx->ehdr.e_phentsize = decode_uint16(ctx, raw_ehdr + 42);
+    ctx->ehdr.e_phnum = decode_uint16(ctx, raw_ehdr + 44);
+    ctx->ehdr.e_shentsize = decode_uint16(ctx, raw_ehdr + 46);
+    ctx->ehdr.e_shnum = decode_uint16(ctx, raw_ehdr + 48);
+    ctx->ehdr.e_shstrndx = decode_uint16(ctx, raw_ehdr + 50);
+
+    if (!ctx->ehdr.e_phoff)
+        return ty_error(TY_ERROR_PARSE, "ELF file '%s' has no program headers", ctx->fw->filename);
+    if (ctx->ehdr.e_phentsize < ELF_PHDR_SIZE)
+        return elf_malformed_error(ctx);
+
+    // Read the whole program header table at once
+    phdrs_size = (size_t)ctx->ehdr.e_phnum * ctx->ehdr.e_phentsize;
+    if (phdrs_size) {
+        raw_phdrs = malloc(phdrs_size);
+        if (!raw_phdrs)
+            return ty_error(TY_ERROR_MEMORY, NULL);
+        r = read_chunk(ctx, ctx->ehdr.e_phoff, phdrs_size, raw_phdrs);
+        if (r < 0)
+            goto cleanup;
+    }
+
+    for (unsigned int i = 0; i < ctx->ehdr.e_phnum; i++) {
+        const uint8_t *raw_phdr = raw_phdrs + i * ctx->ehdr.e_phentsize;
+        Elf32_Phdr phdr;
+
+        phdr.p_type = decode_uint32(ctx, raw_phdr);
+        if (phdr.p_type != PT_LOAD)
+            continue;
+        phdr.p_offset = decode_uint32(ctx, raw_phdr + 4);
+        phdr.p_vaddr = decode_uint32(ctx, raw_phdr + 8);
+        phdr.p_paddr = decode_uint32(ctx, raw_phdr + 12);
+        phdr.p_filesz = decode_uint32(ctx, raw_phdr + 16);
+        phdr.p_memsz = decode_uint32(ctx, raw_phdr + 20);
+        phdr.p_flags = decode_uint32(ctx, raw_phdr + 24);
+        phdr.p_align = decode_uint32(ctx, raw_phdr + 28);
+        if (!phdr.p_filesz)
+            continue;
+
+        r = load_segment_data(ctx, &phdr);
+        if (r < 0)
+            goto cleanup;
+    }
 
-    return 1;
+    r = 0;
+cleanup:
+    free(raw_phdrs);
+    return r;
 }
 
 int ty_firmware_load_elf(ty_firmware *fw, const uint8_t *mem, size_t len)
 {
     assert(fw);
-    assert(!fw->segments_count && !fw->total_size);
+    assert(!fw->pages_count);
     assert(mem || !len);
 
     struct loader_context ctx = {0};
-    int r;
 
     ctx.fw = fw;
     ctx.mem = mem;
     ctx.len = len;
 
-    r = read_chunk(&ctx, 0, sizeof(ctx.ehdr), &ctx.ehdr);
-    if (r < 0)
-        return r;
-
-    if (memcmp(ctx.ehdr.e_ident, ELFMAG, SELFMAG) != 0)
-        return ty_error(TY_ERROR_PARSE, "Missing ELF signature in '%s'", ctx.fw->filename);
-
-    if (ctx.ehdr.e_ident[EI_CLASS] != ELFCLASS32)
-        return ty_error(TY_ERROR_UNSUPPORTED, "ELF object '%s' is not supported (not 32-bit)",
-                        ctx.fw->filename);
-
-    if (is_endianness_reversed(&ctx)) {
-        reverse_uint16(&ctx.ehdr.e_type);
-        reverse_uint16(&ctx.ehdr.e_machine);
-        reverse_uint32(&ctx.ehdr.e_entry);
-        reverse_uint32(&ctx.ehdr.e_phoff);
-        reverse_uint32(&ctx.ehdr.e_shoff);
-        reverse_uint32(&ctx.ehdr.e_flags);
-        reverse_uint16(&ctx.ehdr.e_ehsize);
-        reverse_uint16(&ctx.ehdr.e_phentsize);
-        reverse_uint16(&ctx.ehdr.e_phnum);
-        reverse_uint16(&ctx.ehdr.e_shentsize);
-        reverse_uint16(&ctx.ehdr.e_shnum);
-        reverse_uint16(&ctx.ehdr.e_shstrndx);
-    }
+    return load_elf(&ctx);
+}
 
-    if (!ctx.ehdr.e_phoff)
-        return ty_error(TY_ERROR_PARSE, "ELF file '%s' has no program headers", ctx.fw->filename);
+int ty_firmware_load_elf_file(ty_firmware *fw, FILE *fp)
+{
+    assert(fw);
+    assert(!fw->pages_count);
+    assert(fp);
 
-    for (unsigned int i = 0; i < ctx.ehdr.e_phnum; i++) {
-        r = load_segment(&ctx, i);
-        if (r < 0)
-            return r;
-    }
+    struct loader_context ctx = {0};
 
-    for (unsigned int i = 0; i < fw->segments_count; i++) {
-        const ty_firmware_segment *segment = &fw->segments[i];
-        fw->total_size += segment->size;
-        fw->max_address = TY_MAX(fw->max_address, segment->address + segment->size);
-    }
+    ctx.fw = fw;
+    ctx.fp = fp;
 
-    return 0;
+    return load_elf(&ctx);
 }
@@ -11,7 +11,10 @@
 #include "common_priv.h"
 #include "firmware.h"
 
-struct parser_context {
+// Colon, count, address, type, 255 data bytes and checksum
+#define IHEX_MAX_LINE_SIZE (1 + 2 + 4 + 2 + 2 * 255 + 2)
+
+struct ty_firmware_ihex_parser {
     ty_firmware *fw;
     unsigned int line;
 
@@ -22,10 +25,14 @@ struct parser_context {
 
     uint32_t offset1;
     uint32_t offset2;
-    ty_firmware_segment *segment;
+
+    // Incomplete line from the previous call to ty_firmware_ihex_parser_feed()
+    char buf[IHEX_MAX_LINE_SIZE];
+    size_t buf_len;
+    bool eof;
 };
 
-static uint32_t parse_hex_value(struct parser_context *ctx, size_t size)
+static uint32_t parse_hex_value(ty_firmware_ihex_parser *ctx, size_t size)
 {
     if (ctx->error)
         return 0;
@@ -57,13 +64,13 @@ static uint32_t parse_hex_value(struct parser_context *ctx, size_t size)
     return value;
 }
 
-static int ihex_parse_error(struct parser_context *ctx)
+static int ihex_parse_error(ty_firmware_ihex_parser *ctx)
 {
     return ty_error(TY_ERROR_PARSE, "IHEX parse error on line %u in '%s'", ctx->line,
                     ctx->fw->filename);
 }
 
-static int parse_line(struct parser_context *ctx, const char *line, size_t line_len)
+static int parse_line(ty_firmware_ihex_parser *ctx, const char *line, size_t line_len)
 {
     unsigned int data_len, type;
     uint32_t address;
@@ -85,14 +92,17 @@ static int parse_line(struct parser_context *ctx, const char *line, size_t line_
 
     switch (type) {
         case 0: { // data record
-            address += ctx->offset1 + ctx->offset2;
+            uint8_t data[255];
+
+            for (unsigned int i = 0; i < data_len; i++)
+                data[i] = (uint8_t)parse_hex_value(ctx, 1);
+            if (ctx->error)
+                return ihex_parse_error(ctx);
 
-            r = ty_firmware_expand_segment(ctx->fw, ctx->segment, address + data_len);
+            address += ctx->offset1 + ctx->offset2;
+            r = ty_firmware_write(ctx->fw, address, data, data_len);
             if (r < 0)
                 return r;
-
-            for (unsigned int i = 0; i < data_len; i++)
-                ctx->segment->data[address + i] = (uint8_t)parse_hex_value(ctx, 1);
         } break;
 
         case 1: { // EOF record
@@ -111,17 +121,7 @@ static int parse_line(struct parser_context *ctx, const char *line, size_t line_
             if (data_len != 2)
                 return ihex_parse_error(ctx);
 
-            address = (uint32_t)parse_hex_value(ctx, 2) << 16;
-
-            if (address + 65536 > ctx->segment->address + TY_FIRMWARE_MAX_SEGMENT_SIZE) {
-                r = ty_firmware_add_segment(ctx->fw, address, 0, &ctx->segment);
-                if (r < 0)
-                    return r;
-
-                ctx->offset1 = 0;
-            } else {
-                ctx->offset1 = address - ctx->segment->address;
-            }
+            ctx->offset1 = (uint32_t)parse_hex_value(ctx, 2) << 16;
         } break;
 
         case 3:   // start segment address record
@@ -150,43 +150,165 @@ static int parse_line(struct parser_context *ctx, const char *line, size_t line_
     return (type == 1);
 }
 
-int ty_firmware_load_ihex(ty_firmware *fw, const uint8_t *mem, size_t len)
+int ty_firmware_ihex_parser_new(ty_firmware *fw, ty_firmware_ihex_parser **rparser)
 {
     assert(fw);
-    assert(!fw->segments_count && !fw->total_size);
-    assert(mem || !len);
+    assert(!fw->pages_count);
+    assert(rparser);
+
+    ty_firmware_ihex_parser *parser;
+
+    parser = calloc(1, sizeof(*parser));
+    if (!parser)
+        return ty_error(TY_ERROR_MEMORY, NULL);
+    parser->fw = fw;
+
+    *rparser = parser;
+    return 0;
+}
+
+void ty_firmware_ihex_parser_free(ty_firmware_ihex_parser *parser)
+{
+    free(parser);
+}
 
-    struct parser_context ctx = {0};
+static int end_line(ty_firmware_ihex_parser *parser, const char *line, size_t line_len)
+{
     int r;
 
-    ctx.fw = fw;
-    r = ty_firmware_add_segment(fw, 0, 0, &ctx.segment);
+    parser->line++;
+
+    // Returns 1 when EOF record is detected
+    r = parse_line(parser, line, line_len);
     if (r < 0)
         return r;
+    parser->eof = r;
+
+    return 0;
+}
+
+/* Complete lines are parsed in place, only the last incomplete line (if any) is copied
+   until the rest comes in. Everything after the EOF record is ignored. */
+int ty_firmware_ihex_parser_feed(ty_firmware_ihex_parser *parser, const uint8_t *mem, size_t len)
+{
+    assert(parser);
+    assert(mem || !len);
+
+    int r;
+
+    while (len && !parser->eof) {
+        size_t line_len = 0;
+        while (line_len < len && mem[line_len] != '\r' && mem[line_len] != '\n')
+            line_len++;
+
+        if (parser->buf_len || line_len == len) {
+            if (line_len > sizeof(parser->buf) - parser->buf_len) {
+                parser->line++;
+                return ihex_parse_error(parser);
+            }
+            memcpy(parser->buf + parser->buf_len, mem, line_len);
+            parser->buf_len += line_len;
+
+            if (line_len == len)
+                break;
+
+            r = end_line(parser, parser->buf, parser->buf_len);
+            if (r < 0)
+                return r;
+            parser->buf_len = 0;
+        } else if (line_len) {
+            r = end_line(parser, (const char *)mem, line_len);
+            if (r < 0)
+                return r;
+        }
 
-    size_t start, end = 0;
-    do {
-        start = end;
-        while (start < len && (mem[start] == '\r' || mem[start] == '\n'))
-            start++;
-        if (start >= len)
-            return ty_error(TY_ERROR_PARSE, "Missing EOF record in '%s' (IHEX)", fw->filename);
-        end = start;
-        while (end < len && mem[end] != '\r' && mem[end] != '\n')
-            end++;
-        ctx.line++;
-
-        // Returns 1 when EOF record is detected
-        r = parse_line(&ctx, (const char *)mem + start, end - start);
+        mem += line_len + 1;
+        len -= line_len + 1;
+    }
+
+    return 0;
+}
+
+int ty_firmware_ihex_parser_finish(ty_firmware_ihex_parser *parser)
+{
+    assert(parser);
+
+    int r;
+
+    // The last line does not need a line ending
+    if (!parser->eof && parser->buf_len) {
+        r = end_line(parser, parser->buf, parser->buf_len);
         if (r < 0)
             return r;
-    } while (!r);
-
-    for (unsigned int i = 0; i < fw->segments_count; i++) {
-        const ty_firmware_segment *segment = &fw->segments[i];
-        fw->total_size += segment->size;
-        fw->max_address = TY_MAX(fw->max_address, segment->address + segment->size);
+        parser->buf_len = 0;
     }
 
+    if (!parser->eof)
+        return ty_error(TY_ERROR_PARSE, "Missing EOF record in '%s' (IHEX)", parser->fw->filename);
+
     return 0;
 }
+
+int ty_firmware_load_ihex(ty_firmware *fw, const uint8_t *mem, size_t len)
+{
+    assert(fw);
+    assert(!fw->pages_count);
+    assert(mem || !len);
+
+    ty_firmware_ihex_parser *parser = NULL;
+    int r;
+
+    r = ty_firmware_ihex_parser_new(fw, &parser);
+    if (r < 0)
+        return r;
+
+    r = ty_firmware_ihex_parser_feed(parser, mem, len);
+    if (r < 0)
+        goto cleanup;
+    r = ty_firmware_ihex_parser_finish(parser);
+
+cleanup:
+    ty_firmware_ihex_parser_free(parser);
+    return r;
+}
+
+int ty_firmware_load_ihex_stream(ty_firmware *fw, ty_firmware_read_func *f, void *udata)
+{
+    assert(fw);
+    assert(!fw->pages_count);
+    assert(f);
+
+    ty_firmware_ihex_parser *parser = NULL;
+    uint8_t *buf = NULL;
+    int r;
+
+    r = ty_firmware_ihex_parser_new(fw, &parser);
+    if (r < 0)
+        return r;
+
+    buf = malloc(TY_FIRMWARE_STREAM_CHUNK_SIZE);
+    if (!buf) {
+        r = ty_error(TY_ERROR_MEMORY, NULL);
+        goto cleanup;
+    }
+
+    while (true) {
+        ssize_t len = (*f)(udata, buf, TY_FIRMWARE_STREAM_CHUNK_SIZE);
+        if (len < 0) {
+            r = (int)len;
+            goto cleanup;
+        }
+        if (!len)
+            break;
+
+        r = ty_firmware_ihex_parser_feed(parser, buf, (size_t)len);
+        if (r < 0)
+            goto cleanup;
+    }
+    r = ty_firmware_ihex_parser_finish(parser);
+
+cleanup:
+    free(buf);
+    ty_firmware_ihex_parser_free(parser);
+    return r;
+}
@@ -0,0 +1,236 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://koromix.dev/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#include "common_priv.h"
+#include "class_priv.h"
+#include "firmware.h"
+
+/* Flash images contain a firmware already split in the blocks the bootloader expects, and
+   the models it was identified with, so that they can be uploaded without parsing or
+   identifying anything. All integers are little-endian:
+
+       char magic[4] = "TYFI";
+       uint32_t version = 1;
+       uint32_t base_address;
+       uint32_t block_size;
+       uint32_t blocks_count;
+       uint32_t models_size;
+       char models[models_size]; // NUL-terminated model names
+       uint8_t bitmap[(blocks_count + 7) / 8];
+       uint8_t blocks[][block_size];
+
+   Block i covers base_address + i * block_size. Its bit in the bitmap (LSB first) is set if
+   it is stored in the image, and cleared if it is erased or outside the firmware, in which
+   case it does not need to be sent. Stored blocks follow each other in address order. */
+
+#define IMAGE_MAGIC "TYFI"
+#define IMAGE_VERSION 1
+#define IMAGE_HEADER_SIZE 24
+#define IMAGE_MAX_BLOCK_SIZE 65536
+
+static uint32_t read_image_uint32(const uint8_t *ptr)
+{
+    return (uint32_t)ptr[0] | ((uint32_t)ptr[1] << 8) | ((uint32_t)ptr[2] << 16) |
+           ((uint32_t)ptr[3] << 24);
+}
+
+static void write_image_uint32(uint8_t *ptr, uint32_t value)
+{
+    ptr[0] = (uint8_t)value;
+    ptr[1] = (uint8_t)(value >> 8);
+    ptr[2] = (uint8_t)(value >> 16);
+    ptr[3] = (uint8_t)(value >> 24);
+}
+
+static int image_malformed_error(ty_firmware *fw)
+{
+    return ty_error(TY_ERROR_PARSE, "Flash image '%s' is malformed or truncated", fw->filename);
+}
+
+int ty_firmware_load_image(ty_firmware *fw, const uint8_t *mem, size_t len)
+{
+    assert(fw);
+    assert(!fw->pages_count);
+    assert(mem || !len);
+
+    uint32_t version, base_address, block_size, blocks_count, models_size;
+    const uint8_t *models, *bitmap;
+    size_t bitmap_size, offset;
+    ty_model image_models[TY_FIRMWARE_MAX_MODELS];
+    unsigned int image_models_count = 0;
+    int r;
+
+    if (len < IMAGE_HEADER_SIZE || memcmp(mem, IMAGE_MAGIC, 4))
+        return ty_error(TY_ERROR_PARSE, "Missing flash image signature in '%s'", fw->filename);
+    version = read_image_uint32(mem + 4);
+    if (version != IMAGE_VERSION)
+        return ty_error(TY_ERROR_UNSUPPORTED, "Flash image '%s' uses unsupported version %"PRIu32,
+                        fw->filename, version);
+
+    base_address = read_image_uint32(mem + 8);
+    block_size = read_image_uint32(mem + 12);
+    blocks_count = read_image_uint32(mem + 16);
+    models_size = read_image_uint32(mem + 20);
+    if (!block_size || block_size > IMAGE_MAX_BLOCK_SIZE)
+        return image_malformed_error(fw);
+    if ((uint64_t)base_address + (uint64_t)blocks_count * block_size > (uint64_t)UINT32_MAX + 1)
+        return image_malformed_error(fw);
+    offset = IMAGE_HEADER_SIZE;
+
+    if (models_size > len - offset)
+        return image_malformed_error(fw);
+    models = mem + offset;
+    offset += models_size;
+
+    // Computed in size_t, blocks_count + 7 can overflow in 32-bit
+    bitmap_size = ((size_t)blocks_count + 7) / 8;
+    if (bitmap_size > len - offset)
+        return image_malformed_error(fw);
+    bitmap = mem + offset;
+    offset += bitmap_size;
+
+    for (uint32_t i = 0; i < blocks_count; i++) {
+        if (!(bitmap[i / 8] & (1 << (i % 8))))
+            continue;
+
+        if (block_size > len - offset)
+            return image_malformed_error(fw);
+        r = ty_firmware_write(fw, base_address + i * block_size, mem + offset, block_size);
+        if (r < 0)
+            return r;
+        offset += block_size;
+    }
+
+    for (size_t i = 0; i < models_size;) {
+        const char *name = (const char *)models + i;
+        const char *end = memchr(name, 0, models_size - i);
+        ty_model model;
+
+        if (!end)
+            return image_malformed_error(fw);
+
+        model = ty_models_find(name);
+        if (model && image_models_count < TY_COUNTOF(image_models)) {
+            image_models[image_models_count++] = model;
+        } else if (!model) {
+            ty_log(TY_LOG_WARNING, "Ignoring unknown model '%s' in flash image '%s'", name,
+                   fw->filename);
+        }
+
+        i += (size_t)(end - name) + 1;
+    }
+
+    // Trust the identification done when the image was built
+    memcpy(fw->models, image_models, image_models_count * sizeof(*image_models));
+    fw->models_count = image_models_count;
+    fw->identified = true;
+
+    return 0;
+}
+
+static int prepare_image_plan(ty_firmware *fw, ty_model model, _ty_upload_plan **rplan)
+{
+    for (unsigned int i = 0; i < _ty_classes_count; i++) {
+        const struct _ty_class_vtable *vtable = _ty_classes[i].vtable;
+        ty_model models[16];
+        unsigned int models_count;
+
+        if (!vtable->identify_models || !vtable->prepare_upload)
+            continue;
+
+        models_count = (*vtable->identify_models)(fw, models, TY_COUNTOF(models));
+        for (unsigned int j = 0; j < models_count; j++) {
+            if (models[j] == model)
+                return (*vtable->prepare_upload)(model, fw, rplan);
+        }
+    }
+
+    return ty_error(TY_ERROR_UNSUPPORTED, "Firmware '%s' is not compatible with %s",
+                    fw->name, ty_models[model].name);
+}
+
+int ty_firmware_build_image(ty_firmware *fw, ty_model model, uint8_t **rimage, size_t *rsize)
+{
+    assert(fw);
+    assert(model);
+    assert(rimage);
+    assert(rsize);
+
+    _ty_upload_plan *plan = NULL;
+    ty_model models[TY_FIRMWARE_MAX_MODELS];
+    unsigned int models_count;
+    size_t models_size = 0;
+    uint32_t base_address = 0, blocks_count = 0;
+    size_t bitmap_size, size;
+    uint8_t *image = NULL, *ptr;
+    int r;
+
+    r = prepare_image_plan(fw, model, &plan);
+    if (r < 0)
+        goto cleanup;
+
+    models_count = ty_firmware_identify(fw, models, TY_COUNTOF(models));
+    for (unsigned int i = 0; i < models_count; i++)
+        models_size += strlen(ty_models[models[i]].name) + 1;
+
+    if (plan->blocks.count) {
+        base_address = plan->blocks.values[0].address;
+        blocks_count = (uint32_t)((plan->blocks.values[plan->blocks.count - 1].address -
+                                   base_address) / plan->block_size + 1);
+    }
+    bitmap_size = (blocks_count + 7) / 8;
+
+    size = IMAGE_HEADER_SIZE + models_size + bitmap_size + plan->blocks.count * plan->block_size;
+    image = calloc(1, size);
+    if (!image) {
+        r = ty_error(TY_ERROR_MEMORY, NULL);
+        goto cleanup;
+    }
+
+    memcpy(image, IMAGE_MAGIC, 4);
+    write_image_uint32(image + 4, IMAGE_VERSION);
+    write_image_uint32(image + 8, base_address);
+    write_image_uint32(image + 12, (uint32_t)plan->block_size);
+    write_image_uint32(image + 16, blocks_count);
+    write_image_uint32(image + 20, (uint32_t)models_size);
+    ptr = image + IMAGE_HEADER_SIZE;
+
+    for (unsigned int i = 0; i < models_count; i++) {
+        size_t len = strlen(ty_models[models[i]].name) + 1;
+
+        memcpy(ptr, ty_models[models[i]].name, len);
+        ptr += len;
+    }
+
+    for (size_t i = 0; i < plan->blocks.count; i++) {
+        const _ty_upload_block *block = &plan->blocks.values[i];
+        size_t idx = (block->address - base_address) / plan->block_size;
+
+        ptr[idx / 8] = (uint8_t)(ptr[idx / 8] | (1 << (idx % 8)));
+    }
+    ptr += bitmap_size;
+
+    for (size_t i = 0; i < plan->blocks.count; i++) {
+        const _ty_upload_block *block = &plan->blocks.values[i];
+
+        memcpy(ptr, plan->data.values + block->offset, plan->block_size);
+        ptr += plan->block_size;
+    }
+
+    *rimage = image;
+    *rsize = size;
+    image = NULL;
+
+    r = 0;
+cleanup:
+    free(image);
+    _ty_upload_plan_free(plan);
+    return r;
+}
@@ -37,12 +37,17 @@ struct ty_monitor {
 
     ty_mutex refresh_mutex;
     ty_cond refresh_cond;
+    unsigned int refresh_waiters;
     int refresh_callback_ret;
 
+    _HS_ARRAY(ty_board *) notify_boards;
+    ty_monitor_wait_stats wait_stats;
+
     _HS_ARRAY(ty_board *) boards;
     _hs_htable ifaces;
 
     ty_thread_id main_thread_id;
+    ty_poller *poller;
 };
 
 #define DROP_BOARD_DELAY 15000
@@ -68,6 +73,15 @@ static int change_board_status(ty_board *board, ty_board_status status, ty_monit
         board->status = status;
     }
 
+    // Waiters for this board get woken up at the end of ty_monitor_refresh()
+    if (!board->wait_notify) {
+        r = _hs_array_push(&monitor->notify_boards, board);
+        if (r < 0)
+            return ty_libhs_translate_error(r);
+        ty_board_ref(board);
+        board->wait_notify = true;
+    }
+
     /* Notify callbacks and do some additional stuff as we go:
        - Drop callback that return r > 0
        - Stop calling them is one returns r < 0 */
@@ -109,6 +123,9 @@ static int create_board(ty_monitor *monitor, ty_board_interface *iface, ty_board
     }
 
     r = ty_mutex_init(&board->ifaces_lock);
+    if (r < 0)
+        goto error;
+    r = ty_cond_init(&board->wait_cond);
     if (r < 0)
         goto error;
 
@@ -154,8 +171,7 @@ static int close_board(ty_board *board)
     for (size_t i = 0; i < ifaces.count; i++) {
         ty_board_interface *iface_it = ifaces.values[i];
 
-        if (iface_it->monitor_hnode.next)
-            _hs_htable_remove(&iface_it->monitor_hnode);
+        _hs_htable_remove(&board->monitor->ifaces, _hs_htable_hash_ptr(iface_it->dev), iface_it);
         ty_board_interface_unref(iface_it);
     }
     _hs_array_release(&ifaces);
@@ -192,8 +208,8 @@ static ty_board *find_monitor_board(ty_monitor *monitor, const char *location)
 
 static ty_board_interface *find_monitor_interface(ty_monitor *monitor, hs_device *dev)
 {
-   _hs_htable_foreach_hash(cur, &monitor->ifaces, _hs_htable_hash_ptr(dev)) {
-        ty_board_interface *iface = ty_container_of(cur, ty_board_interface, monitor_hnode);
+    _hs_htable_foreach_hash(cur, &monitor->ifaces, _hs_htable_hash_ptr(dev)) {
+        ty_board_interface *iface = cur;
 
         if (iface->dev == dev)
             return iface;
@@ -318,8 +334,12 @@ static int register_interface(ty_board *board, ty_board_interface *iface)
         r = ty_libhs_translate_error(r);
         goto cleanup;
     }
-    _hs_htable_add(&board->monitor->ifaces, _hs_htable_hash_ptr(iface->dev),
-                   &iface->monitor_hnode);
+    r = _hs_htable_add(&board->monitor->ifaces, _hs_htable_hash_ptr(iface->dev), iface);
+    if (r < 0) {
+        board->ifaces.count--;
+        r = ty_libhs_translate_error(r);
+        goto cleanup;
+    }
 
     // Update board capabilities
     for (int i = 0; i < (int)TY_COUNTOF(board->cap2iface); i++) {
@@ -373,7 +393,7 @@ static int remove_interface_with_device(ty_monitor *monitor, hs_device *dev)
     board = iface->board;
 
     // Unregister from monitor
-    _hs_htable_remove(&iface->monitor_hnode);
+    _hs_htable_remove(&monitor->ifaces, _hs_htable_hash_ptr(dev), iface);
     ty_board_interface_unref(iface);
 
     ty_mutex_lock(&board->ifaces_lock);
@@ -488,7 +508,9 @@ void ty_monitor_free(ty_monitor *monitor)
 
         _hs_array_release(&monitor->callbacks);
         _hs_htable_release(&monitor->ifaces);
+        _hs_array_release(&monitor->notify_boards);
 
+        ty_poller_free(monitor->poller);
         ty_cond_release(&monitor->refresh_cond);
         ty_mutex_release(&monitor->refresh_mutex);
         hs_monitor_free(monitor->device_monitor);
@@ -514,6 +536,11 @@ int ty_monitor_start(ty_monitor *monitor)
     }
     monitor->started = true;
 
+    /* On Linux, libhs swaps the file behind its poll descriptor when the device monitor
+       starts or stops, and epoll registrations do not follow that. */
+    if (monitor->poller)
+        ty_poller_clear(monitor->poller);
+
     r = hs_monitor_list(monitor->device_monitor, device_callback, monitor);
     if (r < 0)
         goto error;
@@ -536,6 +563,17 @@ void ty_monitor_stop(ty_monitor *monitor)
     hs_monitor_stop(monitor->device_monitor);
     ty_timer_set(monitor->timer, -1, 0);
     monitor->timer_running = false;
+    if (monitor->poller)
+        ty_poller_clear(monitor->poller);
+
+    // Pending notifications can only matter to waiters, which will fail on their own
+    for (size_t i = 0; i < monitor->notify_boards.count; i++) {
+        ty_board *board_it = monitor->notify_boards.values[i];
+
+        board_it->wait_notify = false;
+        ty_board_unref(board_it);
+    }
+    monitor->notify_boards.count = 0;
 
     // Clear registered boards
     for (size_t i = 0; i < monitor->boards.count; i++) {
@@ -548,10 +586,7 @@ void ty_monitor_stop(ty_monitor *monitor)
 
     // Clear registered interfaces
     _hs_htable_foreach(cur, &monitor->ifaces) {
-        ty_board_interface *iface_it = ty_container_of(cur, ty_board_interface, monitor_hnode);
-
-        if (iface_it->monitor_hnode.next)
-            _hs_htable_remove(&iface_it->monitor_hnode);
+        ty_board_interface *iface_it = cur;
         ty_board_interface_unref(iface_it);
     }
     _hs_htable_clear(&monitor->ifaces);
@@ -594,6 +629,51 @@ void ty_monitor_deregister_callback(ty_monitor *monitor, int id)
     }
 }
 
+static void notify_waiters(ty_monitor *monitor)
+{
+    uint64_t lock_start, lock_time;
+
+    ty_mutex_lock(&monitor->refresh_mutex);
+    lock_start = ty_micros();
+
+    /* Each board waiter only cares about its own board, so only wake threads waiting on
+       boards that changed. Generic ty_monitor_wait() callers still get a broadcast. */
+    for (size_t i = 0; i < monitor->notify_boards.count; i++) {
+        ty_board *board = monitor->notify_boards.values[i];
+
+        if (board->waiters) {
+            ty_cond_broadcast(&board->wait_cond);
+            monitor->wait_stats.wakeups += board->waiters;
+        }
+        for (size_t j = 0; j < board->wait_tasks.count; j++) {
+            ty_task *task = board->wait_tasks.values[j];
+
+            _ty_task_resume(task);
+            ty_task_unref(task);
+        }
+        monitor->wait_stats.wakeups += board->wait_tasks.count;
+        board->wait_tasks.count = 0;
+        board->wait_notify = false;
+    }
+    if (monitor->refresh_waiters) {
+        ty_cond_broadcast(&monitor->refresh_cond);
+        monitor->wait_stats.wakeups += monitor->refresh_waiters;
+    }
+    monitor->wait_stats.notifications++;
+
+    lock_time = ty_micros() - lock_start;
+    monitor->wait_stats.lock_hold_total += lock_time;
+    if (lock_time > monitor->wait_stats.lock_hold_max)
+        monitor->wait_stats.lock_hold_max = lock_time;
+
+    ty_mutex_unlock(&monitor->refresh_mutex);
+
+    // Release outside the lock, this may free dropped boards
+    for (size_t i = 0; i < monitor->notify_boards.count; i++)
+        ty_board_unref(monitor->notify_boards.values[i]);
+    monitor->notify_boards.count = 0;
+}
+
 int ty_monitor_refresh(ty_monitor *monitor)
 {
     assert(monitor);
@@ -638,9 +718,7 @@ int ty_monitor_refresh(ty_monitor *monitor)
         return ty_libhs_translate_error(r);
     }
 
-    ty_mutex_lock(&monitor->refresh_mutex);
-    ty_cond_broadcast(&monitor->refresh_cond);
-    ty_mutex_unlock(&monitor->refresh_mutex);
+    notify_waiters(monitor);
 
     return 0;
 }
@@ -650,24 +728,42 @@ int ty_monitor_wait(ty_monitor *monitor, ty_monitor_wait_func *f, void *udata, i
     assert(monitor);
     assert(f || (monitor->main_thread_id == ty_thread_get_self_id()));
 
-    ty_descriptor_set set = {0};
     uint64_t start;
     int r;
 
     start = ty_millis();
     if (monitor->main_thread_id != ty_thread_get_self_id()) {
         ty_mutex_lock(&monitor->refresh_mutex);
+        monitor->refresh_waiters++;
         while (!(r = (*f)(monitor, udata))) {
             r = ty_cond_wait(&monitor->refresh_cond, &monitor->refresh_mutex,
                              ty_adjust_timeout(timeout, start));
             if (!r)
                 break;
         }
+        monitor->refresh_waiters--;
         ty_mutex_unlock(&monitor->refresh_mutex);
 
         return r;
     } else {
-        ty_monitor_get_descriptors(monitor, &set, 1);
+        int ready_id;
+
+        // Keep the descriptors registered between calls, ty_monitor_start() resets them
+        if (!monitor->poller) {
+            r = ty_poller_new(&monitor->poller);
+            if (r < 0)
+                return r;
+        }
+        if (!ty_poller_get_count(monitor->poller)) {
+            ty_descriptor_set set = {0};
+
+            ty_monitor_get_descriptors(monitor, &set, 1);
+            r = ty_poller_add_set(monitor->poller, &set);
+            if (r < 0) {
+                ty_poller_clear(monitor->poller);
+                return r;
+            }
+        }
 
         do {
             r = ty_monitor_refresh(monitor);
@@ -680,12 +776,111 @@ int ty_monitor_wait(ty_monitor *monitor, ty_monitor_wait_func *f, void *udata, i
                     return r;
             }
 
-            r = ty_poll(&set, ty_adjust_timeout(timeout, start));
+            r = ty_poller_wait(monitor->poller, &ready_id, 1, ty_adjust_timeout(timeout, start));
         } while (r > 0);
         return r;
     }
 }
 
+void ty_monitor_get_wait_stats(ty_monitor *monitor, ty_monitor_wait_stats *rstats)
+{
+    assert(monitor);
+    assert(rstats);
+
+    ty_mutex_lock(&monitor->refresh_mutex);
+    *rstats = monitor->wait_stats;
+    ty_mutex_unlock(&monitor->refresh_mutex);
+}
+
+int _ty_monitor_wait_board(ty_monitor *monitor, ty_board *board,
+                           ty_monitor_wait_func *f, void *udata, int timeout)
+{
+    assert(monitor);
+    assert(board);
+    assert(f);
+
+    ty_task *task = ty_task_get_current();
+    uint64_t start;
+    int r;
+
+    // Waits made on behalf of a task end with it, see ty_task_cancel()
+    timeout = _ty_task_adjust_timeout(task, timeout);
+
+    if (monitor->main_thread_id == ty_thread_get_self_id()) {
+        r = ty_monitor_wait(monitor, f, udata, timeout);
+        if (!r)
+            r = _ty_task_check(task);
+        return r;
+    }
+
+    if (task)
+        _ty_task_set_wakeup(task, &monitor->refresh_mutex, &board->wait_cond);
+
+    start = ty_millis();
+    ty_mutex_lock(&monitor->refresh_mutex);
+    board->waiters++;
+    while (!(r = (*f)(monitor, udata))) {
+        if (task && task->canceled)
+            break;
+        r = ty_cond_wait(&board->wait_cond, &monitor->refresh_mutex,
+                         ty_adjust_timeout(timeout, start));
+        if (!r)
+            break;
+    }
+    board->waiters--;
+    ty_mutex_unlock(&monitor->refresh_mutex);
+
+    if (task) {
+        _ty_task_set_wakeup(task, NULL, NULL);
+        if (!r)
+            r = _ty_task_check(task);
+    }
+
+    return r;
+}
+
+int _ty_monitor_watch_board(ty_monitor *monitor, ty_board *board, ty_task *task)
+{
+    assert(monitor);
+    assert(board);
+    assert(task);
+
+    int r;
+
+    // The task gets resumed once, on the next change to this board
+    ty_mutex_lock(&monitor->refresh_mutex);
+    r = _hs_array_push(&board->wait_tasks, task);
+    if (r >= 0)
+        ty_task_ref(task);
+    ty_mutex_unlock(&monitor->refresh_mutex);
+
+    return ty_libhs_translate_error(r);
+}
+
+void _ty_monitor_unwatch_board(ty_monitor *monitor, ty_board *board, ty_task *task)
+{
+    assert(monitor);
+    assert(board);
+    assert(task);
+
+    bool found = false;
+
+    /* The registration stays until the next change to the board, remove it if the task
+       has resumed for another reason (timeout, cancellation) or is done. */
+    ty_mutex_lock(&monitor->refresh_mutex);
+    for (size_t i = 0; i < board->wait_tasks.count; i++) {
+        if (board->wait_tasks.values[i] == task) {
+            _hs_array_remove(&board->wait_tasks, i, 1);
+            found = true;
+            break;
+        }
+    }
+    ty_mutex_unlock(&monitor->refresh_mutex);
+
+    if (found)
+        ty_task_unref(task);
+}
+
 int ty_monitor_list(ty_monitor *monitor, ty_monitor_callback_func *f, void *udata)
 {
     assert(monitor);
@@ -26,6 +26,13 @@ typedef enum ty_monitor_event {
     TY_MONITOR_EVENT_DROPPED
 } ty_monitor_event;
 
+typedef struct ty_monitor_wait_stats {
+    uint64_t notifications;
+    uint64_t wakeups;
+    uint64_t lock_hold_total; // microseconds
+    uint64_t lock_hold_max; // microseconds
+} ty_monitor_wait_stats;
+
 typedef int ty_monitor_callback_func(struct ty_board *board, ty_monitor_event event, void *udata);
 typedef int ty_monitor_wait_func(ty_monitor *monitor, void *udata);
 
@@ -42,6 +49,7 @@ void ty_monitor_deregister_callback(ty_monitor *monitor, int id);
 
 int ty_monitor_refresh(ty_monitor *monitor);
 int ty_monitor_wait(ty_monitor *monitor, ty_monitor_wait_func *f, void *udata, int timeout);
+void ty_monitor_get_wait_stats(ty_monitor *monitor, ty_monitor_wait_stats *rstats);
 
 int ty_monitor_list(ty_monitor *monitor, ty_monitor_callback_func *f, void *udata);
 
@@ -62,3 +62,17 @@ void ty_descriptor_set_remove(ty_descriptor_set *set, int id)
 
     set->count = count;
 }
+
+int ty_poller_add_set(ty_poller *poller, const ty_descriptor_set *set)
+{
+    assert(poller);
+    assert(set);
+
+    for (unsigned int i = 0; i < set->count; i++) {
+        int r = ty_poller_add(poller, set->desc[i], set->id[i]);
+        if (r < 0)
+            return r;
+    }
+
+    return 0;
+}
@@ -53,6 +53,8 @@ typedef struct ty_descriptor_set {
     int id[64];
 } ty_descriptor_set;
 
+typedef struct ty_poller ty_poller;
+
 enum {
     TY_TERMINAL_RAW = 0x1,
     TY_TERMINAL_SILENT = 0x2
@@ -63,6 +65,7 @@ char *ty_win32_strerror(unsigned long err);
 #endif
 
 uint64_t ty_millis(void);
+uint64_t ty_micros(void);
 void ty_delay(unsigned int ms);
 
 int ty_adjust_timeout(int timeout, uint64_t start);
@@ -83,6 +86,18 @@ unsigned int ty_standard_get_paths(ty_standard_path std_path, const char *suffix
 
 int ty_poll(const ty_descriptor_set *set, int timeout);
 
+int ty_poller_new(ty_poller **rpoller);
+void ty_poller_free(ty_poller *poller);
+
+int ty_poller_add(ty_poller *poller, ty_descriptor desc, int id);
+int ty_poller_add_set(ty_poller *poller, const ty_descriptor_set *set);
+void ty_poller_remove(ty_poller *poller, int id);
+void ty_poller_clear(ty_poller *poller);
+
+unsigned int ty_poller_get_count(const ty_poller *poller);
+
+int ty_poller_wait(ty_poller *poller, int *rids, unsigned int max_ids, int timeout);
+
 bool ty_compare_paths(const char *path1, const char *path2);
 
 int ty_terminal_setup(int flags);
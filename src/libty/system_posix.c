@@ -10,6 +10,7 @@
 
 #include "common_priv.h"
 #include <fcntl.h>
+#include <poll.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
@@ -20,9 +21,10 @@
     #include <mach/mach_time.h>
     #include <mach-o/dyld.h>
     #include <sys/select.h>
-#else
-    #include <poll.h>
+#elif defined(__linux__)
+    #include <sys/epoll.h>
 #endif
+#include "../libhs/array.h"
 #include "system.h"
 
 struct child_report {
@@ -44,6 +46,15 @@ uint64_t ty_millis(void)
     return (uint64_t)mach_absolute_time() * tb.numer / tb.denom / 1000000;
 }
 
+uint64_t ty_micros(void)
+{
+    static mach_timebase_info_data_t tb;
+    if (!tb.numer)
+        mach_timebase_info(&tb);
+
+    return (uint64_t)mach_absolute_time() * tb.numer / tb.denom / 1000;
+}
+
 #else
 
 uint64_t ty_millis(void)
@@ -61,7 +72,25 @@ uint64_t ty_millis(void)
         return 0;
     }
 
-    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 10000000;
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+uint64_t ty_micros(void)
+{
+    struct timespec ts;
+    int r;
+
+#ifdef CLOCK_MONOTONIC_RAW
+    r = clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+#else
+    r = clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+    if (r < 0) {
+        ty_log(TY_LOG_WARNING, "clock_gettime() failed: %s", strerror(errno));
+        return 0;
+    }
+
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
 }
 
 #endif
@@ -351,6 +380,374 @@ restart:
 
 #endif
 
+static void push_ready_id(int *rids, unsigned int *rcount, int id)
+{
+    for (unsigned int i = 0; i < *rcount; i++) {
+        if (rids[i] == id)
+            return;
+    }
+    rids[(*rcount)++] = id;
+}
+
+#ifdef __linux__
+
+struct poller_entry {
+    int fd;
+    int id;
+
+    /* epoll refuses regular files (EPERM), but poll() and select() consider them
+       readable at all times so we emulate that. */
+    bool always_ready;
+};
+
+struct ty_poller {
+    int epfd;
+
+    _HS_ARRAY(struct poller_entry) entries;
+    unsigned int always_ready_count;
+
+    _HS_ARRAY(struct epoll_event) events;
+};
+
+int ty_poller_new(ty_poller **rpoller)
+{
+    assert(rpoller);
+
+    ty_poller *poller;
+    int r;
+
+    poller = calloc(1, sizeof(*poller));
+    if (!poller) {
+        r = ty_error(TY_ERROR_MEMORY, NULL);
+        goto error;
+    }
+    poller->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (poller->epfd < 0) {
+        r = ty_error(TY_ERROR_SYSTEM, "epoll_create1() failed: %s", strerror(errno));
+        goto error;
+    }
+
+    r = _hs_array_grow(&poller->events, 8);
+    if (r < 0) {
+        r = ty_libhs_translate_error(r);
+        goto error;
+    }
+
+    *rpoller = poller;
+    return 0;
+
+error:
+    ty_poller_free(poller);
+    return r;
+}
+
+void ty_poller_free(ty_poller *poller)
+{
+    if (poller) {
+        if (poller->epfd >= 0)
+            close(poller->epfd);
+        _hs_array_release(&poller->entries);
+        _hs_array_release(&poller->events);
+    }
+
+    free(poller);
+}
+
+int ty_poller_add(ty_poller *poller, ty_descriptor desc, int id)
+{
+    assert(poller);
+    assert(desc >= 0);
+
+    struct poller_entry entry = {0};
+    struct epoll_event ev = {0};
+    int r;
+
+    // Keep one event slot per descriptor, so that epoll_wait() can report all of them
+    r = _hs_array_grow(&poller->entries, 1);
+    if (r < 0)
+        return ty_libhs_translate_error(r);
+    r = _hs_array_grow(&poller->events, poller->entries.count + 1);
+    if (r < 0)
+        return ty_libhs_translate_error(r);
+
+    entry.fd = desc;
+    entry.id = id;
+
+    ev.events = EPOLLIN;
+    ev.data.u64 = (uint32_t)id;
+
+    r = epoll_ctl(poller->epfd, EPOLL_CTL_ADD, desc, &ev);
+    if (r < 0) {
+        if (errno != EPERM)
+            return ty_error(TY_ERROR_SYSTEM, "epoll_ctl() failed: %s", strerror(errno));
+
+        entry.always_ready = true;
+        poller->always_ready_count++;
+    }
+
+    poller->entries.values[poller->entries.count++] = entry;
+    return 0;
+}
+
+void ty_poller_remove(ty_poller *poller, int id)
+{
+    assert(poller);
+
+    size_t count = 0;
+    for (size_t i = 0; i < poller->entries.count; i++) {
+        struct poller_entry *entry = &poller->entries.values[i];
+
+        if (entry->id == id) {
+            if (entry->always_ready) {
+                poller->always_ready_count--;
+            } else {
+                // Closed descriptors are dropped by the kernel, so ignore errors
+                epoll_ctl(poller->epfd, EPOLL_CTL_DEL, entry->fd, NULL);
+            }
+        } else {
+            poller->entries.values[count++] = *entry;
+        }
+    }
+
+    poller->entries.count = count;
+}
+
+void ty_poller_clear(ty_poller *poller)
+{
+    assert(poller);
+
+    for (size_t i = 0; i < poller->entries.count; i++) {
+        struct poller_entry *entry = &poller->entries.values[i];
+
+        if (!entry->always_ready)
+            epoll_ctl(poller->epfd, EPOLL_CTL_DEL, entry->fd, NULL);
+    }
+
+    poller->entries.count = 0;
+    poller->always_ready_count = 0;
+}
+
+unsigned int ty_poller_get_count(const ty_poller *poller)
+{
+    assert(poller);
+    return (unsigned int)poller->entries.count;
+}
+
+int ty_poller_wait(ty_poller *poller, int *rids, unsigned int max_ids, int timeout)
+{
+    assert(poller);
+    assert(rids);
+    assert(max_ids);
+
+    unsigned int ids_count = 0;
+    uint64_t start;
+    int r;
+
+    if (poller->always_ready_count) {
+        for (size_t i = 0; i < poller->entries.count && ids_count < max_ids; i++) {
+            const struct poller_entry *entry = &poller->entries.values[i];
+
+            if (entry->always_ready)
+                push_ready_id(rids, &ids_count, entry->id);
+        }
+
+        // Still check the other descriptors, but don't block
+        timeout = 0;
+    }
+
+    start = ty_millis();
+restart:
+    r = epoll_wait(poller->epfd, poller->events.values, (int)poller->events.allocated,
+                   ty_adjust_timeout(timeout, start));
+    if (r < 0) {
+        if (errno == EINTR)
+            goto restart;
+
+        return ty_error(TY_ERROR_SYSTEM, "epoll_wait() failed: %s", strerror(errno));
+    }
+
+    for (int i = 0; i < r && ids_count < max_ids; i++) {
+        int id = (int)(uint32_t)poller->events.values[i].data.u64;
+        push_ready_id(rids, &ids_count, id);
+    }
+
+    return (int)ids_count;
+}
+
+#else
+
+struct ty_poller {
+    _HS_ARRAY(struct pollfd) pfds;
+    _HS_ARRAY(int) ids;
+};
+
+int ty_poller_new(ty_poller **rpoller)
+{
+    assert(rpoller);
+
+    ty_poller *poller;
+
+    poller = calloc(1, sizeof(*poller));
+    if (!poller)
+        return ty_error(TY_ERROR_MEMORY, NULL);
+
+    *rpoller = poller;
+    return 0;
+}
+
+void ty_poller_free(ty_poller *poller)
+{
+    if (poller) {
+        _hs_array_release(&poller->pfds);
+        _hs_array_release(&poller->ids);
+    }
+
+    free(poller);
+}
+
+int ty_poller_add(ty_poller *poller, ty_descriptor desc, int id)
+{
+    assert(poller);
+    assert(desc >= 0);
+
+    struct pollfd pfd = {0};
+    int r;
+
+#ifdef __APPLE__
+    if (desc >= FD_SETSIZE)
+        return ty_error(TY_ERROR_RANGE, "Cannot poll descriptors above %d", FD_SETSIZE - 1);
+#endif
+
+    r = _hs_array_grow(&poller->pfds, 1);
+    if (r < 0)
+        return ty_libhs_translate_error(r);
+    r = _hs_array_grow(&poller->ids, 1);
+    if (r < 0)
+        return ty_libhs_translate_error(r);
+
+    pfd.fd = desc;
+    pfd.events = POLLIN;
+
+    poller->pfds.values[poller->pfds.count++] = pfd;
+    poller->ids.values[poller->ids.count++] = id;
+
+    return 0;
+}
+
+void ty_poller_remove(ty_poller *poller, int id)
+{
+    assert(poller);
+
+    size_t count = 0;
+    for (size_t i = 0; i < poller->pfds.count; i++) {
+        if (poller->ids.values[i] != id) {
+            poller->pfds.values[count] = poller->pfds.values[i];
+            poller->ids.values[count] = poller->ids.values[i];
+
+            count++;
+        }
+    }
+
+    poller->pfds.count = count;
+    poller->ids.count = count;
+}
+
+void ty_poller_clear(ty_poller *poller)
+{
+    assert(poller);
+
+    poller->pfds.count = 0;
+    poller->ids.count = 0;
+}
+
+unsigned int ty_poller_get_count(const ty_poller *poller)
+{
+    assert(poller);
+    return (unsigned int)poller->pfds.count;
+}
+
+#ifdef __APPLE__
+
+int ty_poller_wait(ty_poller *poller, int *rids, unsigned int max_ids, int timeout)
+{
+    assert(poller);
+    assert(rids);
+    assert(max_ids);
+
+    fd_set fds;
+    unsigned int ids_count = 0;
+    uint64_t start;
+    struct timeval tv;
+    int r;
+
+    // poll() does not work with device files on macOS, same as ty_poll()
+    start = ty_millis();
+restart:
+    FD_ZERO(&fds);
+    for (size_t i = 0; i < poller->pfds.count; i++)
+        FD_SET(poller->pfds.values[i].fd, &fds);
+
+    if (timeout >= 0) {
+        int adjusted_timeout = ty_adjust_timeout(timeout, start);
+        tv.tv_sec = adjusted_timeout / 1000;
+        tv.tv_usec = (adjusted_timeout % 1000) * 1000;
+        r = select(FD_SETSIZE, &fds, NULL, NULL, &tv);
+    } else {
+        r = select(FD_SETSIZE, &fds, NULL, NULL, NULL);
+    }
+    if (r < 0) {
+        if (errno == EINTR)
+            goto restart;
+
+        return ty_error(TY_ERROR_SYSTEM, "select() failed: %s", strerror(errno));
+    }
+    if (!r)
+        return 0;
+
+    for (size_t i = 0; i < poller->pfds.count && ids_count < max_ids; i++) {
+        if (FD_ISSET(poller->pfds.values[i].fd, &fds))
+            push_ready_id(rids, &ids_count, poller->ids.values[i]);
+    }
+
+    return (int)ids_count;
+}
+
+#else
+
+int ty_poller_wait(ty_poller *poller, int *rids, unsigned int max_ids, int timeout)
+{
+    assert(poller);
+    assert(rids);
+    assert(max_ids);
+
+    unsigned int ids_count = 0;
+    uint64_t start;
+    int r;
+
+    start = ty_millis();
+restart:
+    r = poll(poller->pfds.values, (nfds_t)poller->pfds.count, ty_adjust_timeout(timeout, start));
+    if (r < 0) {
+        if (errno == EINTR)
+            goto restart;
+
+        return ty_error(TY_ERROR_SYSTEM, "poll() failed: %s", strerror(errno));
+    }
+    if (!r)
+        return 0;
+
+    for (size_t i = 0; i < poller->pfds.count && ids_count < max_ids; i++) {
+        if (poller->pfds.values[i].revents & (POLLIN | POLLERR | POLLHUP | POLLNVAL))
+            push_ready_id(rids, &ids_count, poller->ids.values[i]);
+    }
+
+    return (int)ids_count;
+}
+
+#endif
+
+#endif
+
 bool ty_compare_paths(const char *path1, const char *path2)
 {
     assert(path1);
@@ -14,6 +14,7 @@
 #include <direct.h>
 #include <io.h>
 #include <shlobj.h>
+#include "../libhs/array.h"
 #include "system.h"
 
 typedef ULONGLONG WINAPI GetTickCount64_func(void);
@@ -80,6 +81,23 @@ uint64_t ty_millis(void)
     return GetTickCount64_();
 }
 
+uint64_t ty_micros(void)
+{
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER now;
+    BOOL success TY_POSSIBLY_UNUSED;
+
+    if (!freq.QuadPart) {
+        success = QueryPerformanceFrequency(&freq);
+        assert(success);
+    }
+    success = QueryPerformanceCounter(&now);
+    assert(success);
+
+    return (uint64_t)now.QuadPart / (uint64_t)freq.QuadPart * 1000000 +
+           (uint64_t)now.QuadPart % (uint64_t)freq.QuadPart * 1000000 / (uint64_t)freq.QuadPart;
+}
+
 void ty_delay(unsigned int ms)
 {
     Sleep(ms);
@@ -212,6 +230,143 @@ int ty_poll(const ty_descriptor_set *set, int timeout)
     return set->id[ret - WAIT_OBJECT_0];
 }
 
+struct ty_poller {
+    _HS_ARRAY(HANDLE) handles;
+    _HS_ARRAY(int) ids;
+};
+
+int ty_poller_new(ty_poller **rpoller)
+{
+    assert(rpoller);
+
+    ty_poller *poller;
+
+    poller = calloc(1, sizeof(*poller));
+    if (!poller)
+        return ty_error(TY_ERROR_MEMORY, NULL);
+
+    *rpoller = poller;
+    return 0;
+}
+
+void ty_poller_free(ty_poller *poller)
+{
+    if (poller) {
+        _hs_array_release(&poller->handles);
+        _hs_array_release(&poller->ids);
+    }
+
+    free(poller);
+}
+
+int ty_poller_add(ty_poller *poller, ty_descriptor desc, int id)
+{
+    assert(poller);
+    assert(desc);
+
+    int r;
+
+    if (poller->handles.count >= MAXIMUM_WAIT_OBJECTS)
+        return ty_error(TY_ERROR_RANGE, "Cannot wait on more than %d descriptors",
+                        MAXIMUM_WAIT_OBJECTS);
+
+    r = _hs_array_grow(&poller->handles, 1);
+    if (r < 0)
+        return ty_libhs_translate_error(r);
+    r = _hs_array_grow(&poller->ids, 1);
+    if (r < 0)
+        return ty_libhs_translate_error(r);
+
+    poller->handles.values[poller->handles.count++] = desc;
+    poller->ids.values[poller->ids.count++] = id;
+
+    return 0;
+}
+
+void ty_poller_remove(ty_poller *poller, int id)
+{
+    assert(poller);
+
+    size_t count = 0;
+    for (size_t i = 0; i < poller->handles.count; i++) {
+        if (poller->ids.values[i] != id) {
+            poller->handles.values[count] = poller->handles.values[i];
+            poller->ids.values[count] = poller->ids.values[i];
+
+            count++;
+        }
+    }
+
+    poller->handles.count = count;
+    poller->ids.count = count;
+}
+
+void ty_poller_clear(ty_poller *poller)
+{
+    assert(poller);
+
+    poller->handles.count = 0;
+    poller->ids.count = 0;
+}
+
+unsigned int ty_poller_get_count(const ty_poller *poller)
+{
+    assert(poller);
+    return (unsigned int)poller->handles.count;
+}
+
+static void push_ready_id(int *rids, unsigned int *rcount, int id)
+{
+    for (unsigned int i = 0; i < *rcount; i++) {
+        if (rids[i] == id)
+            return;
+    }
+    rids[(*rcount)++] = id;
+}
+
+int ty_poller_wait(ty_poller *poller, int *rids, unsigned int max_ids, int timeout)
+{
+    assert(poller);
+    assert(rids);
+    assert(max_ids);
+
+    DWORD count = (DWORD)poller->handles.count;
+    unsigned int ids_count = 0;
+    DWORD ret;
+
+    if (!count) {
+        Sleep(timeout < 0 ? INFINITE : (DWORD)timeout);
+        return 0;
+    }
+
+    ret = WaitForMultipleObjects(count, poller->handles.values, FALSE,
+                                 timeout < 0 ? INFINITE : (DWORD)timeout);
+    switch (ret) {
+        case WAIT_FAILED: {
+            return ty_error(TY_ERROR_SYSTEM, "WaitForMultipleObjects() failed: %s",
+                            ty_win32_strerror(0));
+        } break;
+        case WAIT_TIMEOUT: {
+            return 0;
+        } break;
+    }
+
+    /* WaitForMultipleObjects() only reports the first signaled handle, look for
+       other ones without blocking. */
+    for (DWORD offset = ret - WAIT_OBJECT_0; offset < count && ids_count < max_ids;) {
+        push_ready_id(rids, &ids_count, poller->ids.values[offset++]);
+        if (offset >= count)
+            break;
+
+        ret = WaitForMultipleObjects(count - offset, poller->handles.values + offset, FALSE, 0);
+        if (ret >= WAIT_OBJECT_0 + count - offset)
+            break;
+        offset += ret - WAIT_OBJECT_0;
+    }
+
+    return (int)ids_count;
+}
+
 int ty_terminal_setup(int flags)
 {
     HANDLE handle;
@@ -10,11 +10,21 @@
 
 #include "common_priv.h"
 #include "../libhs/array.h"
+#include "../libhs/htable.h"
 #include "system.h"
 #include "task.h"
 
+/* Tasks sharing the same serial key run one at a time, in the order they were started.
+   The head of each queue is the task that sits in pending_tasks or runs, the others
+   wait here until it finishes. */
+struct serial_queue {
+    const void *key;
+    _HS_ARRAY(ty_task *) tasks;
+};
+
 struct ty_pool {
     int unused_timeout;
+    unsigned int min_threads;
     unsigned int max_threads;
 
     ty_mutex mutex;
@@ -25,11 +35,24 @@ struct ty_pool {
     _HS_ARRAY(ty_task *) pending_tasks;
     ty_cond pending_cond;
 
+    _hs_htable serial_queues;
+
+    /* Suspended tasks, in a min-heap ordered by resume_deadline (ty_task::parked_index
+       is the position of each task). Resuming a task moves its deadline to 0. */
+    _HS_ARRAY(ty_task *) parked_tasks;
+
+    // Statistics, see ty_pool_get_stats()
+    uint64_t workers_started;
+    uint64_t workers_stopped;
+    ty_pool_task_stats total_stats;
+    _HS_ARRAY(ty_pool_task_stats) task_stats;
+
     bool init;
 };
 
 static ty_pool *default_pool;
 static TY_THREAD_LOCAL ty_task *current_task;
+static TY_THREAD_LOCAL ty_pool *current_worker_pool;
 
 int ty_pool_new(ty_pool **rpool)
 {
@@ -53,6 +76,11 @@ int ty_pool_new(ty_pool **rpool)
     r = ty_cond_init(&pool->pending_cond);
     if (r < 0)
         goto error;
+    r = _hs_htable_init(&pool->serial_queues, 16);
+    if (r < 0) {
+        r = ty_libhs_translate_error(r);
+        goto error;
+    }
 
     pool->init = true;
 
@@ -75,6 +103,23 @@ void ty_pool_free(ty_pool *pool)
                 ty_task_unref(task);
             }
             _hs_array_release(&pool->pending_tasks);
+            _hs_htable_foreach(cur, &pool->serial_queues) {
+                struct serial_queue *queue = cur;
+
+                // The head task was in pending_tasks, or belongs to the worker running it
+                for (size_t i = 1; i < queue->tasks.count; i++)
+                    ty_task_unref(queue->tasks.values[i]);
+                _hs_array_release(&queue->tasks);
+                free(queue);
+            }
+            _hs_htable_clear(&pool->serial_queues);
+            for (size_t i = 0; i < pool->parked_tasks.count; i++) {
+                ty_task *task = pool->parked_tasks.values[i];
+
+                task->parked = false;
+                ty_task_unref(task);
+            }
+            _hs_array_release(&pool->parked_tasks);
             pool->max_threads = 0;
             ty_cond_broadcast(&pool->pending_cond);
 
@@ -91,6 +136,10 @@ void ty_pool_free(ty_pool *pool)
             _hs_array_release(&pool->worker_threads);
         }
 
+        for (size_t i = 0; i < pool->task_stats.count; i++)
+            free((char *)pool->task_stats.values[i].name);
+        _hs_array_release(&pool->task_stats);
+        _hs_htable_release(&pool->serial_queues);
         ty_cond_release(&pool->pending_cond);
         ty_mutex_release(&pool->mutex);
     }
@@ -124,6 +173,13 @@ int ty_pool_set_max_threads(ty_pool *pool, unsigned int max)
     }
     pool->max_threads = max;
 
+    while (pool->worker_threads.count < pool->min_threads &&
+           pool->worker_threads.count < pool->max_threads) {
+        r = start_worker_thread(pool);
+        if (r < 0)
+            goto cleanup;
+    }
+
     r = 0;
 cleanup:
     ty_mutex_unlock(&pool->mutex);
@@ -136,6 +192,36 @@ unsigned int ty_pool_get_max_threads(ty_pool *pool)
     return pool->max_threads;
 }
 
+int ty_pool_set_min_threads(ty_pool *pool, unsigned int min)
+{
+    assert(pool);
+
+    int r;
+
+    ty_mutex_lock(&pool->mutex);
+
+    pool->min_threads = min;
+
+    // Start them now, so that the first tasks don't have to wait for thread creation
+    while (pool->worker_threads.count < pool->min_threads &&
+           pool->worker_threads.count < pool->max_threads) {
+        r = start_worker_thread(pool);
+        if (r < 0)
+            goto cleanup;
+    }
+
+    r = 0;
+cleanup:
+    ty_mutex_unlock(&pool->mutex);
+    return r;
+}
+
+unsigned int ty_pool_get_min_threads(ty_pool *pool)
+{
+    assert(pool);
+    return pool->min_threads;
+}
+
 void ty_pool_set_idle_timeout(ty_pool *pool, int timeout)
 {
     assert(pool);
@@ -173,6 +259,111 @@ int ty_pool_get_default(ty_pool **rpool)
     return 0;
 }
 
+void ty_pool_get_stats(ty_pool *pool, ty_pool_stats *rstats)
+{
+    assert(pool);
+    assert(rstats);
+
+    ty_mutex_lock(&pool->mutex);
+
+    rstats->min_threads = pool->min_threads;
+    rstats->max_threads = pool->max_threads;
+    rstats->workers = (unsigned int)pool->worker_threads.count;
+    rstats->busy_workers = (unsigned int)pool->busy_workers;
+    rstats->workers_started = pool->workers_started;
+    rstats->workers_stopped = pool->workers_stopped;
+
+    rstats->pending_tasks = pool->pending_tasks.count;
+    _hs_htable_foreach(cur, &pool->serial_queues) {
+        struct serial_queue *queue = cur;
+        rstats->pending_tasks += queue->tasks.count - 1;
+    }
+    rstats->parked_tasks = pool->parked_tasks.count;
+
+    rstats->tasks = pool->total_stats;
+
+    ty_mutex_unlock(&pool->mutex);
+}
+
+int ty_pool_list_task_stats(ty_pool *pool, ty_pool_stats_func *f, void *udata)
+{
+    assert(pool);
+    assert(f);
+
+    ty_pool_task_stats *stats;
+    size_t count;
+    int r;
+
+    // Copy the values so that the callback can do whatever it wants with the pool
+    ty_mutex_lock(&pool->mutex);
+    count = pool->task_stats.count;
+    stats = malloc(count * sizeof(*stats) + 1);
+    if (!stats) {
+        ty_mutex_unlock(&pool->mutex);
+        return ty_error(TY_ERROR_MEMORY, NULL);
+    }
+    memcpy(stats, pool->task_stats.values, count * sizeof(*stats));
+    ty_mutex_unlock(&pool->mutex);
+
+    r = 0;
+    for (size_t i = 0; i < count; i++) {
+        r = (*f)(&stats[i], udata);
+        if (r)
+            break;
+    }
+
+    free(stats);
+    return r;
+}
+
+void ty_pool_reset_stats(ty_pool *pool)
+{
+    assert(pool);
+
+    ty_mutex_lock(&pool->mutex);
+
+    pool->workers_started = 0;
+    pool->workers_stopped = 0;
+    memset(&pool->total_stats, 0, sizeof(pool->total_stats));
+    // Keep the names, ty_pool_list_task_stats() callers may still use them
+    for (size_t i = 0; i < pool->task_stats.count; i++) {
+        ty_pool_task_stats *stats = &pool->task_stats.values[i];
+        const char *name = stats->name;
+
+        memset(stats, 0, sizeof(*stats));
+        stats->name = name;
+    }
+
+    ty_mutex_unlock(&pool->mutex);
+}
+
+uint64_t ty_pool_latency_percentile(const ty_pool_latency *latency, unsigned int percent)
+{
+    assert(latency);
+    assert(percent <= 100);
+
+    uint64_t threshold, seen;
+
+    if (!latency->count)
+        return 0;
+
+    // Round up, the 100th percentile is the last value
+    threshold = (latency->count * percent + 99) / 100;
+    if (!threshold)
+        threshold = 1;
+
+    seen = 0;
+    for (unsigned int i = 0; i < TY_POOL_LATENCY_BUCKETS - 1; i++) {
+        seen += latency->buckets[i];
+        if (seen >= threshold) {
+            uint64_t limit = ((uint64_t)1 << i) * 1000;
+            return TY_MIN(limit, latency->max);
+        }
+    }
+
+    return latency->max;
+}
+
 int ty_task_new(const char *name, int (*run)(ty_task *task), ty_task **rtask)
 {
     assert(name);
@@ -258,41 +449,308 @@ static void change_task_status(ty_task *task, ty_task_status status)
     ty_message(&msg);
 }
 
-static void run_task(ty_task *task)
+static void add_latency(ty_pool_latency *latency, uint64_t value)
 {
-    assert(task->status <= TY_TASK_STATUS_PENDING);
+    unsigned int bucket = 0;
+
+    latency->count++;
+    latency->total += value;
+    if (value > latency->max)
+        latency->max = value;
+
+    for (uint64_t ms = value / 1000; ms && bucket < TY_POOL_LATENCY_BUCKETS - 1; ms >>= 1)
+        bucket++;
+    latency->buckets[bucket]++;
+}
+
+// Call with pool->mutex locked, returns NULL if we run out of memory
+static ty_pool_task_stats *find_task_stats(ty_pool *pool, const char *task_name)
+{
+    size_t len = strcspn(task_name, "@");
+    ty_pool_task_stats *stats;
+    char *name;
+
+    for (size_t i = 0; i < pool->task_stats.count; i++) {
+        stats = &pool->task_stats.values[i];
+        if (strlen(stats->name) == len && !strncmp(stats->name, task_name, len))
+            return stats;
+    }
+
+    if (_hs_array_grow(&pool->task_stats, 1) < 0)
+        return NULL;
+    name = malloc(len + 1);
+    if (!name)
+        return NULL;
+    memcpy(name, task_name, len);
+    name[len] = 0;
+
+    stats = &pool->task_stats.values[pool->task_stats.count++];
+    memset(stats, 0, sizeof(*stats));
+    stats->name = name;
+
+    return stats;
+}
+
+static void update_task_stats(ty_task *task, bool finished)
+{
+    ty_pool *pool = task->pool;
+    uint64_t now = ty_micros();
+    ty_pool_task_stats *stats[2];
+
+    if (!pool)
+        return;
+
+    ty_mutex_lock(&pool->mutex);
+    stats[0] = &pool->total_stats;
+    stats[1] = find_task_stats(pool, task->name);
+    for (unsigned int i = 0; i < TY_COUNTOF(stats) && stats[i]; i++) {
+        if (finished) {
+            stats[i]->finished++;
+            if (task->ret < 0)
+                stats[i]->failed++;
+            add_latency(&stats[i]->run, now - task->running_since);
+        } else {
+            stats[i]->started++;
+            // Tasks executed right away by ty_task_wait() have not been queued
+            if (task->pending_since)
+                add_latency(&stats[i]->queue, now - task->pending_since);
+        }
+    }
+    ty_mutex_unlock(&pool->mutex);
+}
+
+// Returns false if the task called _ty_task_suspend() and needs to run again later
+static bool run_task(ty_task *task)
+{
+    assert(task->status <= TY_TASK_STATUS_RUNNING);
 
     ty_task *previous_task;
 
     previous_task = current_task;
     current_task = task;
 
-    change_task_status(task, TY_TASK_STATUS_RUNNING);
-    task->ret = (*task->task_run)(task);
+    // Resumed tasks are already running
+    if (task->status != TY_TASK_STATUS_RUNNING) {
+        task->running_since = ty_micros();
+        update_task_stats(task, false);
+        change_task_status(task, TY_TASK_STATUS_RUNNING);
+    }
+    task->suspended = false;
+    // Canceled and expired tasks finish without running (again)
+    task->ret = _ty_task_check(task);
+    if (!task->ret)
+        task->ret = (*task->task_run)(task);
+    if (task->suspended) {
+        current_task = previous_task;
+        return false;
+    }
     if (task->task_finalize) {
         (*task->task_finalize)(task);
         task->task_finalize = NULL;
     }
+    update_task_stats(task, true);
     change_task_status(task, TY_TASK_STATUS_FINISHED);
 
     current_task = previous_task;
+    return true;
+}
+
+static void set_parked_task(ty_pool *pool, size_t idx, ty_task *task)
+{
+    pool->parked_tasks.values[idx] = task;
+    task->parked_index = idx;
+}
+
+static void sift_parked_task_up(ty_pool *pool, size_t idx)
+{
+    ty_task *task = pool->parked_tasks.values[idx];
+
+    while (idx) {
+        size_t parent = (idx - 1) / 2;
+        ty_task *parent_task = pool->parked_tasks.values[parent];
+
+        if (parent_task->resume_deadline <= task->resume_deadline)
+            break;
+
+        set_parked_task(pool, idx, parent_task);
+        idx = parent;
+    }
+    set_parked_task(pool, idx, task);
+}
+
+static void sift_parked_task_down(ty_pool *pool, size_t idx)
+{
+    ty_task *task = pool->parked_tasks.values[idx];
+
+    while (true) {
+        size_t child = idx * 2 + 1;
+        ty_task *child_task;
+
+        if (child >= pool->parked_tasks.count)
+            break;
+        if (child + 1 < pool->parked_tasks.count &&
+                pool->parked_tasks.values[child + 1]->resume_deadline <
+                pool->parked_tasks.values[child]->resume_deadline)
+            child++;
+        child_task = pool->parked_tasks.values[child];
+
+        if (task->resume_deadline <= child_task->resume_deadline)
+            break;
+
+        set_parked_task(pool, idx, child_task);
+        idx = child;
+    }
+    set_parked_task(pool, idx, task);
+}
+
+// Call with pool->mutex locked, returns the task if it must run again right away
+static ty_task *park_task(ty_pool *pool, ty_task *task)
+{
+    if (task->resume) {
+        task->resume = false;
+        return task;
+    }
+
+    // Better to run the task again than to lose it
+    if (_hs_array_push(&pool->parked_tasks, task) < 0)
+        return task;
+    task->parked = true;
+    sift_parked_task_up(pool, pool->parked_tasks.count - 1);
+
+    // An idle worker needs to take the new deadline into account if it comes first
+    if (!task->parked_index)
+        ty_cond_signal(&pool->pending_cond);
+
+    return NULL;
+}
+
+// Call with pool->mutex locked, *rtimeout is set to the delay until the next deadline
+static ty_task *take_parked_task(ty_pool *pool, int *rtimeout)
+{
+    ty_task *task;
+    uint64_t now;
+
+    *rtimeout = -1;
+
+    if (!pool->parked_tasks.count)
+        return NULL;
+    task = pool->parked_tasks.values[0];
+
+    now = ty_millis();
+    if (task->resume_deadline > now) {
+        if (task->resume_deadline != UINT64_MAX) {
+            uint64_t delay = task->resume_deadline - now;
+            *rtimeout = delay > INT_MAX ? INT_MAX : (int)delay;
+        }
+        return NULL;
+    }
+
+    {
+        ty_task *last = pool->parked_tasks.values[pool->parked_tasks.count - 1];
+
+        _hs_array_pop(&pool->parked_tasks, 1);
+        if (pool->parked_tasks.count) {
+            set_parked_task(pool, 0, last);
+            sift_parked_task_down(pool, 0);
+        }
+    }
+    task->parked = false;
+    task->resume = false;
+
+    return task;
+}
+
+static struct serial_queue *find_serial_queue(ty_pool *pool, const void *key)
+{
+    _hs_htable_foreach_hash(cur, &pool->serial_queues, _hs_htable_hash_ptr(key)) {
+        struct serial_queue *queue = cur;
+
+        if (queue->key == key)
+            return queue;
+    }
+
+    return NULL;
+}
+
+// Call with pool->mutex locked, the task becomes the head of the new queue
+static int create_serial_queue(ty_pool *pool, ty_task *task, struct serial_queue **rqueue)
+{
+    struct serial_queue *queue;
+    int r;
+
+    queue = calloc(1, sizeof(*queue));
+    if (!queue)
+        return ty_error(TY_ERROR_MEMORY, NULL);
+    queue->key = task->serial_key;
+
+    r = _hs_array_push(&queue->tasks, task);
+    if (r < 0)
+        goto error;
+    r = _hs_htable_add(&pool->serial_queues, _hs_htable_hash_ptr(queue->key), queue);
+    if (r < 0)
+        goto error;
+
+    *rqueue = queue;
+    return 0;
+
+error:
+    _hs_array_release(&queue->tasks);
+    free(queue);
+    return ty_libhs_translate_error(r);
+}
+
+// Call with pool->mutex locked
+static void free_serial_queue(ty_pool *pool, struct serial_queue *queue)
+{
+    _hs_htable_remove(&pool->serial_queues, _hs_htable_hash_ptr(queue->key), queue);
+    _hs_array_release(&queue->tasks);
+    free(queue);
+}
+
+/* Call with pool->mutex locked, after the head task of a serial queue has run. The
+   caller takes over the reference we got when the returned task was queued. */
+static ty_task *advance_serial_queue(ty_pool *pool, ty_task *task)
+{
+    struct serial_queue *queue;
+    ty_task *next;
+
+    if (!task->serial_key)
+        return NULL;
+
+    // The queue is gone if ty_pool_free() was called in the mean time
+    queue = find_serial_queue(pool, task->serial_key);
+    if (!queue)
+        return NULL;
+    assert(queue->tasks.values[0] == task);
+
+    if (queue->tasks.count == 1) {
+        free_serial_queue(pool, queue);
+        return NULL;
+    }
+
+    _hs_array_remove(&queue->tasks, 0, 1);
+    next = queue->tasks.values[0];
+
+    return next;
 }
 
 static int worker_thread_main(void *udata)
 {
     ty_pool *pool = udata;
 
+    current_worker_pool = pool;
+
     while (true) {
         uint64_t start;
-        bool run;
         ty_task *task;
 
         ty_mutex_lock(&pool->mutex);
         pool->busy_workers--;
 
-        run = true;
         start = ty_millis();
         while (true) {
+            int timeout;
+
             if (pool->worker_threads.count > pool->max_threads)
                 goto timeout;
             if (pool->pending_tasks.count) {
@@ -300,21 +758,53 @@ static int worker_thread_main(void *udata)
                 _hs_array_remove(&pool->pending_tasks, 0, 1);
                 break;
             }
-            if (!run)
-                goto timeout;
+            task = take_parked_task(pool, &timeout);
+            if (task)
+                break;
+
+            /* Keep min_threads workers warm, and one idle worker around while tasks are
+               parked to handle their deadlines. */
+            if (pool->worker_threads.count > pool->min_threads &&
+                    (!pool->parked_tasks.count ||
+                     pool->worker_threads.count - pool->busy_workers > 1)) {
+                int idle_timeout = ty_adjust_timeout(pool->unused_timeout, start);
+
+                if (!idle_timeout)
+                    goto timeout;
+                if (timeout < 0 || (idle_timeout >= 0 && idle_timeout < timeout))
+                    timeout = idle_timeout;
+            }
 
-            run = ty_cond_wait(&pool->pending_cond, &pool->mutex,
-                               ty_adjust_timeout(pool->unused_timeout, start));
+            ty_cond_wait(&pool->pending_cond, &pool->mutex, timeout);
         }
 
         pool->busy_workers++;
         ty_mutex_unlock(&pool->mutex);
 
-        run_task(task);
-        ty_task_unref(task);
+        // Drain the serial queue of this task, if any, other workers handle other keys
+        do {
+            ty_task *next;
+            bool finished;
+
+            finished = run_task(task);
+
+            ty_mutex_lock(&pool->mutex);
+            if (finished) {
+                next = advance_serial_queue(pool, task);
+            } else {
+                next = park_task(pool, task);
+            }
+            ty_mutex_unlock(&pool->mutex);
+
+            // Parked tasks keep their reference
+            if (finished)
+                ty_task_unref(task);
+            task = next;
+        } while (task);
     }
 
 timeout:
+    pool->workers_stopped++;
     if (pool->init) {
         for (size_t i = 0; i < pool->worker_threads.count; i++) {
             ty_thread *thread = &pool->worker_threads.values[i];
@@ -350,6 +840,7 @@ static int start_worker_thread(ty_pool *pool)
 
     pool->worker_threads.count++;
     pool->busy_workers++;
+    pool->workers_started++;
 
     return 0;
 }
@@ -359,7 +850,10 @@ int ty_task_start(ty_task *task)
     assert(task);
     assert(task->status == TY_TASK_STATUS_READY);
 
+    // Stamp it first, queue latency must include the worker threads we may have to start
+    uint64_t start = ty_micros();
     ty_pool *pool;
+    struct serial_queue *queue = NULL;
     int r;
 
     if (!task->pool) {
@@ -371,29 +865,127 @@ int ty_task_start(ty_task *task)
 
     ty_mutex_lock(&pool->mutex);
 
+    if (task->serial_key) {
+        queue = find_serial_queue(pool, task->serial_key);
+
+        if (queue) {
+            // Another task with this key is pending or running, the worker will get to it
+            r = _hs_array_push(&queue->tasks, task);
+            if (r < 0) {
+                r = ty_libhs_translate_error(r);
+                goto cleanup;
+            }
+            ty_task_ref(task);
+
+            task->pending_since = start;
+            change_task_status(task, TY_TASK_STATUS_PENDING);
+
+            r = 0;
+            goto cleanup;
+        }
+
+        r = create_serial_queue(pool, task, &queue);
+        if (r < 0)
+            goto cleanup;
+    }
+
     if (pool->busy_workers == pool->worker_threads.count &&
             pool->worker_threads.count < pool->max_threads) {
         r = start_worker_thread(pool);
         if (r < 0)
-            goto cleanup;
+            goto error;
     }
 
     r = _hs_array_push(&pool->pending_tasks, task);
     if (r < 0) {
         r = ty_libhs_translate_error(r);
-        goto cleanup;
+        goto error;
     }
     ty_task_ref(task);
     ty_cond_signal(&pool->pending_cond);
 
+    task->pending_since = start;
     change_task_status(task, TY_TASK_STATUS_PENDING);
 
     r = 0;
+    goto cleanup;
+
+error:
+    if (queue)
+        free_serial_queue(pool, queue);
 cleanup:
     ty_mutex_unlock(&pool->mutex);
     return r;
 }
 
+/* Run a task in ty_task_wait(). On a worker thread of its own pool, the task can suspend
+   itself: park it like the worker would, and return false to let the workers finish it. */
+static bool run_inline_task(ty_task *task)
+{
+    ty_pool *pool = task->pool;
+
+    while (!run_task(task)) {
+        bool parked;
+
+        ty_mutex_lock(&pool->mutex);
+        parked = !park_task(pool, task);
+        if (parked) {
+            // Parked tasks keep a reference, inline tasks don't have one yet
+            ty_task_ref(task);
+
+            // This thread is about to block, make sure a worker is around to resume it
+            if (pool->busy_workers == pool->worker_threads.count &&
+                    pool->worker_threads.count < pool->max_threads)
+                start_worker_thread(pool);
+        }
+        ty_mutex_unlock(&pool->mutex);
+
+        if (parked)
+            return false;
+    }
+
+    return true;
+}
+
+// Hand the next task of the serial queue to the workers after running a task inline
+static void finish_inline_task(ty_pool *pool, ty_task *task)
+{
+    ty_task *next;
+
+    ty_mutex_lock(&pool->mutex);
+    next = advance_serial_queue(pool, task);
+    if (next) {
+        if (pool->busy_workers == pool->worker_threads.count &&
+                pool->worker_threads.count < pool->max_threads)
+            start_worker_thread(pool);
+        if (pool->worker_threads.count && _hs_array_push(&pool->pending_tasks, next) >= 0) {
+            ty_cond_signal(&pool->pending_cond);
+            next = NULL;
+        }
+    }
+    ty_mutex_unlock(&pool->mutex);
+
+    // We could not hand it over, run the rest of the queue here instead
+    while (next) {
+        ty_task *task2 = next;
+        bool finished;
+
+        finished = run_task(task2);
+
+        ty_mutex_lock(&pool->mutex);
+        if (finished) {
+            next = advance_serial_queue(pool, task2);
+        } else {
+            next = park_task(pool, task2);
+        }
+        ty_mutex_unlock(&pool->mutex);
+
+        // Parked tasks keep their reference, the workers will advance the queue
+        if (finished)
+            ty_task_unref(task2);
+    }
+}
+
 int ty_task_wait(ty_task *task, ty_task_status status, int timeout)
 {
     assert(task);
@@ -403,31 +995,65 @@ int ty_task_wait(ty_task *task, ty_task_status status, int timeout)
     int r;
 
     /* If the caller wants to wait until the task has finished without timing out, try
-       to execute the task in this thread if it's not running already. */
+       to execute the task in this thread if it's not running already. Tasks with a
+       serial key can only do that when no other task with the same key comes first. */
     if (status == TY_TASK_STATUS_FINISHED && timeout < 0) {
+        bool steal = false;
+
         if (task->status == TY_TASK_STATUS_PENDING) {
             ty_pool *pool = task->pool;
 
             ty_mutex_lock(&pool->mutex);
-            if (task->status == TY_TASK_STATUS_PENDING) {
-                for (size_t i = 0; i < pool->pending_tasks.count; i++) {
-                    if (pool->pending_tasks.values[i] == task) {
-                        _hs_array_remove(&pool->pending_tasks, i, 1);
-                        break;
-                    }
-                }
-                ty_task_unref(task);
+            for (size_t i = 0; i < pool->pending_tasks.count; i++) {
+                if (pool->pending_tasks.values[i] == task) {
+                    _hs_array_remove(&pool->pending_tasks, i, 1);
+                    ty_task_unref(task);
 
-                task->status = TY_TASK_STATUS_READY;
+                    task->status = TY_TASK_STATUS_READY;
+                    steal = true;
+                    break;
+                }
             }
             ty_mutex_unlock(&pool->mutex);
+        } else if (task->status == TY_TASK_STATUS_READY) {
+            // Even inline tasks count in the pool statistics
+            if (!task->pool) {
+                r = ty_pool_get_default(&task->pool);
+                if (r < 0)
+                    return r;
+            }
+
+            if (task->serial_key) {
+                struct serial_queue *queue;
+
+                ty_mutex_lock(&task->pool->mutex);
+                if (!find_serial_queue(task->pool, task->serial_key)) {
+                    r = create_serial_queue(task->pool, task, &queue);
+                    if (r < 0) {
+                        ty_mutex_unlock(&task->pool->mutex);
+                        return r;
+                    }
+                    steal = true;
+                }
+                ty_mutex_unlock(&task->pool->mutex);
+            } else {
+                steal = true;
+            }
         }
 
-        if (task->status == TY_TASK_STATUS_READY) {
-            run_task(task);
-            return 1;
+        if (steal) {
+            if (run_inline_task(task)) {
+                if (task->serial_key)
+                    finish_inline_task(task->pool, task);
+
+                return 1;
+            }
+
+            // The task has suspended itself, wait for the workers to finish it
         }
-    } else if (task->status == TY_TASK_STATUS_READY) {
+    }
+
+    if (task->status == TY_TASK_STATUS_READY) {
         r = ty_task_start(task);
         if (r < 0)
             return r;
@@ -456,6 +1082,141 @@ int ty_task_join(ty_task *task)
     return task->ret;
 }
 
+void ty_task_cancel(ty_task *task)
+{
+    assert(task);
+
+    ty_mutex_lock(&task->mutex);
+    task->canceled = true;
+    // Wake up the task if it is blocked somewhere, see _ty_task_set_wakeup()
+    if (task->wakeup_cond) {
+        ty_mutex_lock(task->wakeup_mutex);
+        ty_cond_broadcast(task->wakeup_cond);
+        ty_mutex_unlock(task->wakeup_mutex);
+    }
+    ty_mutex_unlock(&task->mutex);
+
+    // Suspended tasks need to run again to notice
+    _ty_task_resume(task);
+}
+
+void ty_task_set_deadline(ty_task *task, uint64_t deadline)
+{
+    assert(task);
+
+    ty_mutex_lock(&task->mutex);
+    task->deadline = deadline;
+    ty_mutex_unlock(&task->mutex);
+}
+
+bool _ty_task_suspend(ty_task *task, int timeout)
+{
+    assert(task);
+
+    ty_pool *pool = task->pool;
+
+    // Only pool workers can put a task aside, other threads have nothing else to do
+    if (task != current_task || !pool || pool != current_worker_pool)
+        return false;
+
+    ty_mutex_lock(&pool->mutex);
+    task->suspended = true;
+    task->resume_deadline = timeout >= 0 ? ty_millis() + (uint64_t)timeout : UINT64_MAX;
+    ty_mutex_unlock(&pool->mutex);
+
+    return true;
+}
+
+void _ty_task_resume(ty_task *task)
+{
+    assert(task);
+
+    ty_pool *pool = task->pool;
+
+    if (!pool)
+        return;
+
+    ty_mutex_lock(&pool->mutex);
+    /* Spurious resumes are harmless, so set the flag even if the task is not suspended
+       yet. This way we can't lose a resume that happens right before the suspension. */
+    task->resume = true;
+    if (task->parked && task->resume_deadline) {
+        // Due right away, a single worker is enough to pick it up
+        task->resume_deadline = 0;
+        sift_parked_task_up(pool, task->parked_index);
+
+        if (pool->busy_workers == pool->worker_threads.count &&
+                pool->worker_threads.count < pool->max_threads)
+            start_worker_thread(pool);
+        ty_cond_signal(&pool->pending_cond);
+    }
+    ty_mutex_unlock(&pool->mutex);
+}
+
+/* Returns TY_ERROR_CANCELED or TY_ERROR_TIMEOUT once the task has been canceled or has
+   passed its deadline. Long operations check this between steps, task can be NULL. */
+int _ty_task_check(ty_task *task)
+{
+    bool canceled;
+    uint64_t deadline;
+
+    if (!task)
+        return 0;
+
+    ty_mutex_lock(&task->mutex);
+    canceled = task->canceled;
+    deadline = task->deadline;
+    ty_mutex_unlock(&task->mutex);
+
+    if (canceled)
+        return ty_error(TY_ERROR_CANCELED, "Task '%s' was canceled", task->name);
+    if (deadline && ty_millis() >= deadline)
+        return ty_error(TY_ERROR_TIMEOUT, "Task '%s' has reached its deadline", task->name);
+
+    return 0;
+}
+
+// Shortens timeout (-1 for none) so that it does not go past the deadline of task
+int _ty_task_adjust_timeout(ty_task *task, int timeout)
+{
+    uint64_t deadline, now, delay;
+
+    if (!task)
+        return timeout;
+
+    ty_mutex_lock(&task->mutex);
+    deadline = task->deadline;
+    ty_mutex_unlock(&task->mutex);
+
+    if (!deadline)
+        return timeout;
+    now = ty_millis();
+    if (now >= deadline)
+        return 0;
+
+    delay = deadline - now;
+    if (delay > INT_MAX)
+        delay = INT_MAX;
+    if (timeout < 0 || (int)delay < timeout)
+        timeout = (int)delay;
+
+    return timeout;
+}
+
+/* Tell ty_task_cancel() how to wake the task while it waits on cond. The waiter must
+   check task->canceled with mutex locked before each wait. Call with mutex unlocked,
+   and again with NULL values once the wait is over. */
+void _ty_task_set_wakeup(ty_task *task, ty_mutex *mutex, ty_cond *cond)
+{
+    assert(task);
+    assert(!mutex == !cond);
+
+    ty_mutex_lock(&task->mutex);
+    task->wakeup_mutex = mutex;
+    task->wakeup_cond = cond;
+    ty_mutex_unlock(&task->mutex);
+}
+
 ty_task *ty_task_get_current(void)
 {
     return current_task;
@@ -18,15 +18,60 @@ TY_C_BEGIN
 
 struct ty_board;
 struct ty_firmware;
+struct _ty_upload_plan;
 
 typedef struct ty_pool ty_pool;
 
+#define TY_POOL_LATENCY_BUCKETS 16
+
+typedef struct ty_pool_latency {
+    uint64_t count;
+    // In microseconds
+    uint64_t total;
+    uint64_t max;
+
+    // Bucket i counts latencies under 2^i milliseconds, the last one gets the rest
+    uint64_t buckets[TY_POOL_LATENCY_BUCKETS];
+} ty_pool_latency;
+
+typedef struct ty_pool_task_stats {
+    // Task name up to the '@' (e.g. "upload" for "upload@1234-Teensy"), NULL for all tasks
+    const char *name;
+
+    uint64_t started;
+    uint64_t finished;
+    uint64_t failed;
+
+    // Time spent pending, and from the first run until the task finishes
+    ty_pool_latency queue;
+    ty_pool_latency run;
+} ty_pool_task_stats;
+
+typedef struct ty_pool_stats {
+    unsigned int min_threads;
+    unsigned int max_threads;
+    unsigned int workers;
+    unsigned int busy_workers;
+    uint64_t workers_started;
+    // Workers torn down after the idle timeout, or when max_threads goes down
+    uint64_t workers_stopped;
+
+    size_t pending_tasks;
+    size_t parked_tasks;
+
+    ty_pool_task_stats tasks;
+} ty_pool_stats;
+
+typedef int ty_pool_stats_func(const ty_pool_task_stats *stats, void *udata);
+
 typedef struct ty_task {
     unsigned int refcount;
 
     char *name;
     ty_task_status status;
     ty_pool *pool;
+    // Tasks with the same non-NULL key run in start order, one at a time
+    const void *serial_key;
 
     ty_message_func *user_callback;
     void *user_callback_udata;
@@ -43,12 +88,34 @@ typedef struct ty_task {
     ty_mutex mutex;
     ty_cond cond;
 
+    // Managed by the pool for tasks waiting in _ty_task_suspend()
+    bool suspended;
+    bool parked;
+    bool resume;
+    uint64_t resume_deadline;
+    size_t parked_index;
+
+    // For pool statistics, in microseconds
+    uint64_t pending_since;
+    uint64_t running_since;
+
+    // See ty_task_cancel() and ty_task_set_deadline(), protected by mutex
+    bool canceled;
+    uint64_t deadline;
+    ty_mutex *wakeup_mutex;
+    ty_cond *wakeup_cond;
+
     union {
         struct {
             struct ty_board *board;
             struct ty_firmware **fws;
             unsigned int fws_count;
             int flags;
+
+            int state;
+            uint64_t wait_start;
+            struct ty_firmware *fw;
+            struct _ty_upload_plan *plan;
         } upload;
 
         struct {
@@ -66,11 +133,23 @@ typedef struct ty_task {
 
         struct {
             struct ty_board *board;
+
+            int state;
+            uint64_t wait_start;
         } reset;
 
         struct {
             struct ty_board *board;
+
+            int state;
+            uint64_t wait_start;
         } reboot;
+
+        struct {
+            char *filename;
+            FILE *fp;
+            char *format_name;
+        } load_firmware;
     } u;
 } ty_task;
 
@@ -79,11 +158,19 @@ void ty_pool_free(ty_pool *pool);
 
 int ty_pool_set_max_threads(ty_pool *pool, unsigned int max);
 unsigned int ty_pool_get_max_threads(ty_pool *pool);
+int ty_pool_set_min_threads(ty_pool *pool, unsigned int min);
+unsigned int ty_pool_get_min_threads(ty_pool *pool);
 void ty_pool_set_idle_timeout(ty_pool *pool, int timeout);
 int ty_pool_get_idle_timeout(ty_pool *pool);
 
 int ty_pool_get_default(ty_pool **rpool);
 
+void ty_pool_get_stats(ty_pool *pool, ty_pool_stats *rstats);
+int ty_pool_list_task_stats(ty_pool *pool, ty_pool_stats_func *f, void *udata);
+void ty_pool_reset_stats(ty_pool *pool);
+
+uint64_t ty_pool_latency_percentile(const ty_pool_latency *latency, unsigned int percent);
+
 int ty_task_new(const char *name, int (*run)(ty_task *task), ty_task **rtask);
 
 ty_task *ty_task_ref(ty_task *task);
@@ -93,8 +180,18 @@ int ty_task_start(ty_task *task);
 int ty_task_wait(ty_task *task, ty_task_status status, int timeout);
 int ty_task_join(ty_task *task);
 
+void ty_task_cancel(ty_task *task);
+void ty_task_set_deadline(ty_task *task, uint64_t deadline);
+
 ty_task *ty_task_get_current(void);
 
+bool _ty_task_suspend(ty_task *task, int timeout);
+void _ty_task_resume(ty_task *task);
+
+int _ty_task_check(ty_task *task);
+int _ty_task_adjust_timeout(ty_task *task, int timeout);
+void _ty_task_set_wakeup(ty_task *task, ty_mutex *mutex, ty_cond *cond);
+
 TY_C_END
 
 #endif
@@ -178,11 +178,16 @@ bool ty_cond_wait(ty_cond *cond, ty_mutex *mutex, int timeout)
         r = pthread_cond_timedwait_relative_np(&cond->cond, &mutex->mutex, &ts);
 #else
         struct timespec ts;
-        uint64_t end;
 
-        end = ty_millis() + (uint64_t)timeout;
-        ts.tv_sec = (time_t)(end / 1000);
-        ts.tv_nsec = (long)(end % 1000 * 1000000);
+        /* Use the clock given to pthread_condattr_setclock(), ty_millis() may rely on
+           CLOCK_MONOTONIC_RAW which can drift apart from it. */
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        ts.tv_sec += (time_t)(timeout / 1000);
+        ts.tv_nsec += (long)(timeout % 1000 * 1000000);
+        if (ts.tv_nsec >= 1000000000) {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000;
+        }
 
         r = pthread_cond_timedwait(&cond->cond, &mutex->mutex, &ts);
 #endif
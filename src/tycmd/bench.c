@@ -0,0 +1,488 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://koromix.dev/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#include "../libty/firmware.h"
+#include "../libty/system.h"
+#include "../libty/task.h"
+#include "main.h"
+
+enum bench_metric_id {
+    BENCH_REBOOT,
+    BENCH_UPLOAD,
+    BENCH_RESET,
+    BENCH_ECHO,
+    BENCH_SERIAL,
+
+    BENCH_METRICS_COUNT
+};
+
+struct bench_metric {
+    const char *key;
+    const char *name;
+    const char *unit;
+
+    unsigned int count;
+    double total;
+    double min;
+    double max;
+};
+
+#define BENCH_SERIAL_TIMEOUT 5000
+#define BENCH_ECHO_TIMEOUT 1000
+
+static struct bench_metric bench_metrics[BENCH_METRICS_COUNT] = {
+    {"reboot_latency",    "Reboot to bootloader",    "ms"},
+    {"upload_throughput", "Upload throughput",       "KiB/s"},
+    {"reset_latency",     "Reset to serial ready",   "ms"},
+    {"echo_latency",      "Serial echo round-trip",  "ms"},
+    {"serial_throughput", "Serial throughput",       "KiB/s"}
+};
+
+static unsigned int bench_count = 3;
+static bool bench_json = false;
+static unsigned int bench_echo_count = 0;
+static unsigned int bench_duration = 2000;
+static const char *bench_firmware_format = NULL;
+
+static void print_bench_usage(FILE *f)
+{
+    fprintf(f, "usage: %s bench [options] [firmware]\n\n", tycmd_executable_name);
+
+    print_common_options(f);
+    fprintf(f, "\n");
+
+    fprintf(f, "Bench options:\n"
+               "   -n, --count <count>      Number of reboot/upload/reset cycles, default is 3\n"
+               "   -O, --output <format>    Output format, must be plain (default) or json\n"
+               "   -f, --format <format>    Firmware file format (autodetected by default)\n\n"
+               "       --echo <count>       Measure round-trip latency with <count> pings, the\n"
+               "                            firmware must echo serial input back\n"
+               "       --duration <ms>      Measure serial throughput for <ms> milliseconds,\n"
+               "                            default is 2000, use 0 to skip\n\n"
+               "Upload throughput is only measured when a firmware is given, it is uploaded\n"
+               "once per cycle. Serial throughput counts everything the board sends.\n");
+}
+
+static void add_sample(enum bench_metric_id id, double value)
+{
+    struct bench_metric *metric = &bench_metrics[id];
+
+    if (!metric->count || value < metric->min)
+        metric->min = value;
+    if (!metric->count || value > metric->max)
+        metric->max = value;
+    metric->total += value;
+    metric->count++;
+}
+
+static inline double elapsed_ms(uint64_t start)
+{
+    return (double)(ty_micros() - start) / 1000.0;
+}
+
+static int join_task(int r, ty_task *task)
+{
+    if (r < 0)
+        return r;
+
+    r = ty_task_join(task);
+    ty_task_unref(task);
+
+    return r;
+}
+
+static int bench_reboot(ty_board *board)
+{
+    ty_task *task = NULL;
+    uint64_t start;
+    int r;
+
+    if (ty_board_has_capability(board, TY_BOARD_CAPABILITY_UPLOAD))
+        return 0;
+    if (!ty_board_has_capability(board, TY_BOARD_CAPABILITY_REBOOT))
+        return ty_error(TY_ERROR_MODE, "Board '%s' cannot be rebooted to bootloader",
+                        ty_board_get_tag(board));
+
+    start = ty_micros();
+    r = join_task(ty_reboot(board, &task), task);
+    if (r < 0)
+        return r;
+    add_sample(BENCH_REBOOT, elapsed_ms(start));
+
+    return 0;
+}
+
+static int bench_upload(ty_board *board, ty_firmware *fw)
+{
+    ty_task *task = NULL;
+    uint64_t start;
+    double time;
+    int r;
+
+    // The board is already in bootloader mode, don't count the reboot twice
+    start = ty_micros();
+    r = join_task(ty_upload(board, &fw, 1, TY_UPLOAD_WAIT | TY_UPLOAD_NORESET, &task), task);
+    if (r < 0)
+        return r;
+    time = elapsed_ms(start);
+
+    add_sample(BENCH_UPLOAD, (double)fw->total_size / 1024.0 / (time / 1000.0));
+    return 0;
+}
+
+static int bench_reset(ty_board *board)
+{
+    ty_task *task = NULL;
+    uint64_t start;
+    int r;
+
+    start = ty_micros();
+    r = join_task(ty_reset(board, &task), task);
+    if (r < 0)
+        return r;
+    r = ty_board_wait_for(board, TY_BOARD_CAPABILITY_SERIAL, BENCH_SERIAL_TIMEOUT);
+    if (r < 0)
+        return r;
+    if (!r)
+        return ty_error(TY_ERROR_TIMEOUT, "Board '%s' does not provide serial after reset",
+                        ty_board_get_tag(board));
+    add_sample(BENCH_RESET, elapsed_ms(start));
+
+    return 0;
+}
+
+static int drain_serial(ty_board *board)
+{
+    char buf[1024];
+    ssize_t r;
+
+    do {
+        r = ty_board_serial_read(board, buf, sizeof(buf), 0);
+    } while (r > 0);
+
+    return (int)r;
+}
+
+static bool find_bytes(const char *buf, size_t len, const char *needle, size_t needle_len)
+{
+    for (size_t i = 0; i + needle_len <= len; i++) {
+        if (!memcmp(buf + i, needle, needle_len))
+            return true;
+    }
+
+    return false;
+}
+
+static int bench_echo_ping(ty_board *board, unsigned int i)
+{
+    char msg[32], buf[256];
+    size_t msg_len, buf_len = 0;
+    uint64_t start;
+    ssize_t r;
+
+    msg_len = (size_t)snprintf(msg, sizeof(msg), "tycmd-bench-%u\n", i);
+
+    start = ty_micros();
+    r = ty_board_serial_write(board, msg, msg_len);
+    if (r < 0)
+        return (int)r;
+
+    // Echo sketches may add noise around the payload, so look for it in the stream
+    while (!find_bytes(buf, buf_len, msg, msg_len)) {
+        int timeout = BENCH_ECHO_TIMEOUT - (int)((ty_micros() - start) / 1000);
+
+        if (timeout <= 0)
+            return ty_error(TY_ERROR_TIMEOUT, "Board '%s' did not echo serial data back",
+                            ty_board_get_tag(board));
+
+        if (buf_len > sizeof(buf) - 64) {
+            memmove(buf, buf + buf_len - msg_len, msg_len);
+            buf_len = msg_len;
+        }
+        r = ty_board_serial_read(board, buf + buf_len, sizeof(buf) - buf_len, timeout);
+        if (r < 0)
+            return (int)r;
+        buf_len += (size_t)r;
+    }
+    add_sample(BENCH_ECHO, elapsed_ms(start));
+
+    return 0;
+}
+
+static int bench_serial_throughput(ty_board *board)
+{
+    char buf[16384];
+    uint64_t start, total = 0;
+    double time;
+
+    start = ty_micros();
+    while ((time = elapsed_ms(start)) < (double)bench_duration) {
+        ssize_t r = ty_board_serial_read(board, buf, sizeof(buf),
+                                         (int)((double)bench_duration - time) + 1);
+        if (r < 0)
+            return (int)r;
+        total += (uint64_t)r;
+    }
+    if (!total)
+        ty_log(TY_LOG_WARNING, "Board '%s' did not send anything", ty_board_get_tag(board));
+
+    add_sample(BENCH_SERIAL, (double)total / 1024.0 / (time / 1000.0));
+    return 0;
+}
+
+static int bench_serial(ty_board *board)
+{
+    ty_board_interface *iface = NULL;
+    int r;
+
+    if (!ty_board_has_capability(board, TY_BOARD_CAPABILITY_SERIAL)) {
+        ty_log(TY_LOG_WARNING, "Board '%s' is not available for serial I/O, skipping serial tests",
+               ty_board_get_tag(board));
+        return 0;
+    }
+
+    // Keep the interface open, ty_board_serial_read/write would reopen it each time
+    r = ty_board_open_interface(board, TY_BOARD_CAPABILITY_SERIAL, &iface);
+    if (r < 0)
+        return r;
+    if (!r)
+        return ty_error(TY_ERROR_MODE, "Board '%s' is not available for serial I/O",
+                        ty_board_get_tag(board));
+
+    if (bench_echo_count) {
+        ty_log(TY_LOG_INFO, "Measuring serial echo latency (%u pings)", bench_echo_count);
+
+        r = drain_serial(board);
+        if (r < 0)
+            goto cleanup;
+        for (unsigned int i = 0; i < bench_echo_count; i++) {
+            r = bench_echo_ping(board, i);
+            if (r < 0)
+                goto cleanup;
+        }
+    }
+    if (bench_duration) {
+        ty_log(TY_LOG_INFO, "Measuring serial throughput for %u ms", bench_duration);
+
+        r = bench_serial_throughput(board);
+        if (r < 0)
+            goto cleanup;
+    }
+
+    r = 0;
+cleanup:
+    ty_board_interface_close(iface);
+    return r;
+}
+
+static void print_results_plain(ty_board *board)
+{
+    printf("Board '%s' (%s)\n", ty_board_get_tag(board),
+           ty_models[ty_board_get_model(board)].name);
+
+    for (unsigned int i = 0; i < BENCH_METRICS_COUNT; i++) {
+        const struct bench_metric *metric = &bench_metrics[i];
+
+        if (!metric->count)
+            continue;
+
+        printf("  %-24s %10.2f %-6s (min %.2f, max %.2f, %u samples)\n",
+               metric->name, metric->total / metric->count, metric->unit,
+               metric->min, metric->max, metric->count);
+    }
+}
+
+static void print_bench_json_string(const char *value)
+{
+    putchar('"');
+    for (size_t i = 0; value[i]; i++) {
+        const char *escape = get_json_escape(value[i]);
+
+        if (escape) {
+            fputs(escape, stdout);
+        } else {
+            putchar(value[i]);
+        }
+    }
+    putchar('"');
+}
+
+static void print_results_json(ty_board *board)
+{
+    bool comma = false;
+
+    printf("{\"board\": ");
+    print_bench_json_string(ty_board_get_tag(board));
+    printf(", \"model\": ");
+    print_bench_json_string(ty_models[ty_board_get_model(board)].name);
+    printf(", \"cycles\": %u, \"results\": {", bench_count);
+    for (unsigned int i = 0; i < BENCH_METRICS_COUNT; i++) {
+        const struct bench_metric *metric = &bench_metrics[i];
+
+        if (!metric->count)
+            continue;
+
+        printf("%s\"%s\": {\"unit\": \"%s\", \"count\": %u, \"avg\": %.3f, \"min\": %.3f, \"max\": %.3f}",
+               comma ? ", " : "", metric->key, metric->unit, metric->count,
+               metric->total / metric->count, metric->min, metric->max);
+        comma = true;
+    }
+    printf("}}\n");
+    fflush(stdout);
+}
+
+static bool parse_bench_uint(ty_optline_context *optl, const char *name, unsigned int *rvalue)
+{
+    const char *value = ty_optline_get_value(optl);
+    char *end;
+    unsigned long n;
+
+    if (!value) {
+        ty_log(TY_LOG_ERROR, "Option '%s' takes an argument", name);
+        return false;
+    }
+
+    errno = 0;
+    n = strtoul(value, &end, 10);
+    if (errno || end == value || *end || n > UINT_MAX) {
+        ty_log(TY_LOG_ERROR, "Option '%s' expects a positive integer", name);
+        return false;
+    }
+
+    *rvalue = (unsigned int)n;
+    return true;
+}
+
+int bench(int argc, char *argv[])
+{
+    ty_optline_context optl;
+    char *opt;
+    const char *firmware_filename = NULL;
+    ty_firmware *fw = NULL;
+    ty_board *board = NULL;
+    int r;
+
+    for (unsigned int i = 0; i < BENCH_METRICS_COUNT; i++) {
+        bench_metrics[i].count = 0;
+        bench_metrics[i].total = 0.0;
+    }
+    bench_count = 3;
+    bench_json = false;
+    bench_echo_count = 0;
+    bench_duration = 2000;
+    bench_firmware_format = NULL;
+
+    ty_optline_init_argv(&optl, argc, argv);
+    while ((opt = ty_optline_next_option(&optl))) {
+        if (strcmp(opt, "--help") == 0) {
+            print_bench_usage(stdout);
+            return EXIT_SUCCESS;
+        } else if (strcmp(opt, "--count") == 0 || strcmp(opt, "-n") == 0) {
+            if (!parse_bench_uint(&optl, "--count", &bench_count) || !bench_count) {
+                print_bench_usage(stderr);
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(opt, "--output") == 0 || strcmp(opt, "-O") == 0) {
+            char *value = ty_optline_get_value(&optl);
+            if (!value) {
+                ty_log(TY_LOG_ERROR, "Option '--output' takes an argument");
+                print_bench_usage(stderr);
+                return EXIT_FAILURE;
+            }
+
+            if (strcmp(value, "plain") == 0) {
+                bench_json = false;
+            } else if (strcmp(value, "json") == 0) {
+                bench_json = true;
+            } else {
+                ty_log(TY_LOG_ERROR, "--output must be one of plain or json");
+                print_bench_usage(stderr);
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(opt, "--format") == 0 || strcmp(opt, "-f") == 0) {
+            bench_firmware_format = ty_optline_get_value(&optl);
+            if (!bench_firmware_format) {
+                ty_log(TY_LOG_ERROR, "Option '--format' takes an argument");
+                print_bench_usage(stderr);
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(opt, "--echo") == 0) {
+            if (!parse_bench_uint(&optl, "--echo", &bench_echo_count)) {
+                print_bench_usage(stderr);
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(opt, "--duration") == 0) {
+            if (!parse_bench_uint(&optl, "--duration", &bench_duration)) {
+                print_bench_usage(stderr);
+                return EXIT_FAILURE;
+            }
+        } else if (!parse_common_option(&optl, opt)) {
+            print_bench_usage(stderr);
+            return EXIT_FAILURE;
+        }
+    }
+    firmware_filename = ty_optline_consume_non_option(&optl);
+    if (ty_optline_consume_non_option(&optl)) {
+        ty_log(TY_LOG_ERROR, "Too many positional arguments");
+        print_bench_usage(stderr);
+        return EXIT_FAILURE;
+    }
+
+    // Keep stdout clean for the JSON document
+    if (bench_json && ty_config_verbosity > TY_LOG_WARNING)
+        ty_config_verbosity = TY_LOG_WARNING;
+
+    if (firmware_filename) {
+        r = ty_firmware_load_file(firmware_filename, NULL, bench_firmware_format, &fw);
+        if (r < 0)
+            goto cleanup;
+    }
+
+    r = get_board(&board);
+    if (r < 0)
+        goto cleanup;
+
+    if (ty_board_has_capability(board, TY_BOARD_CAPABILITY_REBOOT) ||
+            ty_board_has_capability(board, TY_BOARD_CAPABILITY_UPLOAD)) {
+        for (unsigned int i = 0; i < bench_count; i++) {
+            ty_log(TY_LOG_INFO, "Running cycle %u of %u", i + 1, bench_count);
+
+            r = bench_reboot(board);
+            if (r < 0)
+                goto cleanup;
+            if (fw) {
+                r = bench_upload(board, fw);
+                if (r < 0)
+                    goto cleanup;
+            }
+            r = bench_reset(board);
+            if (r < 0)
+                goto cleanup;
+        }
+    } else {
+        ty_log(TY_LOG_WARNING, "Board '%s' cannot reboot, skipping reboot and upload tests",
+               ty_board_get_tag(board));
+    }
+
+    r = bench_serial(board);
+
+cleanup:
+    // Partial results are still useful to find out which step regressed
+    if (board) {
+        if (bench_json) {
+            print_results_json(board);
+        } else {
+            print_results_plain(board);
+        }
+    }
+    ty_board_unref(board);
+    ty_firmware_unref(fw);
+    return r < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
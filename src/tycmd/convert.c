@@ -0,0 +1,190 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://koromix.dev/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#include "../libty/firmware.h"
+#include "../libty/system.h"
+#include "main.h"
+
+static const char *convert_firmware_format = NULL;
+static const char *convert_model_name = NULL;
+static const char *convert_output = NULL;
+
+static void print_convert_usage(FILE *f)
+{
+    fprintf(f, "usage: %s convert [options] <firmware>\n\n", tycmd_executable_name);
+
+    print_common_options(f);
+    fprintf(f, "\n");
+
+    fprintf(f, "Convert options:\n"
+               "   -f, --format <format>    Firmware file format (autodetected by default)\n"
+               "   -m, --model <model>      Prepare image for <model> (first compatible by default)\n"
+               "   -o, --output <file>      Write image to <file> (firmware name with .tyi\n"
+               "                            extension by default)\n\n"
+               "Flash images (.tyi) contain firmwares already split in bootloader blocks, and can\n"
+               "be uploaded without any parsing.\n");
+}
+
+static int write_image(const char *filename, const uint8_t *image, size_t size)
+{
+    FILE *fp;
+
+#ifdef _WIN32
+    fp = fopen(filename, "wb");
+#else
+    fp = fopen(filename, "wbe");
+#endif
+    if (!fp) {
+        switch (errno) {
+            case EACCES: {
+                return ty_error(TY_ERROR_ACCESS, "Permission denied for '%s'", filename);
+            } break;
+            case ENOENT:
+            case ENOTDIR: {
+                return ty_error(TY_ERROR_NOT_FOUND, "Cannot create '%s'", filename);
+            } break;
+
+            default: {
+                return ty_error(TY_ERROR_SYSTEM, "fopen('%s') failed: %s", filename,
+                                strerror(errno));
+            } break;
+        }
+    }
+
+    if (fwrite(image, 1, size, fp) != size || fflush(fp)) {
+        int r = ty_error(TY_ERROR_IO, "Failed to write to '%s': %s", filename, strerror(errno));
+        fclose(fp);
+        return r;
+    }
+    fclose(fp);
+
+    return 0;
+}
+
+int convert(int argc, char *argv[])
+{
+    ty_optline_context optl;
+    char *opt;
+    const char *filename;
+    ty_firmware *fw = NULL;
+    ty_model model;
+    char *output = NULL;
+    uint8_t *image = NULL;
+    size_t image_size;
+    int r;
+
+    convert_firmware_format = NULL;
+    convert_model_name = NULL;
+    convert_output = NULL;
+
+    ty_optline_init_argv(&optl, argc, argv);
+    while ((opt = ty_optline_next_option(&optl))) {
+        if (strcmp(opt, "--help") == 0) {
+            print_convert_usage(stdout);
+            return EXIT_SUCCESS;
+        } else if (strcmp(opt, "--format") == 0 || strcmp(opt, "-f") == 0) {
+            convert_firmware_format = ty_optline_get_value(&optl);
+            if (!convert_firmware_format) {
+                ty_log(TY_LOG_ERROR, "Option '--format' takes an argument");
+                print_convert_usage(stderr);
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(opt, "--model") == 0 || strcmp(opt, "-m") == 0) {
+            convert_model_name = ty_optline_get_value(&optl);
+            if (!convert_model_name) {
+                ty_log(TY_LOG_ERROR, "Option '--model' takes an argument");
+                print_convert_usage(stderr);
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(opt, "--output") == 0 || strcmp(opt, "-o") == 0) {
+            convert_output = ty_optline_get_value(&optl);
+            if (!convert_output) {
+                ty_log(TY_LOG_ERROR, "Option '--output' takes an argument");
+                print_convert_usage(stderr);
+                return EXIT_FAILURE;
+            }
+        } else if (!parse_common_option(&optl, opt)) {
+            print_convert_usage(stderr);
+            return EXIT_FAILURE;
+        }
+    }
+
+    filename = ty_optline_consume_non_option(&optl);
+    if (!filename) {
+        ty_log(TY_LOG_ERROR, "Missing firmware filename");
+        print_convert_usage(stderr);
+        return EXIT_FAILURE;
+    }
+    if (ty_optline_consume_non_option(&optl)) {
+        ty_log(TY_LOG_ERROR, "Only one firmware can be converted at a time");
+        print_convert_usage(stderr);
+        return EXIT_FAILURE;
+    }
+    if (!strcmp(filename, "-") && !convert_output) {
+        ty_log(TY_LOG_ERROR, "Option '--output' is required when reading from stdin");
+        print_convert_usage(stderr);
+        return EXIT_FAILURE;
+    }
+
+    r = ty_firmware_load_file(filename, !strcmp(filename, "-") ? stdin : NULL,
+                              convert_firmware_format, &fw);
+    if (r < 0)
+        goto cleanup;
+
+    if (convert_model_name) {
+        model = ty_models_find(convert_model_name);
+        if (!model) {
+            r = ty_error(TY_ERROR_PARAM, "Unknown model '%s'", convert_model_name);
+            goto cleanup;
+        }
+    } else {
+        if (!ty_firmware_identify(fw, &model, 1)) {
+            r = ty_error(TY_ERROR_UNSUPPORTED,
+                         "Cannot identify model for '%s', use --model <model>", filename);
+            goto cleanup;
+        }
+    }
+
+    r = ty_firmware_build_image(fw, model, &image, &image_size);
+    if (r < 0)
+        goto cleanup;
+
+    if (!convert_output) {
+        const char *ext = strrchr(filename, '.');
+        size_t len = ext && !strpbrk(ext, TY_PATH_SEPARATORS) ? (size_t)(ext - filename)
+                                                             : strlen(filename);
+
+        output = malloc(len + 5);
+        if (!output) {
+            r = ty_error(TY_ERROR_MEMORY, NULL);
+            goto cleanup;
+        }
+        memcpy(output, filename, len);
+        strcpy(output + len, ".tyi");
+
+        if (!strcmp(output, filename)) {
+            r = ty_error(TY_ERROR_PARAM, "Refusing to overwrite '%s'", filename);
+            goto cleanup;
+        }
+    }
+
+    r = write_image(output ? output : convert_output, image, image_size);
+    if (r < 0)
+        goto cleanup;
+
+    ty_log(TY_LOG_INFO, "Wrote %s image '%s' (%zu bytes)", ty_models[model].name,
+           output ? output : convert_output, image_size);
+
+cleanup:
+    free(image);
+    free(output);
+    ty_firmware_unref(fw);
+    return r < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -32,6 +32,9 @@ int identify(int argc, char *argv[])
     ty_optline_context optl;
     char *opt;
 
+    // tycmd serve runs commands more than once
+    identify_output_json = false;
+
     ty_optline_init_argv(&optl, argc, argv);
     while ((opt = ty_optline_next_option(&optl))) {
         if (strcmp(opt, "--help") == 0) {
@@ -10,6 +10,7 @@
 
 #include <stdarg.h>
 #include "main.h"
+#include "../libty/system.h"
 
 enum output_format {
     OUTPUT_PLAIN,
@@ -23,6 +24,14 @@ static bool list_watch = false;
 
 static bool json_comma = false;
 
+/* JSON goes through this buffer, which is written out once per event. In stream mode
+   each event is a single line, tagged with a sequence number and the time (in
+   milliseconds, monotonic) since the command started. */
+static char json_buf[16384];
+static size_t json_len;
+static uint64_t json_seq;
+static uint64_t json_start;
+
 static void print_list_usage(FILE *f)
 {
     fprintf(f, "usage: %s list [options]\n\n", tycmd_executable_name);
@@ -31,7 +40,8 @@ static void print_list_usage(FILE *f)
     fprintf(f, "\n");
 
     fprintf(f, "List options:\n"
-               "   -O, --output <format>    Output format, must be plain (default) or json\n"
+               "   -O, --output <format>    Output format, must be plain (default), json\n"
+               "                            or ndjson (one event per line)\n"
                "   -v, --verbose            Print detailed information about devices\n\n"
                "   -w, --watch              Watch devices dynamically\n");
 }
@@ -88,45 +98,87 @@ static int print_event_plain(ty_board *board, ty_monitor_event event)
     return 0;
 }
 
-static void print_json_start(const char *key, char type, bool *comma)
+static int flush_json(void)
+{
+    size_t len = json_len;
+
+    json_len = 0;
+    if (fwrite(json_buf, 1, len, stdout) < len || fflush(stdout) == EOF)
+        return ty_error(TY_ERROR_IO, "Failed to write to standard output");
+
+    return 0;
+}
+
+static void write_json(const char *str, size_t len)
+{
+    if (len > sizeof(json_buf) - json_len) {
+        flush_json();
+        if (len > sizeof(json_buf)) {
+            fwrite(str, 1, len, stdout);
+            return;
+        }
+    }
+
+    memcpy(json_buf + json_len, str, len);
+    json_len += len;
+}
+
+static inline void write_json_str(const char *str)
+{
+    write_json(str, strlen(str));
+}
+
+static void write_json_key(const char *key, bool *comma)
 {
     if (*comma)
-        printf(", ");
-    if (key)
-        printf("\"%s\": ", key);
+        write_json(", ", 2);
+    if (key) {
+        write_json("\"", 1);
+        write_json_str(key);
+        write_json("\": ", 3);
+    }
+}
 
-    putc(type, stdout);
+static void print_json_start(const char *key, char type, bool *comma)
+{
+    write_json_key(key, comma);
+    write_json(&type, 1);
 
     *comma = false;
 }
 
 static void print_json_end(char type, bool *comma)
 {
-    putc(type, stdout);
+    write_json(&type, 1);
     *comma = true;
 }
 
 static void print_json_string(const char *key, const char *value, bool *comma)
 {
-    if (*comma)
-        printf(", ");
-    if (key)
-        printf("\"%s\": ", key);
+    write_json_key(key, comma);
 
-    putc('"', stdout);
+    write_json("\"", 1);
     for (size_t i = 0; value[i]; i++) {
-        switch (value[i]) {
-            case '\b': { printf("\\b"); } break;
-            case '\f': { printf("\\f"); } break;
-            case '\n': { printf("\\n"); } break;
-            case '\r': { printf("\\r"); } break;
-            case '\t': { printf("\\t"); } break;
-            case '"': { printf("\\\""); } break;
-            case '\\': { printf("\\\\"); } break;
-            default: { putc(value[i], stdout); } break;
+        const char *escape = get_json_escape(value[i]);
+
+        if (escape) {
+            write_json_str(escape);
+        } else {
+            write_json(&value[i], 1);
         }
     }
-    putc('"', stdout);
+    write_json("\"", 1);
+
+    *comma = true;
+}
+
+static void print_json_number(const char *key, uint64_t value, bool *comma)
+{
+    char buf[32];
+
+    write_json_key(key, comma);
+    snprintf(buf, sizeof(buf), "%"PRIu64, value);
+    write_json_str(buf);
 
     *comma = true;
 }
@@ -157,6 +209,10 @@ static int print_event_json(ty_board *board, ty_monitor_event event, bool *comma
 
     print_json_start(NULL, '{', comma);
 
+    if (list_output == OUTPUT_JSON_STREAM) {
+        print_json_number("seq", ++json_seq, comma);
+        print_json_number("time", ty_millis() - json_start, comma);
+    }
     print_json_string("action", action, comma);
     print_json_string("tag", ty_board_get_tag(board), comma);
     if (ty_board_get_serial_number(board))
@@ -183,10 +239,9 @@ static int print_event_json(ty_board *board, ty_monitor_event event, bool *comma
     }
 
     print_json_end('}', comma);
-    printf("\n");
+    write_json("\n", 1);
 
-    fflush(stdout);
-    return 0;
+    return flush_json();
 }
 
 static int list_callback(ty_board *board, ty_monitor_event event, void *udata)
@@ -196,7 +251,7 @@ static int list_callback(ty_board *board, ty_monitor_event event, void *udata)
     switch (list_output) {
         case OUTPUT_PLAIN: { return print_event_plain(board, event); } break;
         case OUTPUT_JSON: {
-            printf("  ");
+            write_json("  ", 2);
             return print_event_json(board, event, &json_comma);
         } break;
         case OUTPUT_JSON_STREAM: {
@@ -216,6 +271,15 @@ int list(int argc, char *argv[])
     ty_monitor *monitor;
     int r;
 
+    // tycmd serve runs commands more than once
+    list_output = OUTPUT_PLAIN;
+    list_verbose = false;
+    list_watch = false;
+    json_comma = false;
+    json_len = 0;
+    json_seq = 0;
+    json_start = ty_millis();
+
     ty_optline_init_argv(&optl, argc, argv);
     while ((opt = ty_optline_next_option(&optl))) {
         if (strcmp(opt, "--help") == 0) {
@@ -233,8 +297,10 @@ int list(int argc, char *argv[])
                 list_output = OUTPUT_PLAIN;
             } else if (strcmp(value, "json") == 0) {
                 list_output = OUTPUT_JSON;
+            } else if (strcmp(value, "ndjson") == 0) {
+                list_output = OUTPUT_JSON_STREAM;
             } else {
-                ty_log(TY_LOG_ERROR, "--output must be one of plain or json");
+                ty_log(TY_LOG_ERROR, "--output must be one of plain, json or ndjson");
                 print_list_usage(stderr);
                 return EXIT_FAILURE;
             }
@@ -253,6 +319,10 @@ int list(int argc, char *argv[])
         return EXIT_FAILURE;
     }
 
+    if (list_watch && tycmd_serving) {
+        ty_log(TY_LOG_ERROR, "Option '--watch' is not available through the server");
+        return EXIT_FAILURE;
+    }
     if (list_watch && list_output == OUTPUT_JSON)
         list_output = OUTPUT_JSON_STREAM;
 
@@ -261,9 +331,11 @@ int list(int argc, char *argv[])
         return EXIT_FAILURE;
 
     if (list_output == OUTPUT_JSON) {
-        printf("[\n");
+        write_json("[\n", 2);
         r = ty_monitor_list(monitor, list_callback, NULL);
-        printf("]\n");
+        write_json("]\n", 2);
+        if (flush_json() < 0)
+            r = -1;
     } else {
         r = ty_monitor_list(monitor, list_callback, NULL);
     }
@@ -14,6 +14,7 @@
 #endif
 #include "../libhs/common.h"
 #include "../libty/system.h"
+#include "../libty/task.h"
 #include "main.h"
 
 struct command {
@@ -22,17 +23,14 @@ struct command {
     const char *description;
 };
 
-int identify(int argc, char *argv[]);
-int list(int argc, char *argv[]);
-int monitor(int argc, char *argv[]);
-int reset(int argc, char *argv[]);
-int upload(int argc, char *argv[]);
-
 static const struct command commands[] = {
+    {"bench",    bench,    "Measure reboot, upload and serial performance"},
+    {"convert",  convert,  "Convert firmware to a precompiled flash image"},
     {"identify", identify, "Identify models compatible with firmware"},
     {"list",     list,     "List available boards"},
     {"monitor",  monitor,  "Open serial (or emulated) connection with board"},
     {"reset",    reset,    "Reset board"},
+    {"serve",    serve,    "Run commands from other tycmd instances with a warm monitor"},
     {"upload",   upload,   "Upload new firmware"},
     {0}
 };
@@ -40,9 +38,9 @@ static const struct command commands[] = {
 const char *tycmd_executable_name;
 
 static const char *main_board_tag = NULL;
+static bool main_print_stats = false;
 
 static ty_monitor *main_board_monitor;
-static ty_board *main_board;
 
 static void print_version(FILE *f)
 {
@@ -74,7 +72,8 @@ void print_common_options(FILE *f)
                "       --help               Show help message\n"
                "       --version            Display version information\n\n"
                "   -B, --board <tag>        Work with board <tag> instead of first detected\n"
-               "   -q, --quiet              Disable output, use -qqq to silence errors\n");
+               "   -q, --quiet              Disable output, use -qqq to silence errors\n"
+               "       --stats              Print task statistics once the command is done\n");
 }
 
 static inline unsigned int get_board_priority(ty_board *board)
@@ -82,30 +81,16 @@ static inline unsigned int get_board_priority(ty_board *board)
     return ty_models[ty_board_get_model(board)].priority;
 }
 
-static int board_callback(ty_board *board, ty_monitor_event event, void *udata)
+// Select the board now, tycmd serve changes main_board_tag for each command
+static int select_board_callback(ty_board *board, ty_monitor_event event, void *udata)
 {
-    TY_UNUSED(udata);
-
-    switch (event) {
-        case TY_MONITOR_EVENT_ADDED: {
-            if ((!main_board || get_board_priority(board) > get_board_priority(main_board))
-                    && ty_board_matches_tag(board, main_board_tag)) {
-                ty_board_unref(main_board);
-                main_board = ty_board_ref(board);
-            }
-        } break;
+    TY_UNUSED(event);
 
-        case TY_MONITOR_EVENT_CHANGED:
-        case TY_MONITOR_EVENT_DISAPPEARED: {
-        } break;
+    ty_board **rboard = udata;
 
-        case TY_MONITOR_EVENT_DROPPED: {
-            if (main_board == board) {
-                ty_board_unref(main_board);
-                main_board = NULL;
-            }
-        } break;
-    }
+    if ((!*rboard || get_board_priority(board) > get_board_priority(*rboard))
+            && ty_board_matches_tag(board, main_board_tag))
+        *rboard = board;
 
     return 0;
 }
@@ -122,10 +107,6 @@ static int init_monitor()
     if (r < 0)
         goto error;
 
-    r = ty_monitor_register_callback(monitor, board_callback, NULL);
-    if (r < 0)
-        goto error;
-
     r = ty_monitor_start(monitor);
     if (r < 0)
         goto error;
@@ -150,11 +131,14 @@ int get_monitor(ty_monitor **rmonitor)
 
 int get_board(ty_board **rboard)
 {
+    ty_board *board = NULL;
+
     int r = init_monitor();
     if (r < 0)
         return r;
 
-    if (!main_board) {
+    ty_monitor_list(main_board_monitor, select_board_callback, &board);
+    if (!board) {
         if (main_board_tag) {
             return ty_error(TY_ERROR_NOT_FOUND, "Board '%s' not found", main_board_tag);
         } else {
@@ -162,7 +146,7 @@ int get_board(ty_board **rboard)
         }
     }
 
-    *rboard = ty_board_ref(main_board);
+    *rboard = ty_board_ref(board);
     return 0;
 }
 
@@ -178,12 +162,84 @@ bool parse_common_option(ty_optline_context *optl, char *arg)
     } else if (strcmp(arg, "--quiet") == 0 || strcmp(arg, "-q") == 0) {
         ty_config_verbosity--;
         return true;
+    } else if (strcmp(arg, "--stats") == 0) {
+        main_print_stats = true;
+        return true;
     } else {
         ty_log(TY_LOG_ERROR, "Unknown option '%s'", arg);
         return false;
     }
 }
 
+void reset_common_options(void)
+{
+    main_board_tag = NULL;
+    main_print_stats = false;
+}
+
+const char *get_json_escape(char c)
+{
+    switch (c) {
+        case '\b': return "\\b";
+        case '\f': return "\\f";
+        case '\n': return "\\n";
+        case '\r': return "\\r";
+        case '\t': return "\\t";
+        case '"': return "\\\"";
+        case '\\': return "\\\\";
+    }
+
+    return NULL;
+}
+
+static void print_latency(FILE *f, const ty_pool_latency *latency)
+{
+    if (latency->count) {
+        fprintf(f, " %8.1f %8.1f %8.1f",
+                (double)latency->total / (double)latency->count / 1000.0,
+                (double)ty_pool_latency_percentile(latency, 95) / 1000.0,
+                (double)latency->max / 1000.0);
+    } else {
+        fprintf(f, " %8s %8s %8s", "-", "-", "-");
+    }
+}
+
+static void print_task_stats(FILE *f, const ty_pool_task_stats *stats)
+{
+    fprintf(f, "   %-12s %7"PRIu64" %7"PRIu64, stats->name ? stats->name : "(all)",
+            stats->finished, stats->failed);
+    print_latency(f, &stats->queue);
+    print_latency(f, &stats->run);
+    fputc('\n', f);
+}
+
+static int print_task_stats_callback(const ty_pool_task_stats *stats, void *udata)
+{
+    print_task_stats(udata, stats);
+    return 0;
+}
+
+void print_requested_stats(FILE *f)
+{
+    ty_pool *pool;
+    ty_pool_stats stats;
+
+    if (!main_print_stats)
+        return;
+    if (ty_pool_get_default(&pool) < 0)
+        return;
+    ty_pool_get_stats(pool, &stats);
+
+    fprintf(f, "Task pool: %u/%u workers (%u busy), %"PRIu64" started, %"PRIu64" stopped\n",
+            stats.workers, stats.max_threads, stats.busy_workers, stats.workers_started,
+            stats.workers_stopped);
+    fprintf(f, "   %-12s %7s %7s %26s %26s\n", "", "", "", "Queue (ms)", "Run (ms)");
+    fprintf(f, "   %-12s %7s %7s %8s %8s %8s %8s %8s %8s\n", "Task", "Done", "Failed",
+            "avg", "p95", "max", "avg", "p95", "max");
+    ty_pool_list_task_stats(pool, print_task_stats_callback, f);
+    print_task_stats(f, &stats.tasks);
+}
+
 int main(int argc, char *argv[])
 {
     const struct command *cmd;
@@ -234,9 +290,22 @@ int main(int argc, char *argv[])
         return EXIT_FAILURE;
     }
 
+    // Let the server run the command if there is one and it supports it, or do it ourselves
+    if (can_forward_command(argc - 1, argv + 1)) {
+        const char *socket_path = getenv("TYCMD_SOCKET");
+
+        if (socket_path && *socket_path) {
+            ty_error_mask(TY_ERROR_NOT_FOUND);
+            r = forward_command(socket_path, argc - 1, argv + 1);
+            ty_error_unmask();
+            if (r != TY_ERROR_NOT_FOUND)
+                return r < 0 ? EXIT_FAILURE : r;
+        }
+    }
+
     r = (*cmd->f)(argc - 1, argv + 1);
+    print_requested_stats(stderr);
 
-    ty_board_unref(main_board);
     ty_monitor_free(main_board_monitor);
 
     return r;
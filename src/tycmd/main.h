@@ -20,9 +20,25 @@
 TY_C_BEGIN
 
 extern const char *tycmd_executable_name;
+extern bool tycmd_serving;
+
+int bench(int argc, char *argv[]);
+int convert(int argc, char *argv[]);
+int identify(int argc, char *argv[]);
+int list(int argc, char *argv[]);
+int monitor(int argc, char *argv[]);
+int reset(int argc, char *argv[]);
+int serve(int argc, char *argv[]);
+int upload(int argc, char *argv[]);
+
+bool can_forward_command(int argc, char *argv[]);
+int forward_command(const char *path, int argc, char *argv[]);
 
 void print_common_options(FILE *f);
 bool parse_common_option(ty_optline_context *optl, char *arg);
+void reset_common_options(void);
+void print_requested_stats(FILE *f);
+const char *get_json_escape(char c);
 
 int get_monitor(ty_monitor **rmonitor);
 int get_board(ty_board **rboard);
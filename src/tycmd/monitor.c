@@ -8,6 +8,7 @@
 
    See the LICENSE file for more details. */
 
+#include <signal.h>
 #include <unistd.h>
 #ifdef _WIN32
     #define WIN32_LEAN_AND_MEAN
@@ -16,6 +17,7 @@
 #include "../libhs/device.h"
 #include "../libhs/serial.h"
 #include "../libty/system.h"
+#include "../libty/thread.h"
 #include "main.h"
 
 enum {
@@ -26,6 +28,42 @@ enum {
 #define BUFFER_SIZE 8192
 #define ERROR_IO_TIMEOUT 5000
 
+#define CAPTURE_BLOCK_SIZE (64 * 1024)
+#define CAPTURE_BLOCKS 64
+// Publish partially filled blocks after this delay, so that slow streams still get written
+#define CAPTURE_FLUSH_DELAY 20
+// Reconnection waits are split in steps so that Ctrl+C is noticed
+#define CAPTURE_WAIT_STEP 200
+
+#define PROBE_PREFIX "#ty-probe "
+#define PROBE_TIMEOUT 1000
+#define PROBE_BUCKETS 24
+
+struct capture_block {
+    size_t len;
+    char data[CAPTURE_BLOCK_SIZE];
+};
+
+struct capture_context {
+    int outfd;
+
+    struct capture_block *blocks;
+    ty_mutex mutex;
+    ty_cond cond;
+    // Blocks [tail, head) are ready to be written, head - tail <= CAPTURE_BLOCKS
+    uint64_t head;
+    uint64_t tail;
+    bool done;
+    int write_error;
+
+    uint64_t received;
+    uint64_t written;
+    uint64_t dropped;
+    // Queued data thrown away after a write error, only touched by the writer thread
+    uint64_t discarded;
+    unsigned int max_queued;
+};
+
 static int monitor_term_flags = 0;
 static hs_serial_config monitor_serial_config = {
     .baudrate = 115200
@@ -33,6 +71,10 @@ static hs_serial_config monitor_serial_config = {
 static int monitor_directions = DIRECTION_INPUT | DIRECTION_OUTPUT;
 static bool monitor_reconnect = false;
 static int monitor_timeout_eof = 200;
+static bool monitor_capture = false;
+static unsigned int monitor_probe_count = 0;
+
+static volatile sig_atomic_t monitor_interrupted = 0;
 
 #ifdef _WIN32
 static bool monitor_fake_echo;
@@ -56,7 +98,11 @@ static void print_monitor_usage(FILE *f)
 
     fprintf(f, "Monitor options:\n"
                "   -r, --raw                Disable line-buffering and line-editing\n"
-               "   -s, --silent             Disable echoing of local input on terminal\n\n"
+               "   -s, --silent             Disable echoing of local input on terminal\n"
+               "   -c, --capture            Capture binary serial output at high throughput,\n"
+               "                            statistics are printed on exit (Ctrl+C)\n"
+               "       --probe <count>      Measure serial round-trip latency with <count>\n"
+               "                            probes, the board must echo them back\n\n"
                "   -R, --reconnect          Try to reconnect on I/O errors\n"
                "   -D, --direction <dir>    Open serial connection in given direction\n"
                "                            Supports input, output, both (default)\n"
@@ -73,7 +119,8 @@ static void print_monitor_usage(FILE *f)
                "   -f, --flow <control>     Define flow-control mode\n"
                "                            Must be one of: off, rtscts or xonxoff\n"
                "   -y, --parity <bits>      Change parity mode to use for the serial port\n"
-               "                            Must be one of: off, even, or odd\n\n"
+               "                            Must be one of: off, even, or odd\n"
+               "       --low-latency        Ask the driver to deliver data immediately\n\n"
                "These settings are mostly ignored by the USB serial emulation, but you can still\n"
                "access them in your embedded code (e.g. the Serial object API on Teensy).\n",
                monitor_serial_config.baudrate);
@@ -216,8 +263,6 @@ static int fill_descriptor_set(ty_descriptor_set *set, ty_board *board)
     ty_board_interface *iface = NULL;
     int r;
 
-    ty_descriptor_set_clear(set);
-
     // Board events / state changes
     ty_monitor_get_descriptors(ty_board_get_monitor(board), set, 1);
 
@@ -248,30 +293,41 @@ static int fill_descriptor_set(ty_descriptor_set *set, ty_board *board)
     return 0;
 }
 
-static int loop(ty_board *board, int outfd)
+static int loop(ty_poller *poller, ty_board *board, int outfd)
 {
-    ty_descriptor_set set = {0};
     int timeout;
     char buf[BUFFER_SIZE];
+    int ready_id;
     ssize_t r;
 
 restart:
-    r = fill_descriptor_set(&set, board);
-    if (r < 0)
-        return (int)r;
+    {
+        ty_descriptor_set set = {0};
+
+        r = fill_descriptor_set(&set, board);
+        if (r < 0)
+            return (int)r;
+
+        ty_poller_clear(poller);
+        r = ty_poller_add_set(poller, &set);
+        if (r < 0)
+            return (int)r;
+    }
     timeout = -1;
 
     ty_log(TY_LOG_INFO, "Monitoring '%s'", ty_board_get_tag(board));
 
     while (true) {
-        if (!set.count)
+        if (!ty_poller_get_count(poller))
             return 0;
 
-        r = ty_poll(&set, timeout);
+        r = ty_poller_wait(poller, &ready_id, 1, timeout);
         if (r < 0)
             return (int)r;
+        if (!r)
+            ready_id = 0;
 
-        switch (r) {
+        switch (ready_id) {
             case 0: {
                 return 0;
             } break;
@@ -299,8 +355,8 @@ restart:
                 if (r < 0) {
                     if (r == TY_ERROR_IO && monitor_reconnect) {
                         timeout = ERROR_IO_TIMEOUT;
-                        ty_descriptor_set_remove(&set, 2);
-                        ty_descriptor_set_remove(&set, 3);
+                        ty_poller_remove(poller, 2);
+                        ty_poller_remove(poller, 3);
                         break;
                     }
                     return (int)r;
@@ -347,8 +403,8 @@ restart:
                         /* EOF reached, don't listen to stdin anymore, and start timeout to give some
                            time for the device to send any data before closing down. */
                         timeout = monitor_timeout_eof;
-                        ty_descriptor_set_remove(&set, 1);
-                        ty_descriptor_set_remove(&set, 3);
+                        ty_poller_remove(poller, 1);
+                        ty_poller_remove(poller, 3);
                     }
                     break;
                 }
@@ -365,8 +421,8 @@ restart:
                 if (r < 0) {
                     if (r == TY_ERROR_IO && monitor_reconnect) {
                         timeout = ERROR_IO_TIMEOUT;
-                        ty_descriptor_set_remove(&set, 2);
-                        ty_descriptor_set_remove(&set, 3);
+                        ty_poller_remove(poller, 2);
+                        ty_poller_remove(poller, 3);
                         break;
                     }
                     return (int)r;
@@ -376,11 +432,379 @@ restart:
     }
 }
 
+static void handle_monitor_interrupt(int sig)
+{
+    TY_UNUSED(sig);
+    monitor_interrupted = 1;
+}
+
+static int capture_writer(void *udata)
+{
+    struct capture_context *ctx = udata;
+
+    ty_mutex_lock(&ctx->mutex);
+    while (true) {
+        struct capture_block *block;
+        size_t offset;
+
+        while (ctx->tail == ctx->head && !ctx->done)
+            ty_cond_wait(&ctx->cond, &ctx->mutex, -1);
+        if (ctx->tail == ctx->head)
+            break;
+        block = &ctx->blocks[ctx->tail % CAPTURE_BLOCKS];
+        ty_mutex_unlock(&ctx->mutex);
+
+        offset = 0;
+        while (offset < block->len) {
+#ifdef _WIN32
+            ssize_t r = write(ctx->outfd, block->data + offset, (unsigned int)(block->len - offset));
+#else
+            ssize_t r = write(ctx->outfd, block->data + offset, block->len - offset);
+#endif
+            if (r < 0) {
+                if (errno == EINTR)
+                    continue;
+
+                ty_mutex_lock(&ctx->mutex);
+                ctx->write_error = ty_error(TY_ERROR_IO, "Failed to write to standard output: %s",
+                                            strerror(errno));
+                ctx->done = true;
+                ctx->discarded += block->len - offset;
+                for (uint64_t i = ctx->tail + 1; i < ctx->head; i++)
+                    ctx->discarded += ctx->blocks[i % CAPTURE_BLOCKS].len;
+                ctx->tail = ctx->head;
+                goto exit;
+            }
+            offset += (size_t)r;
+        }
+
+        ty_mutex_lock(&ctx->mutex);
+        ctx->written += block->len;
+        ctx->tail++;
+    }
+
+exit:
+    ty_mutex_unlock(&ctx->mutex);
+    return 0;
+}
+
+static void print_capture_stats(const struct capture_context *ctx, uint64_t duration)
+{
+    double seconds = (double)TY_MAX(duration, 1) / 1000.0;
+
+    ty_log(TY_LOG_INFO, "Captured %"PRIu64" bytes in %.1f seconds (%.2f MiB/s)",
+           ctx->received, seconds, (double)ctx->received / 1048576.0 / seconds);
+    ty_log(TY_LOG_INFO, "Written %"PRIu64" bytes, dropped %"PRIu64" bytes, queue peak %u/%u blocks",
+           ctx->written, ctx->dropped + ctx->discarded, ctx->max_queued, CAPTURE_BLOCKS);
+}
+
+/* The serial device is read on this thread straight into large blocks, which a writer thread
+   pushes to the output. When the output cannot keep up and all blocks are queued, we keep
+   reading the device (so that it does not stall) but drop the data and count it. */
+static int capture(ty_board *board, int outfd)
+{
+    struct capture_context ctx = {0};
+    ty_board_interface *iface = NULL;
+    ty_thread writer;
+    bool writer_started = false;
+    char *scratch = NULL;
+    uint64_t start;
+    int r;
+
+    ctx.outfd = outfd;
+    ctx.blocks = malloc(CAPTURE_BLOCKS * sizeof(*ctx.blocks));
+    scratch = malloc(CAPTURE_BLOCK_SIZE);
+    if (!ctx.blocks || !scratch) {
+        r = ty_error(TY_ERROR_MEMORY, NULL);
+        goto cleanup;
+    }
+    r = ty_mutex_init(&ctx.mutex);
+    if (r < 0)
+        goto cleanup;
+    r = ty_cond_init(&ctx.cond);
+    if (r < 0) {
+        ty_mutex_release(&ctx.mutex);
+        goto cleanup;
+    }
+
+    r = ty_thread_create(&writer, capture_writer, &ctx);
+    if (r < 0) {
+        ty_cond_release(&ctx.cond);
+        ty_mutex_release(&ctx.mutex);
+        goto cleanup;
+    }
+    writer_started = true;
+
+    monitor_interrupted = 0;
+    signal(SIGINT, handle_monitor_interrupt);
+
+    start = ty_millis();
+restart:
+    r = open_serial_interface(board, &iface);
+    if (r < 0)
+        goto cleanup;
+    ty_log(TY_LOG_INFO, "Capturing '%s'", ty_board_get_tag(board));
+
+    while (!monitor_interrupted) {
+        struct capture_block *block;
+        uint64_t block_start;
+        bool full;
+
+        ty_mutex_lock(&ctx.mutex);
+        if (ctx.done) {
+            ty_mutex_unlock(&ctx.mutex);
+            break;
+        }
+        full = ctx.head - ctx.tail == CAPTURE_BLOCKS;
+        ty_mutex_unlock(&ctx.mutex);
+
+        if (full) {
+            ssize_t len = ty_board_serial_read(board, scratch, CAPTURE_BLOCK_SIZE,
+                                               CAPTURE_FLUSH_DELAY);
+            if (len < 0) {
+                r = (int)len;
+                goto disconnected;
+            }
+            ctx.received += (uint64_t)len;
+            ctx.dropped += (uint64_t)len;
+            continue;
+        }
+
+        // Only this thread touches the head block until it is published
+        block = &ctx.blocks[ctx.head % CAPTURE_BLOCKS];
+        block->len = 0;
+        block_start = ty_millis();
+        while (CAPTURE_BLOCK_SIZE - block->len >= BUFFER_SIZE) {
+            int timeout = CAPTURE_FLUSH_DELAY - (int)(ty_millis() - block_start);
+            ssize_t len;
+
+            if (timeout <= 0 || monitor_interrupted)
+                break;
+
+            len = ty_board_serial_read(board, block->data + block->len,
+                                       CAPTURE_BLOCK_SIZE - block->len, timeout);
+            if (len < 0) {
+                r = (int)len;
+                break;
+            }
+            if (!len && block->len)
+                break;
+            block->len += (size_t)len;
+        }
+        ctx.received += block->len;
+
+        if (block->len) {
+            ty_mutex_lock(&ctx.mutex);
+            ctx.head++;
+            if (ctx.head - ctx.tail > ctx.max_queued)
+                ctx.max_queued = (unsigned int)(ctx.head - ctx.tail);
+            ty_cond_signal(&ctx.cond);
+            ty_mutex_unlock(&ctx.mutex);
+        }
+        if (r < 0)
+            goto disconnected;
+    }
+    r = 0;
+    goto cleanup;
+
+disconnected:
+    ty_board_interface_close(iface);
+    iface = NULL;
+    if (r == TY_ERROR_IO && monitor_reconnect && !monitor_interrupted) {
+        ty_log(TY_LOG_INFO, "Waiting for '%s'...", ty_board_get_tag(board));
+        do {
+            r = ty_board_wait_for(board, TY_BOARD_CAPABILITY_SERIAL, CAPTURE_WAIT_STEP);
+        } while (!r && !monitor_interrupted);
+        if (r <= 0)
+            goto cleanup;
+
+        goto restart;
+    }
+
+cleanup:
+    if (writer_started) {
+        signal(SIGINT, SIG_DFL);
+
+        ty_mutex_lock(&ctx.mutex);
+        ctx.done = true;
+        ty_cond_signal(&ctx.cond);
+        ty_mutex_unlock(&ctx.mutex);
+        ty_thread_join(&writer);
+
+        if (!r)
+            r = ctx.write_error;
+        print_capture_stats(&ctx, ty_millis() - start);
+
+        ty_cond_release(&ctx.cond);
+        ty_mutex_release(&ctx.mutex);
+    }
+    if (iface)
+        ty_board_interface_close(iface);
+    free(scratch);
+    free(ctx.blocks);
+    return r;
+}
+
+static int compare_probe_samples(const void *a, const void *b)
+{
+    uint64_t sample1 = *(const uint64_t *)a;
+    uint64_t sample2 = *(const uint64_t *)b;
+
+    return (sample1 > sample2) - (sample1 < sample2);
+}
+
+static void print_probe_stats(uint64_t *samples, unsigned int count, unsigned int lost)
+{
+    unsigned int buckets[PROBE_BUCKETS] = {0};
+    unsigned int first_bucket = PROBE_BUCKETS, last_bucket = 0, max_bucket = 0;
+    uint64_t total = 0;
+
+    printf("%u probes, %u echoed, %u lost\n", count + lost, count, lost);
+    if (!count)
+        return;
+
+    qsort(samples, count, sizeof(*samples), compare_probe_samples);
+    for (unsigned int i = 0; i < count; i++) {
+        unsigned int bucket = 0;
+
+        while (bucket < PROBE_BUCKETS - 1 && samples[i] >= (uint64_t)2 << bucket)
+            bucket++;
+        buckets[bucket]++;
+        total += samples[i];
+
+        first_bucket = TY_MIN(first_bucket, bucket);
+        last_bucket = TY_MAX(last_bucket, bucket);
+        max_bucket = TY_MAX(max_bucket, buckets[bucket]);
+    }
+
+    printf("Latency (us): min %"PRIu64", avg %"PRIu64", p50 %"PRIu64", p90 %"PRIu64
+           ", p99 %"PRIu64", max %"PRIu64"\n",
+           samples[0], total / count, samples[count / 2], samples[count * 9 / 10],
+           samples[count * 99 / 100], samples[count - 1]);
+
+    for (unsigned int i = first_bucket; i <= last_bucket; i++) {
+        unsigned int width = (unsigned int)((uint64_t)buckets[i] * 40 / max_bucket);
+
+        printf("  %8"PRIu64" - %8"PRIu64" us  %6u  ", i ? (uint64_t)1 << i : 0,
+               ((uint64_t)2 << i) - 1, buckets[i]);
+        for (unsigned int j = 0; j < width; j++)
+            putchar('#');
+        putchar('\n');
+    }
+}
+
+// Look for the echo of probe seq in complete lines, and keep the rest of the last line
+static bool match_probe_echo(char *buf, size_t *rlen, unsigned int seq, uint64_t now,
+                             uint64_t *rlatency)
+{
+    size_t len = *rlen, start = 0;
+    bool found = false;
+
+    for (size_t i = 0; i < len; i++) {
+        unsigned int echo_seq;
+        uint64_t echo_time;
+
+        if (buf[i] != '\n')
+            continue;
+
+        buf[i] = 0;
+        if (!found && sscanf(buf + start, PROBE_PREFIX "%u %"SCNu64, &echo_seq, &echo_time) == 2 &&
+                echo_seq == seq) {
+            *rlatency = now - echo_time;
+            found = true;
+        }
+        start = i + 1;
+    }
+
+    if (start < len && len - start < BUFFER_SIZE / 2) {
+        memmove(buf, buf + start, len - start);
+        *rlen = len - start;
+    } else {
+        *rlen = 0;
+    }
+
+    return found;
+}
+
+/* Each probe is a text line carrying its sequence number and the time it was sent, and we
+   wait for the echo (or PROBE_TIMEOUT) before sending the next one. */
+static int probe(ty_board *board)
+{
+    ty_board_interface *iface = NULL;
+    uint64_t *samples = NULL;
+    unsigned int count = 0, lost = 0;
+    char buf[BUFFER_SIZE];
+    size_t buf_len = 0;
+    ssize_t r;
+
+    samples = malloc(monitor_probe_count * sizeof(*samples));
+    if (!samples)
+        return ty_error(TY_ERROR_MEMORY, NULL);
+
+    r = open_serial_interface(board, &iface);
+    if (r < 0)
+        goto cleanup;
+
+    ty_log(TY_LOG_INFO, "Sending %u probes to '%s'", monitor_probe_count, ty_board_get_tag(board));
+
+    // Forget whatever the board sent before
+    do {
+        r = ty_board_serial_read(board, buf, sizeof(buf), 0);
+        if (r < 0)
+            goto cleanup;
+    } while (r);
+
+    for (unsigned int seq = 0; seq < monitor_probe_count && !monitor_interrupted; seq++) {
+        char msg[64];
+        size_t msg_len;
+        uint64_t start;
+        bool matched = false;
+
+        start = ty_micros();
+        msg_len = (size_t)snprintf(msg, sizeof(msg), PROBE_PREFIX "%u %"PRIu64"\n", seq, start);
+        r = ty_board_serial_write(board, msg, msg_len);
+        if (r < 0)
+            goto cleanup;
+
+        while (!matched) {
+            int timeout = PROBE_TIMEOUT - (int)((ty_micros() - start) / 1000);
+            uint64_t now, latency = 0;
+
+            if (timeout <= 0)
+                break;
+
+            r = ty_board_serial_read(board, buf + buf_len, sizeof(buf) - buf_len - 1, timeout);
+            now = ty_micros();
+            if (r < 0)
+                goto cleanup;
+            buf_len += (size_t)r;
+
+            if (match_probe_echo(buf, &buf_len, seq, now, &latency)) {
+                samples[count++] = latency;
+                matched = true;
+            }
+        }
+        if (!matched)
+            lost++;
+    }
+
+    print_probe_stats(samples, count, lost);
+    r = count ? 0 : ty_error(TY_ERROR_TIMEOUT, "Board '%s' did not echo any probe",
+                             ty_board_get_tag(board));
+
+cleanup:
+    if (iface)
+        ty_board_interface_close(iface);
+    free(samples);
+    return (int)r;
+}
+
 int monitor(int argc, char *argv[])
 {
     ty_optline_context optl;
     char *opt;
     ty_board *board = NULL;
+    ty_poller *poller = NULL;
     int outfd = -1;
     int r;
 
@@ -498,6 +922,25 @@ int monitor(int argc, char *argv[])
             }
         } else if (strcmp(opt, "--raw") == 0 || strcmp(opt, "-r") == 0) {
             monitor_term_flags |= TY_TERMINAL_RAW;
+        } else if (strcmp(opt, "--capture") == 0 || strcmp(opt, "-c") == 0) {
+            monitor_capture = true;
+        } else if (strcmp(opt, "--probe") == 0) {
+            char *value = ty_optline_get_value(&optl);
+            if (!value) {
+                ty_log(TY_LOG_ERROR, "Option '--probe' takes an argument");
+                print_monitor_usage(stderr);
+                return EXIT_FAILURE;
+            }
+
+            errno = 0;
+            monitor_probe_count = (unsigned int)strtoul(value, NULL, 10);
+            if (errno || !monitor_probe_count) {
+                ty_log(TY_LOG_ERROR, "--probe requires a positive number");
+                print_monitor_usage(stderr);
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(opt, "--low-latency") == 0) {
+            monitor_serial_config.latency = HS_SERIAL_CONFIG_LATENCY_LOW;
         } else if (strcmp(opt, "--reconnect") == 0 || strcmp(opt, "-R") == 0) {
             monitor_reconnect = true;
         } else if (strcmp(opt, "--silent") == 0 || strcmp(opt, "-s") == 0) {
@@ -530,6 +973,42 @@ int monitor(int argc, char *argv[])
         return EXIT_FAILURE;
     }
 
+    if (monitor_probe_count) {
+        if (monitor_capture || monitor_directions != (DIRECTION_INPUT | DIRECTION_OUTPUT)) {
+            ty_log(TY_LOG_ERROR, "Option '--probe' cannot be used with '--capture' or '--direction'");
+            return EXIT_FAILURE;
+        }
+
+        r = get_board(&board);
+        if (r < 0)
+            goto cleanup;
+
+        monitor_interrupted = 0;
+        signal(SIGINT, handle_monitor_interrupt);
+        r = probe(board);
+        signal(SIGINT, SIG_DFL);
+        goto cleanup;
+    }
+    if (monitor_capture) {
+        if (!(monitor_directions & DIRECTION_INPUT)) {
+            ty_log(TY_LOG_ERROR, "Option '--capture' cannot be used with '--direction output'");
+            return EXIT_FAILURE;
+        }
+        if (ty_standard_get_modes(TY_STREAM_OUTPUT) & TY_DESCRIPTOR_MODE_TERMINAL)
+            ty_log(TY_LOG_WARNING, "Capturing binary data to the terminal, redirect it instead");
+
+        r = redirect_stdout(&outfd);
+        if (r < 0)
+            return EXIT_FAILURE;
+
+        r = get_board(&board);
+        if (r < 0)
+            goto cleanup;
+
+        r = capture(board, outfd);
+        goto cleanup;
+    }
+
     if (ty_standard_get_modes(TY_STREAM_INPUT) & TY_DESCRIPTOR_MODE_TERMINAL) {
 #ifdef _WIN32
         if (monitor_term_flags & TY_TERMINAL_RAW && !(monitor_term_flags & TY_TERMINAL_SILENT)) {
@@ -569,12 +1048,17 @@ int monitor(int argc, char *argv[])
     if (r < 0)
         goto cleanup;
 
-    r = loop(board, outfd);
+    r = ty_poller_new(&poller);
+    if (r < 0)
+        goto cleanup;
+
+    r = loop(poller, board, outfd);
 
 cleanup:
 #ifdef _WIN32
     stop_stdin_thread();
 #endif
+    ty_poller_free(poller);
     ty_board_unref(board);
     return r < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
 }
@@ -0,0 +1,638 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://koromix.dev/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#ifndef _WIN32
+    #include <errno.h>
+    #include <signal.h>
+    #include <sys/socket.h>
+    #include <sys/stat.h>
+    #include <sys/time.h>
+    #include <sys/un.h>
+    #include <unistd.h>
+#endif
+#include "../libty/system.h"
+#include "main.h"
+
+/* The client sends a request made of a header and the NUL-terminated working directory
+   and arguments, along with its standard descriptors (SCM_RIGHTS). The server runs the
+   command with these descriptors in place of its own, so output goes straight to the
+   client terminal, and answers with the exit code. Requests are handled one at a time. */
+
+#define SERVE_MAGIC 0x31444D43 // "CMD1"
+#define SERVE_MAX_REQUEST 65536
+#define SERVE_MAX_ARGS 256
+// Requests are handled one at a time, don't let a stalled client block the server
+#define SERVE_CLIENT_TIMEOUT 5
+
+struct serve_header {
+    uint32_t magic;
+    uint32_t size;
+};
+
+struct serve_command {
+    const char *name;
+    int (*f)(int argc, char *argv[]);
+};
+
+static const struct serve_command serve_commands[] = {
+    {"identify", identify},
+    {"list",     list},
+    {"reset",    reset},
+    {"upload",   upload},
+    {0}
+};
+
+bool tycmd_serving = false;
+
+static const char *serve_socket_path = NULL;
+
+static void print_serve_usage(FILE *f)
+{
+    fprintf(f, "usage: %s serve [options]\n\n", tycmd_executable_name);
+
+    print_common_options(f);
+    fprintf(f, "\n");
+
+    fprintf(f, "Serve options:\n"
+               "   -s, --socket <path>      Listen on <path> instead of the default socket\n\n"
+               "Keep the board monitor running and execute commands sent by other tycmd\n"
+               "instances, which skips device enumeration. Clients use the server when the\n"
+               "TYCMD_SOCKET environment variable is set to the socket path.\n\n");
+
+    fprintf(f, "Supported commands: ");
+    for (const struct serve_command *c = serve_commands; c->name; c++)
+        fprintf(f, "%s%s", c != serve_commands ? ", " : "", c->name);
+    fprintf(f, ".\n");
+}
+
+#ifndef _WIN32
+
+static const struct serve_command *find_serve_command(const char *name)
+{
+    for (const struct serve_command *cmd = serve_commands; cmd->name; cmd++) {
+        if (strcmp(cmd->name, name) == 0)
+            return cmd;
+    }
+
+    return NULL;
+}
+
+bool can_forward_command(int argc, char *argv[])
+{
+    if (!argc || !find_serve_command(argv[0]))
+        return false;
+
+    /* The server refuses list --watch. We cannot run the option parser here (it reorders
+       arguments), so look for -w in every group of short options. A false positive only
+       means the command runs locally. */
+    if (strcmp(argv[0], "list") == 0) {
+        for (int i = 1; i < argc; i++) {
+            if (strcmp(argv[i], "--") == 0)
+                break;
+            if (strcmp(argv[i], "--watch") == 0 ||
+                    (argv[i][0] == '-' && argv[i][1] != '-' && strchr(argv[i], 'w')))
+                return false;
+        }
+    }
+
+    return true;
+}
+
+static int get_default_socket_path(char *buf, size_t size)
+{
+    const char *runtime_dir = getenv("XDG_RUNTIME_DIR");
+    int r;
+
+    if (runtime_dir && *runtime_dir) {
+        r = snprintf(buf, size, "%s/%s.sock", runtime_dir, TY_CONFIG_TYCMD_EXECUTABLE);
+    } else {
+        r = snprintf(buf, size, "/tmp/%s-%u.sock", TY_CONFIG_TYCMD_EXECUTABLE,
+                     (unsigned int)getuid());
+    }
+    if (r < 0 || (size_t)r >= size)
+        return ty_error(TY_ERROR_RANGE, "Socket path is too long");
+
+    return 0;
+}
+
+// Only hand our descriptors over to a server run by the same user
+static int check_server_owner(int fd, const char *path)
+{
+    uid_t uid;
+
+#ifdef __linux__
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
+
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) < 0)
+        return ty_error(TY_ERROR_SYSTEM, "getsockopt(SO_PEERCRED) failed: %s", strerror(errno));
+    uid = cred.uid;
+#else
+    gid_t gid;
+
+    if (getpeereid(fd, &uid, &gid) < 0)
+        return ty_error(TY_ERROR_SYSTEM, "getpeereid() failed: %s", strerror(errno));
+#endif
+
+    if (uid != getuid())
+        return ty_error(TY_ERROR_ACCESS, "Server at '%s' is owned by another user", path);
+
+    return 0;
+}
+
+static int fill_socket_address(struct sockaddr_un *addr, const char *path)
+{
+    if (strlen(path) >= sizeof(addr->sun_path))
+        return ty_error(TY_ERROR_RANGE, "Socket path '%s' is too long", path);
+
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    strcpy(addr->sun_path, path);
+
+    return 0;
+}
+
+static int send_all(int fd, const void *buf, size_t size)
+{
+    const char *ptr = buf;
+
+    while (size) {
+        ssize_t r = send(fd, ptr, size, 0);
+        if (r < 0) {
+            if (errno == EINTR)
+                continue;
+            return ty_error(TY_ERROR_IO, "Failed to write to socket: %s", strerror(errno));
+        }
+
+        ptr += r;
+        size -= (size_t)r;
+    }
+
+    return 0;
+}
+
+static int recv_all(int fd, void *buf, size_t size)
+{
+    char *ptr = buf;
+
+    while (size) {
+        ssize_t r = recv(fd, ptr, size, 0);
+        if (r < 0) {
+            if (errno == EINTR)
+                continue;
+            return ty_error(TY_ERROR_IO, "Failed to read from socket: %s", strerror(errno));
+        }
+        if (!r)
+            return ty_error(TY_ERROR_IO, "Connection closed unexpectedly");
+
+        ptr += r;
+        size -= (size_t)r;
+    }
+
+    return 0;
+}
+
+int forward_command(const char *path, int argc, char *argv[])
+{
+    struct sockaddr_un addr;
+    int fd = -1;
+    char *payload = NULL;
+    size_t payload_len;
+    char cwd[4096];
+    struct serve_header header;
+    struct msghdr msg = {0};
+    struct iovec iov;
+    union {
+        struct cmsghdr hdr;
+        char buf[CMSG_SPACE(3 * sizeof(int))];
+    } control;
+    struct cmsghdr *cmsg;
+    int32_t code;
+    int r;
+
+    r = fill_socket_address(&addr, path);
+    if (r < 0)
+        goto cleanup;
+    if (!getcwd(cwd, sizeof(cwd))) {
+        r = ty_error(TY_ERROR_SYSTEM, "getcwd() failed: %s", strerror(errno));
+        goto cleanup;
+    }
+
+    payload_len = strlen(cwd) + 1;
+    for (int i = 0; i < argc; i++)
+        payload_len += strlen(argv[i]) + 1;
+    if (payload_len > SERVE_MAX_REQUEST || argc > SERVE_MAX_ARGS) {
+        r = ty_error(TY_ERROR_RANGE, "Command is too long for the server");
+        goto cleanup;
+    }
+    payload = malloc(payload_len);
+    if (!payload) {
+        r = ty_error(TY_ERROR_MEMORY, NULL);
+        goto cleanup;
+    }
+    {
+        char *ptr = payload;
+
+        strcpy(ptr, cwd);
+        ptr += strlen(cwd) + 1;
+        for (int i = 0; i < argc; i++) {
+            strcpy(ptr, argv[i]);
+            ptr += strlen(argv[i]) + 1;
+        }
+    }
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        r = ty_error(TY_ERROR_SYSTEM, "socket() failed: %s", strerror(errno));
+        goto cleanup;
+    }
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        r = ty_error(TY_ERROR_NOT_FOUND, "Cannot connect to server at '%s': %s", path,
+                     strerror(errno));
+        goto cleanup;
+    }
+    r = check_server_owner(fd, path);
+    if (r < 0)
+        goto cleanup;
+
+    // The descriptors travel with the header
+    header.magic = SERVE_MAGIC;
+    header.size = (uint32_t)payload_len;
+    iov.iov_base = &header;
+    iov.iov_len = sizeof(header);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    memset(&control, 0, sizeof(control));
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(3 * sizeof(int));
+    {
+        int fds[3] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+        memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+    }
+    if (sendmsg(fd, &msg, 0) != (ssize_t)sizeof(header)) {
+        r = ty_error(TY_ERROR_IO, "Failed to send request to server: %s", strerror(errno));
+        goto cleanup;
+    }
+    r = send_all(fd, payload, payload_len);
+    if (r < 0)
+        goto cleanup;
+
+    r = recv_all(fd, &code, sizeof(code));
+    if (r < 0)
+        goto cleanup;
+
+    r = (int)code;
+cleanup:
+    if (fd >= 0)
+        close(fd);
+    free(payload);
+    return r;
+}
+
+static int open_server_socket(const char *path, int *rfd)
+{
+    struct sockaddr_un addr;
+    int fd = -1;
+    int r;
+
+    r = fill_socket_address(&addr, path);
+    if (r < 0)
+        goto error;
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        r = ty_error(TY_ERROR_SYSTEM, "socket() failed: %s", strerror(errno));
+        goto error;
+    }
+
+    // Only replace a stale socket, not one with a server behind it
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+        r = ty_error(TY_ERROR_BUSY, "Another server is listening on '%s'", path);
+        goto error;
+    }
+    unlink(path);
+
+    // Create the socket with restrictive permissions right away, chmod() would be racy
+    {
+        mode_t old_mask = umask(S_IXUSR | S_IRWXG | S_IRWXO);
+        int bind_errno;
+
+        r = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+        bind_errno = errno;
+        umask(old_mask);
+
+        if (r < 0) {
+            r = ty_error(TY_ERROR_SYSTEM, "Failed to bind socket to '%s': %s", path,
+                         strerror(bind_errno));
+            goto error;
+        }
+    }
+    if (listen(fd, 16) < 0) {
+        r = ty_error(TY_ERROR_SYSTEM, "listen() failed: %s", strerror(errno));
+        goto error;
+    }
+
+    *rfd = fd;
+    return 0;
+
+error:
+    if (fd >= 0)
+        close(fd);
+    return r;
+}
+
+static int receive_request(int fd, int fds[3], char **rpayload, size_t *rpayload_len)
+{
+    struct serve_header header;
+    struct msghdr msg = {0};
+    struct iovec iov;
+    union {
+        struct cmsghdr hdr;
+        char buf[CMSG_SPACE(3 * sizeof(int))];
+    } control;
+    struct cmsghdr *cmsg;
+    char *payload = NULL;
+    ssize_t len;
+    int r;
+
+    iov.iov_base = &header;
+    iov.iov_len = sizeof(header);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    do {
+        len = recvmsg(fd, &msg, 0);
+    } while (len < 0 && errno == EINTR);
+    if (len < 0)
+        return ty_error(TY_ERROR_IO, "Failed to read request: %s", strerror(errno));
+
+    cmsg = CMSG_FIRSTHDR(&msg);
+    if (!cmsg || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS ||
+            cmsg->cmsg_len != CMSG_LEN(3 * sizeof(int)))
+        return ty_error(TY_ERROR_PARSE, "Request does not carry standard descriptors");
+    memcpy(fds, CMSG_DATA(cmsg), 3 * sizeof(int));
+
+    if (len < (ssize_t)sizeof(header)) {
+        r = recv_all(fd, (char *)&header + len, sizeof(header) - (size_t)len);
+        if (r < 0)
+            goto error;
+    }
+    if (header.magic != SERVE_MAGIC || !header.size || header.size > SERVE_MAX_REQUEST) {
+        r = ty_error(TY_ERROR_PARSE, "Malformed request");
+        goto error;
+    }
+
+    payload = malloc(header.size + 1);
+    if (!payload) {
+        r = ty_error(TY_ERROR_MEMORY, NULL);
+        goto error;
+    }
+    r = recv_all(fd, payload, header.size);
+    if (r < 0)
+        goto error;
+    payload[header.size] = 0;
+
+    *rpayload = payload;
+    *rpayload_len = header.size;
+    return 0;
+
+error:
+    free(payload);
+    for (int i = 0; i < 3; i++)
+        close(fds[i]);
+    return r;
+}
+
+static int execute_request(char *payload, size_t payload_len)
+{
+    char *cwd;
+    char *argv[SERVE_MAX_ARGS + 1];
+    int argc = 0;
+    const struct serve_command *cmd;
+
+    cwd = payload;
+    for (char *ptr = payload + strlen(payload) + 1; ptr < payload + payload_len;
+            ptr += strlen(ptr) + 1) {
+        if (argc >= SERVE_MAX_ARGS) {
+            ty_log(TY_LOG_ERROR, "Too many arguments");
+            return EXIT_FAILURE;
+        }
+        argv[argc++] = ptr;
+    }
+    argv[argc] = NULL;
+    if (!argc) {
+        ty_log(TY_LOG_ERROR, "Missing command");
+        return EXIT_FAILURE;
+    }
+
+    cmd = find_serve_command(argv[0]);
+    if (!cmd) {
+        ty_log(TY_LOG_ERROR, "Command '%s' is not available through the server", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (chdir(cwd) < 0) {
+        ty_log(TY_LOG_ERROR, "Cannot change to directory '%s': %s", cwd, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    return (*cmd->f)(argc, argv);
+}
+
+static void handle_client(int fd, const char *home)
+{
+    int fds[3];
+    int saved_fds[3] = {-1, -1, -1};
+    char *payload = NULL;
+    size_t payload_len = 0;
+    int verbosity = ty_config_verbosity;
+    struct timeval timeout = {SERVE_CLIENT_TIMEOUT, 0};
+    int32_t code;
+    int r;
+
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    r = receive_request(fd, fds, &payload, &payload_len);
+    if (r < 0)
+        return;
+
+    // Run the command with the client's stdin, stdout and stderr
+    fflush(stdout);
+    fflush(stderr);
+    for (int i = 0; i < 3; i++) {
+        saved_fds[i] = dup(i);
+        dup2(fds[i], i);
+        close(fds[i]);
+    }
+
+    reset_common_options();
+    code = execute_request(payload, payload_len);
+    print_requested_stats(stderr);
+
+    fflush(stdout);
+    fflush(stderr);
+    clearerr(stdin);
+    for (int i = 0; i < 3; i++) {
+        if (saved_fds[i] >= 0) {
+            dup2(saved_fds[i], i);
+            close(saved_fds[i]);
+        }
+    }
+    ty_config_verbosity = verbosity;
+    if (chdir(home) < 0)
+        ty_log(TY_LOG_WARNING, "Cannot go back to '%s': %s", home, strerror(errno));
+
+    send_all(fd, &code, sizeof(code));
+    free(payload);
+}
+
+int serve(int argc, char *argv[])
+{
+    ty_optline_context optl;
+    char *opt;
+    char default_path[256];
+    char home[4096];
+    ty_monitor *monitor;
+    ty_descriptor_set set = {0};
+    ty_poller *poller = NULL;
+    int listen_fd = -1;
+    int r;
+
+    ty_optline_init_argv(&optl, argc, argv);
+    while ((opt = ty_optline_next_option(&optl))) {
+        if (strcmp(opt, "--help") == 0) {
+            print_serve_usage(stdout);
+            return EXIT_SUCCESS;
+        } else if (strcmp(opt, "--socket") == 0 || strcmp(opt, "-s") == 0) {
+            serve_socket_path = ty_optline_get_value(&optl);
+            if (!serve_socket_path) {
+                ty_log(TY_LOG_ERROR, "Option '--socket' takes an argument");
+                print_serve_usage(stderr);
+                return EXIT_FAILURE;
+            }
+        } else if (!parse_common_option(&optl, opt)) {
+            print_serve_usage(stderr);
+            return EXIT_FAILURE;
+        }
+    }
+    if (ty_optline_consume_non_option(&optl)) {
+        ty_log(TY_LOG_ERROR, "No positional argument is allowed");
+        print_serve_usage(stderr);
+        return EXIT_FAILURE;
+    }
+
+    if (!serve_socket_path) {
+        r = get_default_socket_path(default_path, sizeof(default_path));
+        if (r < 0)
+            return EXIT_FAILURE;
+        serve_socket_path = default_path;
+    }
+    if (!getcwd(home, sizeof(home))) {
+        ty_log(TY_LOG_ERROR, "getcwd() failed: %s", strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    // Clients may go away while we write to their descriptors
+    signal(SIGPIPE, SIG_IGN);
+
+    r = get_monitor(&monitor);
+    if (r < 0)
+        goto cleanup;
+    r = open_server_socket(serve_socket_path, &listen_fd);
+    if (r < 0)
+        goto cleanup;
+
+    r = ty_poller_new(&poller);
+    if (r < 0)
+        goto cleanup;
+    ty_monitor_get_descriptors(monitor, &set, 1);
+    ty_descriptor_set_add(&set, listen_fd, 2);
+    r = ty_poller_add_set(poller, &set);
+    if (r < 0)
+        goto cleanup;
+
+    ty_log(TY_LOG_INFO, "Listening on '%s'", serve_socket_path);
+    tycmd_serving = true;
+
+    while (true) {
+        int id;
+
+        r = ty_poller_wait(poller, &id, 1, -1);
+        if (r < 0)
+            goto cleanup;
+        if (!r)
+            continue;
+
+        if (id == 1) {
+            r = ty_monitor_refresh(monitor);
+            if (r < 0)
+                goto cleanup;
+        } else {
+            int fd = accept(listen_fd, NULL, NULL);
+            if (fd < 0) {
+                if (errno == EINTR || errno == EAGAIN || errno == ECONNABORTED)
+                    continue;
+                r = ty_error(TY_ERROR_SYSTEM, "accept() failed: %s", strerror(errno));
+                goto cleanup;
+            }
+
+            handle_client(fd, home);
+            close(fd);
+        }
+    }
+
+cleanup:
+    tycmd_serving = false;
+    ty_poller_free(poller);
+    if (listen_fd >= 0) {
+        close(listen_fd);
+        unlink(serve_socket_path);
+    }
+    return r < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+#else
+
+bool can_forward_command(int argc, char *argv[])
+{
+    TY_UNUSED(argc);
+    TY_UNUSED(argv);
+
+    return false;
+}
+
+int forward_command(const char *path, int argc, char *argv[])
+{
+    TY_UNUSED(path);
+    TY_UNUSED(argc);
+    TY_UNUSED(argv);
+
+    return ty_error(TY_ERROR_UNSUPPORTED, "The tycmd server is not available on Windows");
+}
+
+int serve(int argc, char *argv[])
+{
+    if (argc > 1 && strcmp(argv[1], "--help") == 0) {
+        print_serve_usage(stdout);
+        return EXIT_SUCCESS;
+    }
+
+    ty_log(TY_LOG_ERROR, "The tycmd server is not available on Windows");
+    return EXIT_FAILURE;
+}
+
+#endif
@@ -37,16 +37,60 @@ static void print_upload_usage(FILE *f)
     fprintf(f, ".\n");
 }
 
+static bool is_any_firmware_compatible(const ty_board *board, ty_firmware **fws,
+                                       unsigned int fws_count)
+{
+    ty_model board_model = ty_board_get_model(board);
+
+    for (unsigned int i = 0; i < fws_count; i++) {
+        ty_model fw_models[64];
+        unsigned int fw_models_count;
+
+        fw_models_count = ty_firmware_identify(fws[i], fw_models, TY_COUNTOF(fw_models));
+        for (unsigned int j = 0; j < fw_models_count; j++) {
+            if (fw_models[j] == board_model)
+                return true;
+        }
+    }
+
+    return false;
+}
+
+// Bring back a board we rebooted early for nothing
+static void restore_board(ty_board *board)
+{
+    ty_task *task = NULL;
+    int r;
+
+    if (!ty_board_has_capability(board, TY_BOARD_CAPABILITY_RESET))
+        return;
+
+    r = ty_reset(board, &task);
+    if (!r)
+        ty_task_join(task);
+    ty_task_unref(task);
+}
+
 int upload(int argc, char *argv[])
 {
     ty_optline_context optl;
     char *opt;
+    const char *filenames[TY_UPLOAD_MAX_FIRMWARES];
+    unsigned int filenames_count = 0;
+    bool read_stdin = false;
     ty_board *board = NULL;
+    ty_task *load_tasks[TY_UPLOAD_MAX_FIRMWARES];
+    unsigned int load_tasks_count = 0;
     ty_firmware *fws[TY_UPLOAD_MAX_FIRMWARES];
-    unsigned int fws_count;
+    unsigned int fws_count = 0;
+    ty_task *reboot_task = NULL;
     ty_task *task = NULL;
     int r;
 
+    // tycmd serve runs commands more than once
+    upload_flags = 0;
+    upload_firmware_format = NULL;
+
     ty_optline_init_argv(&optl, argc, argv);
     while ((opt = ty_optline_next_option(&optl))) {
         if (strcmp(opt, "--help") == 0) {
@@ -71,19 +115,26 @@ int upload(int argc, char *argv[])
         }
     }
 
-    fws_count = 0;
     while ((opt = ty_optline_consume_non_option(&optl))) {
-        if (fws_count >= TY_COUNTOF(fws)) {
-            ty_log(TY_LOG_WARNING, "Too many firmwares, considering only %zu files", TY_COUNTOF(fws));
+        // Loads run concurrently, two of them cannot share stdin
+        if (!strcmp(opt, "-")) {
+            if (read_stdin) {
+                ty_log(TY_LOG_ERROR, "Cannot read more than one firmware from stdin");
+                print_upload_usage(stderr);
+                return EXIT_FAILURE;
+            }
+            read_stdin = true;
+        }
+
+        if (filenames_count >= TY_COUNTOF(filenames)) {
+            ty_log(TY_LOG_WARNING, "Too many firmwares, considering only %zu files",
+                   TY_COUNTOF(filenames));
             break;
         }
 
-        r = ty_firmware_load_file(opt, !strcmp(opt, "-") ? stdin : NULL,
-                                  upload_firmware_format, &fws[fws_count]);
-        if (!r)
-            fws_count++;
+        filenames[filenames_count++] = opt;
     }
-    if (!fws_count) {
+    if (!filenames_count) {
         ty_log(TY_LOG_ERROR, "Missing valid firmware filename");
         print_upload_usage(stderr);
         return EXIT_FAILURE;
@@ -93,9 +144,63 @@ int upload(int argc, char *argv[])
     if (r < 0)
         goto cleanup;
 
+    /* Rebooting takes hundreds of milliseconds, start it before the firmware loads (which
+       would otherwise fill the pool queue) and let it run in parallel. If it fails,
+       ty_upload() will deal with it as usual. */
+    if (!(upload_flags & TY_UPLOAD_WAIT) &&
+            !ty_board_has_capability(board, TY_BOARD_CAPABILITY_UPLOAD) &&
+            ty_board_has_capability(board, TY_BOARD_CAPABILITY_REBOOT)) {
+        r = ty_reboot(board, &reboot_task);
+        if (r < 0)
+            goto cleanup;
+        r = ty_task_start(reboot_task);
+        if (r < 0)
+            goto cleanup;
+    }
+
+    // Read, parse and identify all firmwares concurrently
+    for (unsigned int i = 0; i < filenames_count; i++) {
+        const char *filename = filenames[i];
+
+        r = ty_load_firmware(filename, !strcmp(filename, "-") ? stdin : NULL,
+                             upload_firmware_format, &load_tasks[load_tasks_count]);
+        if (r < 0)
+            goto cleanup;
+        load_tasks_count++;
+
+        r = ty_task_start(load_tasks[load_tasks_count - 1]);
+        if (r < 0)
+            goto cleanup;
+    }
+
+    // Keep the command line order, the first compatible firmware wins
+    for (unsigned int i = 0; i < load_tasks_count; i++) {
+        r = ty_task_join(load_tasks[i]);
+        if (!r) {
+            fws[fws_count++] = load_tasks[i]->result;
+            load_tasks[i]->result = NULL;
+            load_tasks[i]->result_cleanup = NULL;
+        }
+    }
+
+    if (reboot_task) {
+        // ty_upload() will wait for the user to press the button if this failed
+        r = ty_task_join(reboot_task);
+        if (r < 0)
+            upload_flags |= TY_UPLOAD_WAIT;
+
+        if (!r && (!fws_count || (!(upload_flags & TY_UPLOAD_NOCHECK) &&
+                                  ty_models[ty_board_get_model(board)].mcu &&
+                                  !is_any_firmware_compatible(board, fws, fws_count))))
+            restore_board(board);
+    }
+
+    if (!fws_count) {
+        r = ty_error(TY_ERROR_PARAM, "Missing valid firmware filename");
+        goto cleanup;
+    }
+
     r = ty_upload(board, fws, fws_count, upload_flags, &task);
-    for (unsigned int i = 0; i < fws_count; i++)
-        ty_firmware_unref(fws[i]);
     if (r < 0)
         goto cleanup;
 
@@ -103,6 +208,15 @@ int upload(int argc, char *argv[])
 
 cleanup:
     ty_task_unref(task);
+    ty_task_unref(reboot_task);
+    for (unsigned int i = 0; i < fws_count; i++)
+        ty_firmware_unref(fws[i]);
+    for (unsigned int i = 0; i < load_tasks_count; i++) {
+        // Don't leave loads running (or reading stdin) behind us
+        if (load_tasks[i]->status != TY_TASK_STATUS_READY)
+            ty_task_wait(load_tasks[i], TY_TASK_STATUS_FINISHED, -1);
+        ty_task_unref(load_tasks[i]);
+    }
     ty_board_unref(board);
     return r < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
 }
@@ -26,7 +26,10 @@
 
 using namespace std;
 
-const QHash<QString, void (ClientHandler::*)(const QStringList &)> ClientHandler::commands_ = {
+#define PROGRESS_INTERVAL 100
+
+const QHash<QString, void (ClientHandler::*)(uint32_t, const QStringList &)>
+    ClientHandler::commands_ = {
     {"workdir", &ClientHandler::setWorkingDirectory},
     {"multi",   &ClientHandler::setMultiSelection},
     {"persist", &ClientHandler::setPersistOption},
@@ -45,16 +48,21 @@ ClientHandler::ClientHandler(unique_ptr<SessionPeer> peer, QObject *parent)
     connect(peer_.get(), &SessionPeer::closed, this, &ClientHandler::closed);
     connect(peer_.get(), &SessionPeer::received, this, &ClientHandler::execute);
 
+    progress_timer_.setSingleShot(true);
+    progress_timer_.setInterval(PROGRESS_INTERVAL);
+    connect(&progress_timer_, &QTimer::timeout, this, &ClientHandler::flushProgress);
+
 #ifdef _WIN32
-    peer_->send({"allowsetforegroundwindow", QString::number(GetCurrentProcessId())});
+    // Not tied to any request
+    peer_->send(0, {"allowsetforegroundwindow", QString::number(GetCurrentProcessId())});
 #endif
 }
 
-void ClientHandler::execute(const QStringList &arguments)
+void ClientHandler::execute(uint32_t id, const QStringList &arguments)
 {
     if (arguments.isEmpty()) {
-        notifyLog(TY_LOG_ERROR, tr("Command not specified"));
-        notifyFinished(false);
+        notifyLog(id, TY_LOG_ERROR, tr("Command not specified"));
+        notifyFinished(id, false);
         return;
     }
 
@@ -63,47 +71,47 @@ void ClientHandler::execute(const QStringList &arguments)
 
     auto cmd_it = commands_.find(cmd_name);
     if (cmd_it == commands_.end()) {
-        notifyLog(TY_LOG_ERROR, tr("Unknown command '%1'").arg(cmd_name));
-        notifyFinished(false);
+        notifyLog(id, TY_LOG_ERROR, tr("Unknown command '%1'").arg(cmd_name));
+        notifyFinished(id, false);
         return;
     }
 
-    (this->**cmd_it)(parameters);
+    (this->**cmd_it)(id, parameters);
 }
 
-void ClientHandler::setWorkingDirectory(const QStringList &parameters)
+void ClientHandler::setWorkingDirectory(uint32_t id, const QStringList &parameters)
 {
     if (parameters.isEmpty()) {
-        notifyLog(TY_LOG_ERROR, "Missing argument for 'workdir' command");
-        notifyFinished(false);
+        notifyLog(id, TY_LOG_ERROR, "Missing argument for 'workdir' command");
+        notifyFinished(id, false);
         return;
     }
 
-    working_directory_ = parameters[0];
+    requests_[id].working_directory = parameters[0];
 }
 
-void ClientHandler::setMultiSelection(const QStringList &parameters)
+void ClientHandler::setMultiSelection(uint32_t id, const QStringList &parameters)
 {
-    multi_ = QVariant(parameters.value(0, "1")).toBool();
+    requests_[id].multi = QVariant(parameters.value(0, "1")).toBool();
 }
 
-void ClientHandler::setPersistOption(const QStringList &parameters)
+void ClientHandler::setPersistOption(uint32_t id, const QStringList &parameters)
 {
-    persist_ = QVariant(parameters.value(0, "1")).toBool();
+    requests_[id].persist = QVariant(parameters.value(0, "1")).toBool();
 }
 
-void ClientHandler::selectBoard(const QStringList &filters)
+void ClientHandler::selectBoard(uint32_t id, const QStringList &filters)
 {
     if (filters.empty()) {
-        notifyLog(TY_LOG_ERROR, "Missing argument for 'select' command");
-        notifyFinished(false);
+        notifyLog(id, TY_LOG_ERROR, "Missing argument for 'select' command");
+        notifyFinished(id, false);
         return;
     }
 
-    filters_.append(filters);
+    requests_[id].filters.append(filters);
 }
 
-void ClientHandler::openMainWindow(const QStringList &parameters)
+void ClientHandler::openMainWindow(uint32_t id, const QStringList &parameters)
 {
     Q_UNUSED(parameters);
 
@@ -111,63 +119,64 @@ void ClientHandler::openMainWindow(const QStringList &parameters)
     win->setAttribute(Qt::WA_DeleteOnClose, true);
     win->show();
 
-    notifyFinished(true);
+    notifyFinished(id, true);
 }
 
-void ClientHandler::reset(const QStringList &)
+void ClientHandler::reset(uint32_t id, const QStringList &)
 {
-    auto boards = selectedBoards();
+    auto boards = selectedBoards(id);
     if (boards.empty())
         return;
 
     for (auto &board: boards) {
         auto task = board->reset();
-        addTask(task);
+        addTask(id, task);
     }
-    executeTasks();
+    executeTasks(id);
 }
 
-void ClientHandler::reboot(const QStringList &)
+void ClientHandler::reboot(uint32_t id, const QStringList &)
 {
-    auto boards = selectedBoards();
+    auto boards = selectedBoards(id);
     if (boards.empty())
         return;
 
     for (auto &board: boards) {
         auto task = board->reboot();
-        addTask(task);
+        addTask(id, task);
     }
-    executeTasks();
+    executeTasks(id);
 }
 
-void ClientHandler::upload(const QStringList &filenames)
+void ClientHandler::upload(uint32_t id, const QStringList &filenames)
 {
     auto monitor = tyCommander->monitor();
+    auto &req = requests_[id];
 
     QStringList filenames2;
     filenames2.reserve(filenames.count());
     for (auto filename: filenames) {
-        QFileInfo info(working_directory_, filename);
+        QFileInfo info(req.working_directory, filename);
         if (!info.exists()) {
-            notifyLog(TY_LOG_ERROR, tr("File '%1' does not exist").arg(filename));
+            notifyLog(id, TY_LOG_ERROR, tr("File '%1' does not exist").arg(filename));
             continue;
         }
         filename = QDir::toNativeSeparators(info.filePath());
         filenames2.append(filename);
     }
     if (filenames2.isEmpty()) {
-        notifyFinished(false);
+        notifyFinished(id, false);
         return;
     }
 
     if (!monitor->boardCount()) {
-        notifyLog(TY_LOG_ERROR, tr("No board available"));
-        notifyFinished(false);
+        notifyLog(id, TY_LOG_ERROR, tr("No board available"));
+        notifyFinished(id, false);
         return;
     }
 
     vector<shared_ptr<Board>> boards;
-    if (filters_.isEmpty() && !filenames2.isEmpty()) {
+    if (req.filters.isEmpty() && !filenames2.isEmpty()) {
         if (filenames2.count() == 1) {
             boards = monitor->find([&](Board &board) {
                 return ty_compare_paths(board.firmware().toLocal8Bit().constData(),
@@ -176,12 +185,12 @@ void ClientHandler::upload(const QStringList &filenames)
         }
 
         if (boards.empty()) {
-            notifyLog(TY_LOG_INFO, "Waiting for user selection");
-            notifyStarted();
+            notifyLog(id, TY_LOG_INFO, "Waiting for user selection");
+            notifyStarted(id);
 
             auto dialog = new SelectorDialog();
             dialog->setAttribute(Qt::WA_DeleteOnClose);
-            dialog->setExtendedSelection(multi_);
+            dialog->setExtendedSelection(req.multi);
             if (filenames2.count() == 1) {
                 dialog->setAction(tr("Upload '%1'").arg(QFileInfo(filenames2[0]).fileName()));
                 dialog->setDescription(tr("Upload '%1' to:")
@@ -199,8 +208,8 @@ void ClientHandler::upload(const QStringList &filenames)
                 if (this_ptr) {
                     auto tasks = makeUploadTasks(dialog->selectedBoards(), filenames2);
                     for (auto &task: tasks)
-                        addTask(task);
-                    executeTasks();
+                        addTask(id, task);
+                    executeTasks(id);
                 } else {
                     auto tasks = makeUploadTasks(dialog->selectedBoards(), filenames2);
                     for (auto &task: tasks)
@@ -208,8 +217,8 @@ void ClientHandler::upload(const QStringList &filenames)
                 }
             });
             connect(dialog, &SelectorDialog::rejected, this, [=]() {
-                notifyLog(TY_LOG_ERROR, "Upload was canceled");
-                notifyFinished(false);
+                notifyLog(id, TY_LOG_ERROR, "Upload was canceled");
+                notifyFinished(id, false);
             });
 
             dialog->show();
@@ -219,41 +228,41 @@ void ClientHandler::upload(const QStringList &filenames)
             return;
         }
     } else {
-        boards = selectedBoards();
+        boards = selectedBoards(id);
     }
     if (boards.empty())
         return;
 
     auto tasks = makeUploadTasks(boards, filenames2);
     for (auto &task: tasks)
-        addTask(task);
-    executeTasks();
+        addTask(id, task);
+    executeTasks(id);
 }
 
-void ClientHandler::attach(const QStringList &)
+void ClientHandler::attach(uint32_t id, const QStringList &)
 {
-    auto boards = selectedBoards();
+    auto boards = selectedBoards(id);
     if (boards.empty())
         return;
 
     bool ret = true;
     for (auto &board: boards) {
-        board->setEnableSerial(true, persist_);
+        board->setEnableSerial(true, requests_[id].persist);
         if (board->hasCapability(TY_BOARD_CAPABILITY_SERIAL) && !board->serialOpen())
             ret = false;
     }
-    notifyFinished(ret);
+    notifyFinished(id, ret);
 }
 
-void ClientHandler::detach(const QStringList &)
+void ClientHandler::detach(uint32_t id, const QStringList &)
 {
-    auto boards = selectedBoards();
+    auto boards = selectedBoards(id);
     if (boards.empty())
         return;
 
     for (auto &board: boards)
-        board->setEnableSerial(false, persist_);
-    notifyFinished(true);
+        board->setEnableSerial(false, requests_[id].persist);
+    notifyFinished(id, true);
 }
 
 /* This function is static because it can be called after the client is gone (and the
@@ -310,21 +319,22 @@ vector<TaskInterface> ClientHandler::makeUploadTasks(const vector<shared_ptr<Boa
     return tasks;
 }
 
-vector<shared_ptr<Board>> ClientHandler::selectedBoards()
+vector<shared_ptr<Board>> ClientHandler::selectedBoards(uint32_t id)
 {
     auto monitor = tyCommander->monitor();
+    auto &req = requests_[id];
 
     if (!monitor->boardCount()) {
-        notifyLog(TY_LOG_ERROR, tr("No board available"));
-        notifyFinished(false);
+        notifyLog(id, TY_LOG_ERROR, tr("No board available"));
+        notifyFinished(id, false);
         return {};
     }
 
     vector<shared_ptr<Board>> boards;
-    if (filters_.isEmpty()) {
+    if (req.filters.isEmpty()) {
         boards = monitor->boards();
     } else {
-        auto filters = multi_ ? filters_ : QStringList{filters_.last()};
+        auto filters = req.multi ? req.filters : QStringList{req.filters.last()};
         boards = monitor->find([&](Board &board) {
             for (auto &filter: filters) {
                 if (board.matchesTag(filter))
@@ -334,76 +344,125 @@ vector<shared_ptr<Board>> ClientHandler::selectedBoards()
         });
 
         if (boards.empty()) {
-            if (filters_.count() == 1) {
-                notifyLog(TY_LOG_ERROR, tr("Cannot find any board matching '%1'").arg(filters_[0]));
+            if (req.filters.count() == 1) {
+                notifyLog(id, TY_LOG_ERROR,
+                          tr("Cannot find any board matching '%1'").arg(req.filters[0]));
             } else {
-                notifyLog(TY_LOG_ERROR, tr("Cannot find any matching board"));
+                notifyLog(id, TY_LOG_ERROR, tr("Cannot find any matching board"));
             }
-            notifyFinished(false);
+            notifyFinished(id, false);
             return {};
         }
     }
 
-    if (!multi_)
+    if (!req.multi)
         boards.resize(1);
     return boards;
 }
 
-void ClientHandler::notifyLog(ty_log_level level, const QString &msg)
+void ClientHandler::send(uint32_t id, const QStringList &arguments)
+{
+    // Keep messages in order, the pending progress message goes first
+    auto it = requests_.find(id);
+    if (it != requests_.end() && !it->pending_progress.isEmpty()) {
+        peer_->send(id, it->pending_progress);
+        it->pending_progress.clear();
+    }
+
+    peer_->send(id, arguments);
+}
+
+void ClientHandler::flushProgress()
+{
+    for (auto it = requests_.begin(); it != requests_.end(); ++it) {
+        if (!it->pending_progress.isEmpty()) {
+            peer_->send(it.key(), it->pending_progress);
+            it->pending_progress.clear();
+        }
+    }
+}
+
+void ClientHandler::notifyLog(uint32_t id, const QString &ctx, ty_log_level level,
+                              const QString &msg)
 {
-    QString ctx;
-    if (auto watcher = qobject_cast<TaskWatcher *>(sender()))
-        ctx = watcher->task().name();
-    peer_->send({"log", ctx, QString::number(level), msg});
+    send(id, {"log", ctx, QString::number(level), msg});
 }
 
-void ClientHandler::notifyStarted()
+void ClientHandler::notifyStarted(uint32_t id)
 {
-    peer_->send("start");
+    send(id, {"start"});
 }
 
-void ClientHandler::notifyFinished(bool success)
+void ClientHandler::notifyFinished(uint32_t id, bool success)
 {
-    finished_tasks_++;
+    auto &req = requests_[id];
+
+    req.finished_tasks++;
     if (!success)
-        error_count_++;
+        req.error_count++;
 
-    if (finished_tasks_ >= tasks_.size())
-        peer_->send({"exit", error_count_ ? "1" : "0"});
+    if (req.finished_tasks >= req.tasks.size()) {
+        send(id, {"exit", req.error_count ? "1" : "0"});
+        // The request is over, don't keep its state around for the rest of the session
+        requests_.remove(id);
+    }
 }
 
-void ClientHandler::notifyProgress(const QString &action, unsigned int value, unsigned int max)
+void ClientHandler::notifyProgress(uint32_t id, const QString &ctx, const QString &action,
+                                   uint64_t value, uint64_t max)
 {
-    if (tasks_.size() > 1) {
+    auto it = requests_.find(id);
+    if (it == requests_.end())
+        return;
+    auto &req = *it;
+
+    if (req.tasks.size() > 1) {
         if (!value)
-            notifyLog(TY_LOG_INFO, QString("%1...").arg(action));
-    } else {
-        QString ctx;
-        if (auto watcher = qobject_cast<TaskWatcher *>(sender()))
-            ctx = watcher->task().name();
-        peer_->send({"progress", ctx, action, QString::number(value), QString::number(max)});
+            notifyLog(id, ctx, TY_LOG_INFO, QString("%1...").arg(action));
+        return;
+    }
+
+    /* Uploads report progress after each block, which makes for thousands of messages with
+       big firmwares. Send the first and last ones right away, and only the most recent one
+       every PROGRESS_INTERVAL milliseconds in between. */
+    req.pending_progress = {"progress", ctx, action, QString::number(value), QString::number(max)};
+    if (!value || value >= max) {
+        peer_->send(id, req.pending_progress);
+        req.pending_progress.clear();
+    } else if (!progress_timer_.isActive()) {
+        progress_timer_.start();
     }
 }
 
-void ClientHandler::addTask(TaskInterface task)
+void ClientHandler::addTask(uint32_t id, TaskInterface task)
 {
-    tasks_.push_back(task);
+    requests_[id].tasks.push_back(task);
 
     auto watcher = new TaskWatcher(this);
-    connect(watcher, &TaskWatcher::log, this, &ClientHandler::notifyLog);
-    connect(watcher, &TaskWatcher::started, this, &ClientHandler::notifyStarted);
-    connect(watcher, &TaskWatcher::finished, this, &ClientHandler::notifyFinished);
-    connect(watcher, &TaskWatcher::progress, this, &ClientHandler::notifyProgress);
+    connect(watcher, &TaskWatcher::log, this, [=](ty_log_level level, const QString &msg) {
+        notifyLog(id, watcher->task().name(), level, msg);
+    });
+    connect(watcher, &TaskWatcher::started, this, [=]() { notifyStarted(id); });
+    connect(watcher, &TaskWatcher::finished, this, [=](bool success) {
+        notifyFinished(id, success);
+    });
+    connect(watcher, &TaskWatcher::progress, this,
+            [=](const QString &action, uint64_t value, uint64_t max) {
+        notifyProgress(id, watcher->task().name(), action, value, max);
+    });
     watcher->setTask(&task);
 }
 
-void ClientHandler::executeTasks()
+void ClientHandler::executeTasks(uint32_t id)
 {
-    if (tasks_.empty()) {
-        notifyFinished(true);
+    // Copy the list, tasks may finish (and touch requests_) before we are done
+    auto tasks = requests_[id].tasks;
+
+    if (tasks.empty()) {
+        notifyFinished(id, true);
         return;
     }
 
-    for (auto &task: tasks_)
+    for (auto &task: tasks)
         task.start();
 }
@@ -12,6 +12,7 @@
 #define CLIENT_HANDLER_HH
 
 #include <QHash>
+#include <QTimer>
 
 #include <memory>
 #include <vector>
@@ -24,52 +25,69 @@ class Board;
 class ClientHandler : public QObject {
     Q_OBJECT
 
-    static const QHash<QString, void (ClientHandler::*)(const QStringList &)> commands_;
+    /* Clients can pipeline several requests on the same connection, each made of option
+       commands (workdir, select, etc.) followed by an action command, and get the answers
+       tagged with the request ID. */
+    struct Request {
+        QString working_directory;
+        bool multi = false;
+        bool persist = false;
+        QStringList filters;
 
-    std::unique_ptr<SessionPeer> peer_;
+        std::vector<TaskInterface> tasks;
+
+        unsigned int finished_tasks = 0;
+        unsigned int error_count = 0;
 
-    QString working_directory_;
-    bool multi_ = false;
-    bool persist_ = false;
-    QStringList filters_;
+        // Last progress message not sent yet, see notifyProgress()
+        QStringList pending_progress;
+    };
 
-    std::vector<TaskInterface> tasks_;
+    static const QHash<QString, void (ClientHandler::*)(uint32_t, const QStringList &)> commands_;
 
-    unsigned int finished_tasks_ = 0;
-    unsigned int error_count_ = 0;
+    std::unique_ptr<SessionPeer> peer_;
+
+    QHash<uint32_t, Request> requests_;
+    QTimer progress_timer_;
 
 public:
     ClientHandler(std::unique_ptr<SessionPeer> peer, QObject *parent = nullptr);
 
-    void execute(const QStringList &parameters);
+    void execute(uint32_t id, const QStringList &parameters);
 
 signals:
     void closed(SessionPeer::CloseReason reason);
 
 private:
-    void setWorkingDirectory(const QStringList &parameters);
-    void setMultiSelection(const QStringList &parameters);
-    void setPersistOption(const QStringList &parameters);
-    void selectBoard(const QStringList &filters);
-    void openMainWindow(const QStringList &parameters);
-    void reset(const QStringList &parameters);
-    void reboot(const QStringList &parameters);
-    void upload(const QStringList &parameters);
-    void attach(const QStringList &parameters);
-    void detach(const QStringList &parameters);
+    void setWorkingDirectory(uint32_t id, const QStringList &parameters);
+    void setMultiSelection(uint32_t id, const QStringList &parameters);
+    void setPersistOption(uint32_t id, const QStringList &parameters);
+    void selectBoard(uint32_t id, const QStringList &filters);
+    void openMainWindow(uint32_t id, const QStringList &parameters);
+    void reset(uint32_t id, const QStringList &parameters);
+    void reboot(uint32_t id, const QStringList &parameters);
+    void upload(uint32_t id, const QStringList &parameters);
+    void attach(uint32_t id, const QStringList &parameters);
+    void detach(uint32_t id, const QStringList &parameters);
 
     static std::vector<TaskInterface> makeUploadTasks(
         const std::vector<std::shared_ptr<Board>> &boards, const QStringList &filenames);
 
-    std::vector<std::shared_ptr<Board>> selectedBoards();
+    std::vector<std::shared_ptr<Board>> selectedBoards(uint32_t id);
+
+    void send(uint32_t id, const QStringList &arguments);
+    void flushProgress();
 
-    void notifyLog(ty_log_level level, const QString &msg);
-    void notifyStarted();
-    void notifyFinished(bool success);
-    void notifyProgress(const QString &action, unsigned int value, unsigned int max);
+    void notifyLog(uint32_t id, const QString &ctx, ty_log_level level, const QString &msg);
+    void notifyLog(uint32_t id, ty_log_level level, const QString &msg)
+        { notifyLog(id, QString(), level, msg); }
+    void notifyStarted(uint32_t id);
+    void notifyFinished(uint32_t id, bool success);
+    void notifyProgress(uint32_t id, const QString &ctx, const QString &action, uint64_t value,
+                        uint64_t max);
 
-    void addTask(TaskInterface task);
-    void executeTasks();
+    void addTask(uint32_t id, TaskInterface task);
+    void executeTasks(uint32_t id);
 };
 
 #endif
@@ -8,30 +8,157 @@
 
    See the LICENSE file for more details. */
 
+#include <QDataStream>
+#include <QDir>
+#include <QFileInfo>
+#include <QSaveFile>
 #include <QSettings>
 
+#include "../libty/common.h"
 #include "database.hpp"
 
 using namespace std;
 
-void SettingsDatabase::put(const QString &key, const QVariant &value)
+#define STORE_MAGIC 0x54594442 // TYDB
+#define STORE_VERSION 1
+#define STORE_STREAM_VERSION QDataStream::Qt_5_0
+#define STORE_SYNC_DELAY 1000
+
+StoreDatabase::StoreDatabase()
 {
-    settings_->setValue(key, value);
+    sync_timer_.setSingleShot(true);
+    sync_timer_.setInterval(STORE_SYNC_DELAY);
+    QObject::connect(&sync_timer_, &QTimer::timeout, &sync_timer_, [=]() { sync(); });
 }
 
-void SettingsDatabase::remove(const QString &key)
+StoreDatabase::~StoreDatabase()
 {
-    settings_->remove(key);
+    sync();
+}
+
+bool StoreDatabase::load(const QString &path)
+{
+    path_ = path;
+    values_.clear();
+    dirty_ = false;
+
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+
+    QDataStream in(&file);
+    in.setVersion(STORE_STREAM_VERSION);
+
+    quint32 magic, version, count;
+    in >> magic >> version >> count;
+    if (in.status() != QDataStream::Ok || magic != STORE_MAGIC || version != STORE_VERSION) {
+        ty_log(TY_LOG_WARNING, "Ignoring invalid settings file '%s'",
+               QDir::toNativeSeparators(path).toUtf8().constData());
+        return false;
+    }
+
+    values_.reserve(static_cast<int>(count));
+    for (quint32 i = 0; i < count; i++) {
+        QString key;
+        QVariant value;
+
+        in >> key >> value;
+        if (in.status() != QDataStream::Ok) {
+            ty_log(TY_LOG_WARNING, "Settings file '%s' is truncated",
+                   QDir::toNativeSeparators(path).toUtf8().constData());
+            break;
+        }
+        values_.insert(key, value);
+    }
+
+    return true;
+}
+
+void StoreDatabase::importSettings(QSettings *settings)
+{
+    for (auto &key: settings->allKeys())
+        values_.insert(key, settings->value(key));
+    markDirty();
+}
+
+void StoreDatabase::put(const QString &key, const QVariant &value)
+{
+    auto it = values_.find(key);
+    if (it != values_.end() && *it == value)
+        return;
+
+    values_.insert(key, value);
+    markDirty();
 }
 
-QVariant SettingsDatabase::get(const QString &key, const QVariant &default_value) const
+void StoreDatabase::remove(const QString &key)
 {
-    return settings_->value(key, default_value);
+    // Same as QSettings, remove the whole group if there is one
+    auto prefix = key + "/";
+    auto removed = values_.remove(key);
+    for (auto it = values_.begin(); it != values_.end();) {
+        if (it.key().startsWith(prefix)) {
+            it = values_.erase(it);
+            removed++;
+        } else {
+            ++it;
+        }
+    }
+
+    if (removed)
+        markDirty();
+}
+
+QVariant StoreDatabase::get(const QString &key, const QVariant &default_value) const
+{
+    return values_.value(key, default_value);
+}
+
+void StoreDatabase::clear()
+{
+    values_.clear();
+    markDirty();
+}
+
+bool StoreDatabase::sync()
+{
+    sync_timer_.stop();
+    if (!dirty_ || path_.isEmpty())
+        return true;
+
+    QDir().mkpath(QFileInfo(path_).path());
+
+    QSaveFile file(path_);
+    if (!file.open(QIODevice::WriteOnly)) {
+        ty_log(TY_LOG_ERROR, "Cannot open settings file '%s' for writing",
+               QDir::toNativeSeparators(path_).toUtf8().constData());
+        return false;
+    }
+
+    QDataStream out(&file);
+    out.setVersion(STORE_STREAM_VERSION);
+
+    out << static_cast<quint32>(STORE_MAGIC) << static_cast<quint32>(STORE_VERSION)
+        << static_cast<quint32>(values_.size());
+    for (auto it = values_.constBegin(); it != values_.constEnd(); ++it)
+        out << it.key() << it.value();
+
+    if (out.status() != QDataStream::Ok || !file.commit()) {
+        ty_log(TY_LOG_ERROR, "Failed to write settings file '%s'",
+               QDir::toNativeSeparators(path_).toUtf8().constData());
+        return false;
+    }
+
+    dirty_ = false;
+    return true;
 }
 
-void SettingsDatabase::clear()
+void StoreDatabase::markDirty()
 {
-    settings_->clear();
+    dirty_ = true;
+    // Don't restart the timer, or a steady stream of changes would never get saved
+    if (!sync_timer_.isActive())
+        sync_timer_.start();
 }
 
 void DatabaseInterface::setGroup(const QString &group)
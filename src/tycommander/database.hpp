@@ -11,7 +11,9 @@
 #ifndef DATABASE_HH
 #define DATABASE_HH
 
+#include <QHash>
 #include <QString>
+#include <QTimer>
 #include <QVariant>
 
 class QSettings;
@@ -27,21 +29,35 @@ public:
     virtual void clear() = 0;
 };
 
-class SettingsDatabase : public Database {
-    QSettings *settings_;
+/* Keeps everything in memory and writes the whole store back to disk at most once per
+   sync delay, so that bulk changes (such as changing the settings of many boards at once)
+   cost one write instead of one per key. The file is a QDataStream dump of the entries. */
+class StoreDatabase : public Database {
+    QString path_;
+    QHash<QString, QVariant> values_;
+
+    QTimer sync_timer_;
+    bool dirty_ = false;
 
 public:
-    SettingsDatabase(QSettings *settings = nullptr)
-        : settings_(settings) {}
+    StoreDatabase();
+    ~StoreDatabase();
+
+    bool load(const QString &path);
+    QString path() const { return path_; }
 
-    void setSettings(QSettings *settings) { settings_ = settings; }
-    QSettings *settings() const { return settings_; }
+    void importSettings(QSettings *settings);
 
     void put(const QString &key, const QVariant &value) override;
     void remove(const QString &key) override;
     QVariant get(const QString &key, const QVariant &default_value) const override;
 
     void clear() override;
+
+    bool sync();
+
+private:
+    void markDirty();
 };
 
 class DatabaseInterface {
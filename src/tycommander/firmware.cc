@@ -8,15 +8,71 @@
 
    See the LICENSE file for more details. */
 
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QFileInfo>
+#include <QFileSystemWatcher>
+#include <QHash>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QThread>
+
 #include "firmware.hpp"
 
 using namespace std;
 
+namespace {
+
+struct CacheEntry {
+    shared_ptr<Firmware> fw;
+    qint64 size;
+    QDateTime mtime;
+    uint64_t last_use;
+};
+
+}
+
+// Keep a few parsed firmwares around, they are immutable and shared by upload tasks
+static const int max_cache_entries = 16;
+
+static QMutex cache_mutex;
+static QHash<QString, CacheEntry> cache;
+static QFileSystemWatcher *cache_watcher;
+static uint64_t cache_clock;
+
 Firmware::~Firmware()
 {
     ty_firmware_unref(fw_);
 }
 
+static void dropCacheEntry(const QString &path)
+{
+    cache.remove(path);
+    if (cache_watcher)
+        cache_watcher->removePath(path);
+}
+
+static void watchCacheEntry(const QString &path)
+{
+    if (!cache_watcher) {
+        // The watcher belongs to the main thread, size and mtime checks are enough until then
+        auto app = QCoreApplication::instance();
+        if (!app || QThread::currentThread() != app->thread())
+            return;
+
+        cache_watcher = new QFileSystemWatcher(app);
+        QObject::connect(cache_watcher, &QFileSystemWatcher::fileChanged, [](const QString &path) {
+            QMutexLocker locker(&cache_mutex);
+            dropCacheEntry(path);
+        });
+        QObject::connect(cache_watcher, &QObject::destroyed, []() {
+            cache_watcher = nullptr;
+        });
+    }
+
+    cache_watcher->addPath(path);
+}
+
 shared_ptr<Firmware> Firmware::load(const QString &filename)
 {
     // Work around the private constructor for make_shared()
@@ -25,12 +81,52 @@ shared_ptr<Firmware> Firmware::load(const QString &filename)
             : Firmware(fw) {}
     };
 
+    QFileInfo info(filename);
+    QString path = info.canonicalFilePath();
     ty_firmware *fw;
     int r;
 
+    /* The watcher drops modified files, but it can miss changes (e.g. on network filesystems)
+       and notifications arrive late, so check size and modification time as well. */
+    if (!path.isEmpty()) {
+        QMutexLocker locker(&cache_mutex);
+
+        auto it = cache.find(path);
+        if (it != cache.end()) {
+            if (it->size == info.size() && it->mtime == info.lastModified()) {
+                it->last_use = ++cache_clock;
+                return it->fw;
+            }
+            dropCacheEntry(path);
+        }
+    }
+
     r = ty_firmware_load_file(filename.toLocal8Bit().constData(), nullptr, nullptr, &fw);
     if (r < 0)
         return nullptr;
+    auto firmware = make_shared<FirmwareSharedEnabler>(fw);
+
+    if (!path.isEmpty()) {
+        QMutexLocker locker(&cache_mutex);
+
+        if (cache.size() >= max_cache_entries) {
+            auto oldest = cache.begin();
+            for (auto it = cache.begin(); it != cache.end(); it++) {
+                if (it->last_use < oldest->last_use)
+                    oldest = it;
+            }
+            dropCacheEntry(oldest.key());
+        }
+
+        CacheEntry entry;
+        entry.fw = firmware;
+        entry.size = info.size();
+        entry.mtime = info.lastModified();
+        entry.last_use = ++cache_clock;
+        cache.insert(path, entry);
+
+        watchCacheEntry(path);
+    }
 
-    return make_shared<FirmwareSharedEnabler>(fw);
+    return firmware;
 }
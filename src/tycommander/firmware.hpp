@@ -28,6 +28,7 @@ public:
     Firmware& operator=(const Firmware &&other) = delete;
     Firmware(const Firmware &&other) = delete;
 
+    // Parsed firmwares are cached until the file changes, don't modify them
     static std::shared_ptr<Firmware> load(const QString &filename);
 
     QString filename() const { return fw_->filename; }
@@ -10,6 +10,7 @@
 
 #include <QBrush>
 #include <QIcon>
+#include <QStringList>
 
 #include "board.hpp"
 #include "database.hpp"
@@ -26,6 +27,8 @@ Monitor::Monitor(QObject *parent)
     int r = ty_pool_new(&pool_);
     if (r < 0)
         throw bad_alloc();
+    // Keep a thread ready so that the first upload after a while starts right away
+    ty_pool_set_min_threads(pool_, 1);
 
     loadSettings();
 }
@@ -109,6 +112,44 @@ unsigned int Monitor::maxTasks() const
     return ty_pool_get_max_threads(pool_);
 }
 
+static QString formatLatency(const ty_pool_latency &latency)
+{
+    if (!latency.count)
+        return "-";
+
+    return QString("%1 / %2 / %3 ms")
+        .arg(static_cast<double>(latency.total) / static_cast<double>(latency.count) / 1000.0, 0, 'f', 1)
+        .arg(static_cast<double>(ty_pool_latency_percentile(&latency, 95)) / 1000.0, 0, 'f', 1)
+        .arg(static_cast<double>(latency.max) / 1000.0, 0, 'f', 1);
+}
+
+static QString formatTaskStats(const ty_pool_task_stats &stats)
+{
+    return Monitor::tr("%1: %2 done, %3 failed, queue %4, run %5 (avg / p95 / max)")
+        .arg(stats.name ? stats.name : Monitor::tr("All tasks"))
+        .arg(stats.finished).arg(stats.failed)
+        .arg(formatLatency(stats.queue), formatLatency(stats.run));
+}
+
+QString Monitor::taskStatistics() const
+{
+    ty_pool_stats stats;
+    QStringList lines;
+
+    ty_pool_get_stats(pool_, &stats);
+
+    lines.append(tr("%1/%2 workers (%3 busy), %4 started, %5 stopped after idle timeout")
+                 .arg(stats.workers).arg(stats.max_threads).arg(stats.busy_workers)
+                 .arg(stats.workers_started).arg(stats.workers_stopped));
+    ty_pool_list_task_stats(pool_, [](const ty_pool_task_stats *stats, void *udata) {
+        static_cast<QStringList *>(udata)->append(formatTaskStats(*stats));
+        return 0;
+    }, &lines);
+    lines.append(formatTaskStats(stats.tasks));
+
+    return lines.join('\n');
+}
+
 void Monitor::setSerialByDefault(bool default_serial)
 {
     if (default_serial == default_serial_)
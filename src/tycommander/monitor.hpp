@@ -75,6 +75,7 @@ public:
     void loadSettings();
 
     unsigned int maxTasks() const;
+    QString taskStatistics() const;
     bool ignoreGeneric() const { return ignore_generic_; }
 
     bool serialByDefault() const { return default_serial_; }
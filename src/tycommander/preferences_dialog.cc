@@ -80,6 +80,8 @@ void PreferencesDialog::refresh()
     serialLogSizeDefaultSpin->setValue(static_cast<int>(monitor->serialLogSize() / 1000));
     serialLogDir->setText(monitor->serialLogDir());
     maxTasksSpin->setValue(monitor->maxTasks());
+    // Help users pick a value based on what happened so far
+    maxTasksSpin->setToolTip(monitor->taskStatistics());
 }
 
 void PreferencesDialog::browseForSerialLogDir()
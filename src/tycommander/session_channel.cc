@@ -9,8 +9,8 @@
    See the LICENSE file for more details. */
 
 #include <QCoreApplication>
-#include <QDataStream>
 #include <QDir>
+#include <QtEndian>
 
 #ifdef _WIN32
     #define WIN32_LEAN_AND_MEAN
@@ -31,6 +31,17 @@ static ProcessIdToSessionId_func *ProcessIdToSessionId_ =
 
 using namespace std;
 
+/* Bump this when the framing or the messages change, so that clients fail to connect
+   to a main instance of another version instead of sending it garbage. */
+#define SESSION_PROTOCOL_VERSION 2
+
+/* Frames start with an 8-byte header: the payload size and the request ID, both
+   little-endian 32-bit integers. The payload is a list of UTF-8 strings, each preceded
+   by its size (little-endian 32-bit). The request ID lets a client pipeline several
+   requests on one connection and tell the answers apart. */
+#define SESSION_FRAME_HEADER_SIZE 8
+#define SESSION_MAX_FRAME_SIZE (16 * 1024 * 1024)
+
 SessionChannel::SessionChannel(const QString &id, QObject *parent)
     : QObject(parent)
 {
@@ -92,6 +103,7 @@ QString SessionChannel::makeSocketName() const
 
         socketName += '-' + QString::number(session);
     }
+    socketName += QString("-v%1").arg(SESSION_PROTOCOL_VERSION);
 
     return socketName;
 }
@@ -126,7 +138,8 @@ void SessionChannel::unlock()
 
 QString SessionChannel::makeSocketName() const
 {
-    return QString("%1-%2").arg(id_, QString::number(getuid()));
+    return QString("%1-%2-v%3").arg(id_, QString::number(getuid()),
+                                     QString::number(SESSION_PROTOCOL_VERSION));
 }
 
 #endif
@@ -218,17 +231,25 @@ void SessionPeer::close()
     close(LocalClose);
 }
 
-void SessionPeer::send(const QStringList &arguments)
+void SessionPeer::send(uint32_t request, const QStringList &arguments)
 {
     if (socket_->state() != QLocalSocket::ConnectedState)
         return;
 
-    QByteArray buf;
-    QDataStream stream(&buf, QIODevice::WriteOnly);
-    stream << arguments;
+    QByteArray buf(SESSION_FRAME_HEADER_SIZE, 0);
+    for (auto &arg: arguments) {
+        auto utf8 = arg.toUtf8();
+        uchar len[4];
+
+        qToLittleEndian(static_cast<quint32>(utf8.size()), len);
+        buf.append(reinterpret_cast<char *>(len), sizeof(len));
+        buf.append(utf8);
+    }
+    auto header = reinterpret_cast<uchar *>(buf.data());
+    qToLittleEndian(static_cast<quint32>(buf.size() - SESSION_FRAME_HEADER_SIZE), header);
+    qToLittleEndian(static_cast<quint32>(request), header + 4);
 
-    uint32_t length = buf.size();
-    socket_->write(reinterpret_cast<char *>(&length), sizeof(length));
+    // Qt buffers writes until we get back to the event loop, so pipelined frames go out together
     socket_->write(buf);
 }
 
@@ -237,29 +258,46 @@ void SessionPeer::dataReceived()
     if (socket_->state() != QLocalSocket::ConnectedState)
         return;
 
-    while (true) {
-        // Get the length first (first 8 bytes)
-        if (!expected_length_) {
-            if (socket_->bytesAvailable() < static_cast<qint64>(sizeof(expected_length_)))
-                break;
+    recv_buf_.append(socket_->readAll());
+
+    while (recv_buf_.size() >= SESSION_FRAME_HEADER_SIZE) {
+        auto header = reinterpret_cast<const uchar *>(recv_buf_.constData());
+        auto payload_len = qFromLittleEndian<quint32>(header);
+        auto request = qFromLittleEndian<quint32>(header + 4);
+
+        if (payload_len > SESSION_MAX_FRAME_SIZE) {
+            close(Error);
+            return;
+        }
+        if (static_cast<quint32>(recv_buf_.size() - SESSION_FRAME_HEADER_SIZE) < payload_len)
+            break;
 
-            qint64 read = socket_->read(reinterpret_cast<char *>(&expected_length_), sizeof(expected_length_));
-            if (read < static_cast<qint64>(sizeof(expected_length_))) {
+        auto ptr = header + SESSION_FRAME_HEADER_SIZE;
+        auto end = ptr + payload_len;
+        QStringList arguments;
+        while (ptr < end) {
+            if (end - ptr < 4) {
+                close(Error);
+                return;
+            }
+            auto len = qFromLittleEndian<quint32>(ptr);
+            ptr += 4;
+            if (static_cast<quint32>(end - ptr) < len) {
                 close(Error);
-                break;
+                return;
             }
+
+            arguments.append(QString::fromUtf8(reinterpret_cast<const char *>(ptr),
+                                               static_cast<int>(len)));
+            ptr += len;
         }
-        // Easier to let Qt/OS handle the buffer, I won't use very big messages anyway
-        if (socket_->bytesAvailable() < expected_length_)
-            break;
 
-        auto buf = socket_->read(static_cast<qint64>(expected_length_));
-        expected_length_ = 0;
+        // Consume the frame first, handlers may run an event loop and get here again
+        recv_buf_.remove(0, SESSION_FRAME_HEADER_SIZE + static_cast<int>(payload_len));
 
-        QDataStream stream(buf);
-        QStringList arguments;
-        stream >> arguments;
-        emit received(arguments);
+        emit received(request, arguments);
+        if (!isConnected())
+            return;
     }
 }
 
@@ -21,7 +21,7 @@ class SessionPeer : public QObject {
     Q_OBJECT
 
     std::unique_ptr<QLocalSocket> socket_;
-    uint32_t expected_length_ = 0;
+    QByteArray recv_buf_;
 
 public:
     enum CloseReason {
@@ -38,12 +38,12 @@ public:
 
     bool isConnected() const { return socket_->state() == QLocalSocket::ConnectedState; }
 
-    void send(const QStringList &arguments);
-    void send(const QString &argument) { send(QStringList(argument)); }
-    void send(const char *argument) { send(QStringList(argument)); }
+    void send(uint32_t request, const QStringList &arguments);
+    void send(uint32_t request, const QString &argument) { send(request, QStringList(argument)); }
+    void send(uint32_t request, const char *argument) { send(request, QStringList(argument)); }
 
 signals:
-    void received(const QStringList &arguments);
+    void received(uint32_t request, const QStringList &arguments);
     void closed(SessionPeer::CloseReason reason);
 
 private:
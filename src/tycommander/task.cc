@@ -93,27 +93,28 @@ TyTask::~TyTask()
 
 bool TyTask::start()
 {
-    if (status() == TY_TASK_STATUS_READY)
-        ty_task_start(task_);
+    if (!task_)
+        return true;
+
+    if (ty_task_start(task_) < 0)
+        return false;
+
+    /* The task is doing something, we don't need to keep it alive anymore... it'll keep this
+       object alive instead. Do it now because messages may be queued and reach us later. */
+    task_->user_cleanup = [](void *ptr) {
+        auto task_ptr = static_cast<shared_ptr<Task> *>(ptr);
+        delete task_ptr;
+    };
+    task_->user_cleanup_udata = new shared_ptr<Task>(shared_from_this());
 
-    return status() >= TY_TASK_STATUS_PENDING;
+    ty_task_unref(task_);
+    task_ = NULL;
+
+    return true;
 }
 
 void TyTask::notifyMessage(const ty_message_data *msg)
 {
-    /* The task is doing something, we don't need to keep it alive anymore... it'll keep this
-       object alive instead. */
-    if (task_ && msg->type == TY_MESSAGE_STATUS) {
-        task_->user_cleanup = [](void *ptr) {
-            auto task_ptr = static_cast<shared_ptr<Task> *>(ptr);
-            delete task_ptr;
-        };
-        task_->user_cleanup_udata = new shared_ptr<Task>(shared_from_this());
-
-        ty_task_unref(task_);
-        task_ = NULL;
-    }
-
     switch (msg->type) {
     case TY_MESSAGE_LOG:
         notifyLog(msg);
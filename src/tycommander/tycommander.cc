@@ -10,6 +10,7 @@
 
 #include <QDir>
 #include <QElapsedTimer>
+#include <QFileInfo>
 #include <QMessageBox>
 #include <QProcess>
 #include <QSettings>
@@ -57,6 +58,8 @@ static const ClientCommand commands[] = {
 
 using namespace std;
 
+#define REMOTE_REQUEST_ID 1
+
 TyCommander::TyCommander(int &argc, char *argv[])
     : QApplication(argc, argv), argc_(argc), argv_(argv)
 {
@@ -66,7 +69,8 @@ TyCommander::TyCommander(int &argc, char *argv[])
     setApplicationName(TY_CONFIG_TYCOMMANDER_NAME);
     setApplicationVersion(ty_version_string());
 
-    // This can be triggered from multiple threads, but Qt can queue signals appropriately
+    /* This can be triggered from multiple threads (unless the main instance queues
+       messages), but Qt can queue signals appropriately. */
     ty_message_redirect([](const ty_message_data *msg, void *) {
         ty_message_default_handler(msg, nullptr);
 
@@ -79,6 +83,12 @@ TyCommander::TyCommander(int &argc, char *argv[])
         }
     }, nullptr);
 
+    connect(this, &TyCommander::aboutToQuit, this, [=]() {
+        tycommander_db_.sync();
+        monitor_db_.sync();
+        monitor_cache_.sync();
+    });
+
     initDatabase("tyqt", tycommander_db_);
     setDatabase(&tycommander_db_);
     loadSettings();
@@ -108,6 +118,18 @@ TyCommander::~TyCommander()
     ty_message_redirect(ty_message_default_handler, nullptr);
 }
 
+void TyCommander::deleteMessageQueue(ty_message_queue *queue)
+{
+    ty_message_redirect_queue(nullptr);
+    ty_message_queue_free(queue);
+}
+
+void TyCommander::dispatchMessages()
+{
+    if (message_queue_)
+        ty_message_queue_dispatch(message_queue_.get(), 256);
+}
+
 QString TyCommander::clientFilePath()
 {
 #ifdef _WIN32
@@ -261,6 +283,19 @@ int TyCommander::runMainInstance(int argc, char *argv[])
 
     connect(&channel_, &SessionChannel::newConnection, this, &TyCommander::acceptClient);
 
+    /* Worker threads only copy their messages to the queue, the UI thread handles them
+       in batches and never makes uploads wait on logging or progress updates. */
+    {
+        ty_message_queue *queue;
+        int r = ty_message_queue_new(1024, [](void *) {
+            QMetaObject::invokeMethod(tyCommander, "dispatchMessages", Qt::QueuedConnection);
+        }, nullptr, &queue);
+        if (r >= 0) {
+            message_queue_.reset(queue);
+            ty_message_redirect_queue(queue);
+        }
+    }
+
     initDatabase("boards", monitor_db_);
     monitor_.setDatabase(&monitor_db_);
     initCache("boards", monitor_cache_);
@@ -376,17 +411,18 @@ int TyCommander::executeRemoteCommand(int argc, char *argv[])
     if (!usbtype.isEmpty() && !usbtype.contains("_SERIAL"))
         filters.clear();
 
-    client->send({"workdir", QDir::currentPath()});
+    // These are pipelined and reach the main instance together
+    client->send(REMOTE_REQUEST_ID, {"workdir", QDir::currentPath()});
     if (multi)
-        client->send("multi");
+        client->send(REMOTE_REQUEST_ID, "multi");
     if (persist)
-        client->send("persist");
+        client->send(REMOTE_REQUEST_ID, "persist");
     if (!filters.isEmpty())
-        client->send(QStringList{"select"} + filters);
+        client->send(REMOTE_REQUEST_ID, QStringList{"select"} + filters);
     QStringList command_arglist = {command_};
     while ((opt = ty_optline_consume_non_option(&optl)))
         command_arglist.append(opt);
-    client->send(command_arglist);
+    client->send(REMOTE_REQUEST_ID, command_arglist);
 
     connect(client.get(), &SessionPeer::closed, this, [=](SessionPeer::CloseReason reason) {
         if (reason != SessionPeer::LocalClose) {
@@ -506,15 +542,14 @@ void TyCommander::clearSettingsAndResetWithConfirmation(QWidget *parent)
     tyCommander->clearSettingsAndReset();
 }
 
-void TyCommander::initDatabase(const QString &name, SettingsDatabase &db)
+void TyCommander::initDatabase(const QString &name, StoreDatabase &db)
 {
-    auto settings = new QSettings(QSettings::IniFormat, QSettings::UserScope,
-                                  organizationName(), name, this);
-    settings->setIniCodec(QTextCodec::codecForName("UTF-8"));
-    db.setSettings(settings);
+    QSettings settings(QSettings::IniFormat, QSettings::UserScope, organizationName(), name);
+    settings.setIniCodec(QTextCodec::codecForName("UTF-8"));
+    initStore(db, &settings);
 }
 
-void TyCommander::initCache(const QString &name, SettingsDatabase &cache)
+void TyCommander::initCache(const QString &name, StoreDatabase &cache)
 {
     /* QStandardPaths adds organizationName()/applicationName() to the generic OS cache path,
        but we put our files in organizationName() to share them with tycmd. On Windows, Qt uses
@@ -526,9 +561,21 @@ void TyCommander::initCache(const QString &name, SettingsDatabase &cache)
     auto path = QString("%1/../%2.ini")
                 .arg(QStandardPaths::writableLocation(QStandardPaths::CacheLocation), name);
 #endif
-    auto settings = new QSettings(path, QSettings::IniFormat, this);
-    settings->setIniCodec(QTextCodec::codecForName("UTF-8"));
-    cache.setSettings(settings);
+    QSettings settings(path, QSettings::IniFormat);
+    settings.setIniCodec(QTextCodec::codecForName("UTF-8"));
+    initStore(cache, &settings);
+}
+
+void TyCommander::initStore(StoreDatabase &store, QSettings *legacy_settings)
+{
+    // The store lives next to the INI file used by previous versions, which we import once
+    auto path = legacy_settings->fileName();
+    if (path.endsWith(".ini"))
+        path.chop(4);
+    path += ".tydb";
+
+    if (!store.load(path) && QFileInfo::exists(legacy_settings->fileName()))
+        store.importSettings(legacy_settings);
 }
 
 QString TyCommander::helpText()
@@ -595,17 +642,20 @@ void TyCommander::acceptClient()
     connect(client, &ClientHandler::closed, client, &ClientHandler::deleteLater);
 }
 
-void TyCommander::processServerAnswer(const QStringList &arguments)
+void TyCommander::processServerAnswer(uint32_t request, const QStringList &arguments)
 {
     QStringList parameters = arguments;
     QString cmd;
 
+    // Request 0 is used for messages not tied to any request
+    if (request && request != REMOTE_REQUEST_ID)
+        goto error;
     if (!arguments.count())
         goto error;
     cmd = parameters.takeFirst();
 
     if (cmd == "log") {
-        if (parameters.count() < 2)
+        if (parameters.count() < 3)
             goto error;
 
         ty_message_data msg = {};
@@ -621,7 +671,7 @@ void TyCommander::processServerAnswer(const QStringList &arguments)
 
         ty_message(&msg);
     } else if (cmd == "progress") {
-        if (parameters.count() < 3)
+        if (parameters.count() < 4)
             goto error;
 
         ty_message_data msg = {};
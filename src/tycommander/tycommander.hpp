@@ -31,6 +31,10 @@ class SelectorDialog;
 class TyCommander : public QApplication {
     Q_OBJECT
 
+    // Declared first so that it outlives the monitor and its worker threads
+    std::unique_ptr<ty_message_queue, void (*)(ty_message_queue *)> message_queue_{
+        nullptr, deleteMessageQueue};
+
     int argc_;
     char **argv_;
     QString command_;
@@ -40,9 +44,9 @@ class TyCommander : public QApplication {
 
     Monitor monitor_;
 
-    SettingsDatabase tycommander_db_;
-    SettingsDatabase monitor_db_;
-    SettingsDatabase monitor_cache_;
+    StoreDatabase tycommander_db_;
+    StoreDatabase monitor_db_;
+    StoreDatabase monitor_cache_;
 
     DatabaseInterface db_;
 
@@ -113,18 +117,23 @@ signals:
     void globalDebug(const QString &msg, const QString &ctx);
 
 private:
-    void initDatabase(const QString &name, SettingsDatabase &db);
-    void initCache(const QString &name, SettingsDatabase &cache);
+    static void deleteMessageQueue(ty_message_queue *queue);
+
+    void initDatabase(const QString &name, StoreDatabase &db);
+    void initCache(const QString &name, StoreDatabase &cache);
+    void initStore(StoreDatabase &store, QSettings *legacy_settings);
 
     QString helpText();
     void showClientMessage(const QString &msg);
     void showClientError(const QString &msg);
 
 private slots:
+    void dispatchMessages();
+
     void trayActivated(QSystemTrayIcon::ActivationReason reason);
 
     void acceptClient();
-    void processServerAnswer(const QStringList &arguments);
+    void processServerAnswer(uint32_t request, const QStringList &arguments);
 };
 
 #endif
@@ -0,0 +1,259 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://koromix.dev/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+/* Compares the open-addressing _hs_htable with the fixed-size chained table it replaced,
+   for the two uses in the tree: device keys (strings) and interface pointers.
+
+   Usage: bench_htable [count ...] */
+
+#include <stdio.h>
+#include "../../src/libhs/htable.h"
+#include "../../src/libty/common.h"
+#include "../../src/libty/system.h"
+
+#define LOOKUP_ROUNDS 64
+
+// Legacy table, kept here for comparison only
+
+struct legacy_head {
+    struct legacy_head *next;
+    uint32_t key;
+};
+
+struct legacy_table {
+    unsigned int size;
+    struct legacy_head **heads;
+};
+
+static int legacy_init(struct legacy_table *table, unsigned int size)
+{
+    table->heads = malloc(size * sizeof(*table->heads));
+    if (!table->heads)
+        return -1;
+    table->size = size;
+
+    for (unsigned int i = 0; i < size; i++)
+        table->heads[i] = (struct legacy_head *)&table->heads[i];
+
+    return 0;
+}
+
+static void legacy_add(struct legacy_table *table, uint32_t key, struct legacy_head *n)
+{
+    struct legacy_head *head = (struct legacy_head *)&table->heads[key % table->size];
+
+    n->key = key;
+    n->next = head->next;
+    head->next = n;
+}
+
+static struct legacy_head *legacy_find(struct legacy_table *table, uint32_t key,
+                                       bool (*match)(struct legacy_head *n, const void *udata),
+                                       const void *udata)
+{
+    struct legacy_head *head = (struct legacy_head *)&table->heads[key % table->size];
+
+    for (struct legacy_head *cur = head->next; cur != head; cur = cur->next) {
+        if (cur->key == key && (*match)(cur, udata))
+            return cur;
+    }
+
+    return NULL;
+}
+
+static uint32_t legacy_hash_str(const char *s)
+{
+    uint32_t hash = 0;
+    while (*s)
+        hash = hash * 101 + (unsigned char)*s++;
+
+    return hash;
+}
+
+static uint32_t legacy_hash_ptr(const void *p)
+{
+    return (uint32_t)((uintptr_t)p >> 3);
+}
+
+struct entry {
+    struct legacy_head hnode; // Keep first!
+    char key[128];
+};
+
+static bool match_key(struct legacy_head *n, const void *udata)
+{
+    return strcmp(((struct entry *)n)->key, udata) == 0;
+}
+
+static bool match_ptr(struct legacy_head *n, const void *udata)
+{
+    return n == udata;
+}
+
+static void print_result(const char *name, size_t count, uint64_t insert, uint64_t lookup)
+{
+    printf("  %-24s %8.1f ns/insert %8.1f ns/lookup\n", name,
+           (double)insert * 1000.0 / (double)count,
+           (double)lookup * 1000.0 / (double)(count * LOOKUP_ROUNDS));
+}
+
+static int bench(size_t count)
+{
+    struct entry *entries;
+    struct legacy_table legacy = {0};
+    _hs_htable table = {0};
+    size_t found;
+    uint64_t start, insert, lookup;
+    int r;
+
+    entries = calloc(count, sizeof(*entries));
+    if (!entries)
+        return -1;
+    // Keys look like Linux sysfs device paths, which share long prefixes
+    for (size_t i = 0; i < count; i++)
+        snprintf(entries[i].key, sizeof(entries[i].key),
+                 "/devices/pci0000:00/0000:00:14.0/usb%zu/%zu-%zu:1.%zu",
+                 i / 64 + 1, i / 64 + 1, i % 64, i % 4);
+
+    printf("%zu entries\n", count);
+
+    // Device keys
+    r = legacy_init(&legacy, 64);
+    if (r < 0)
+        goto cleanup;
+    start = ty_micros();
+    for (size_t i = 0; i < count; i++)
+        legacy_add(&legacy, legacy_hash_str(entries[i].key), &entries[i].hnode);
+    insert = ty_micros() - start;
+    found = 0;
+    start = ty_micros();
+    for (unsigned int j = 0; j < LOOKUP_ROUNDS; j++) {
+        for (size_t i = 0; i < count; i++)
+            found += !!legacy_find(&legacy, legacy_hash_str(entries[i].key), match_key, entries[i].key);
+    }
+    lookup = ty_micros() - start;
+    if (found != count * LOOKUP_ROUNDS)
+        goto missing;
+    print_result("chained/str", count, insert, lookup);
+    free(legacy.heads);
+    legacy.heads = NULL;
+
+    r = _hs_htable_init(&table, 64);
+    if (r < 0)
+        goto cleanup;
+    start = ty_micros();
+    for (size_t i = 0; i < count; i++) {
+        r = _hs_htable_add(&table, _hs_htable_hash_str(entries[i].key), &entries[i]);
+        if (r < 0)
+            goto cleanup;
+    }
+    insert = ty_micros() - start;
+    found = 0;
+    start = ty_micros();
+    for (unsigned int j = 0; j < LOOKUP_ROUNDS; j++) {
+        for (size_t i = 0; i < count; i++) {
+            _hs_htable_foreach_hash(cur, &table, _hs_htable_hash_str(entries[i].key)) {
+                if (strcmp(((struct entry *)cur)->key, entries[i].key) == 0) {
+                    found++;
+                    break;
+                }
+            }
+        }
+    }
+    lookup = ty_micros() - start;
+    if (found != count * LOOKUP_ROUNDS)
+        goto missing;
+    print_result("open-addressing/str", count, insert, lookup);
+    _hs_htable_release(&table);
+
+    // Interface pointers
+    r = legacy_init(&legacy, 64);
+    if (r < 0)
+        goto cleanup;
+    start = ty_micros();
+    for (size_t i = 0; i < count; i++)
+        legacy_add(&legacy, legacy_hash_ptr(&entries[i]), &entries[i].hnode);
+    insert = ty_micros() - start;
+    found = 0;
+    start = ty_micros();
+    for (unsigned int j = 0; j < LOOKUP_ROUNDS; j++) {
+        for (size_t i = 0; i < count; i++)
+            found += !!legacy_find(&legacy, legacy_hash_ptr(&entries[i]), match_ptr, &entries[i]);
+    }
+    lookup = ty_micros() - start;
+    if (found != count * LOOKUP_ROUNDS)
+        goto missing;
+    print_result("chained/ptr", count, insert, lookup);
+    free(legacy.heads);
+    legacy.heads = NULL;
+
+    r = _hs_htable_init(&table, 64);
+    if (r < 0)
+        goto cleanup;
+    start = ty_micros();
+    for (size_t i = 0; i < count; i++) {
+        r = _hs_htable_add(&table, _hs_htable_hash_ptr(&entries[i]), &entries[i]);
+        if (r < 0)
+            goto cleanup;
+    }
+    insert = ty_micros() - start;
+    found = 0;
+    start = ty_micros();
+    for (unsigned int j = 0; j < LOOKUP_ROUNDS; j++) {
+        for (size_t i = 0; i < count; i++) {
+            _hs_htable_foreach_hash(cur, &table, _hs_htable_hash_ptr(&entries[i])) {
+                if (cur == &entries[i]) {
+                    found++;
+                    break;
+                }
+            }
+        }
+    }
+    lookup = ty_micros() - start;
+    if (found != count * LOOKUP_ROUNDS)
+        goto missing;
+    print_result("open-addressing/ptr", count, insert, lookup);
+
+    r = 0;
+    goto cleanup;
+
+missing:
+    fprintf(stderr, "Lookups failed to find some entries\n");
+    r = -1;
+cleanup:
+    _hs_htable_release(&table);
+    free(legacy.heads);
+    free(entries);
+    return r;
+}
+
+int main(int argc, char *argv[])
+{
+    static const size_t default_counts[] = {64, 256, 1024, 4096};
+
+    if (argc > 1) {
+        for (int i = 1; i < argc; i++) {
+            size_t count = (size_t)strtoul(argv[i], NULL, 10);
+            if (!count) {
+                fprintf(stderr, "Invalid entry count '%s'\n", argv[i]);
+                return 1;
+            }
+            if (bench(count) < 0)
+                return 1;
+        }
+    } else {
+        for (size_t i = 0; i < TY_COUNTOF(default_counts); i++) {
+            if (bench(default_counts[i]) < 0)
+                return 1;
+        }
+    }
+
+    return 0;
+}
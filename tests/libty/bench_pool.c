@@ -0,0 +1,112 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://koromix.dev/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+/* Measures enqueue-to-start latency of task bursts that follow an idle period longer
+   than the pool idle timeout, with and without warm workers.
+
+   Usage: bench_pool [burst] [rounds] */
+
+#include <stdio.h>
+#include "../../src/libty/common.h"
+#include "../../src/libty/system.h"
+#include "../../src/libty/task.h"
+
+#define IDLE_TIMEOUT 50
+
+static int run_task(ty_task *task)
+{
+    TY_UNUSED(task);
+
+    ty_delay(2);
+    return 0;
+}
+
+static int bench(unsigned int min_threads, unsigned int burst, unsigned int rounds)
+{
+    ty_pool *pool = NULL;
+    ty_task **tasks = NULL;
+    ty_pool_stats stats;
+    int r;
+
+    tasks = calloc(burst, sizeof(*tasks));
+    if (!tasks)
+        return -1;
+
+    r = ty_pool_new(&pool);
+    if (r < 0)
+        goto cleanup;
+    ty_pool_set_idle_timeout(pool, IDLE_TIMEOUT);
+    r = ty_pool_set_max_threads(pool, burst);
+    if (r < 0)
+        goto cleanup;
+    r = ty_pool_set_min_threads(pool, min_threads);
+    if (r < 0)
+        goto cleanup;
+
+    for (unsigned int i = 0; i < rounds; i++) {
+        // Give on-demand workers the time to go away
+        ty_delay(IDLE_TIMEOUT * 2);
+
+        for (unsigned int j = 0; j < burst; j++) {
+            r = ty_task_new("bench", run_task, &tasks[j]);
+            if (r < 0)
+                goto cleanup;
+            tasks[j]->pool = pool;
+
+            r = ty_task_start(tasks[j]);
+            if (r < 0)
+                goto cleanup;
+        }
+        for (unsigned int j = 0; j < burst; j++) {
+            ty_task_wait(tasks[j], TY_TASK_STATUS_FINISHED, 5000);
+            ty_task_unref(tasks[j]);
+            tasks[j] = NULL;
+        }
+    }
+
+    ty_pool_get_stats(pool, &stats);
+    printf("  %-24s %8.1f us/start (avg) %8.1f us (max) %6"PRIu64" threads created\n",
+           min_threads ? "warm workers" : "on-demand workers",
+           (double)stats.tasks.queue.total / (double)stats.tasks.queue.count,
+           (double)stats.tasks.queue.max, stats.workers_started);
+
+    r = 0;
+cleanup:
+    if (tasks) {
+        for (unsigned int i = 0; i < burst; i++)
+            ty_task_unref(tasks[i]);
+    }
+    ty_pool_free(pool);
+    free(tasks);
+    return r;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned int burst = 4;
+    unsigned int rounds = 20;
+
+    if (argc > 1)
+        burst = (unsigned int)strtoul(argv[1], NULL, 10);
+    if (argc > 2)
+        rounds = (unsigned int)strtoul(argv[2], NULL, 10);
+    if (!burst || !rounds) {
+        fprintf(stderr, "Invalid burst size or round count\n");
+        return 1;
+    }
+
+    printf("%u rounds of %u tasks\n", rounds, burst);
+    if (bench(0, burst, rounds) < 0)
+        return 1;
+    if (bench(burst, burst, rounds) < 0)
+        return 1;
+
+    return 0;
+}
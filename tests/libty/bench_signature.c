@@ -0,0 +1,124 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://koromix.dev/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+/* Compares ty_firmware_search_signatures() with the sliding 64-bit comparison it replaced
+   in teensy_identify_models(), on an image without any match (worst case).
+
+   Usage: bench_signature [size_kib] [rounds] */
+
+#include <stdio.h>
+#include "../../src/libty/common.h"
+#include "../../src/libty/firmware.h"
+#include "../../src/libty/system.h"
+
+static const ty_firmware_signature avr_signatures[] = {
+    {1, {0x0C, 0x94, 0x00, 0x7E, 0xFF, 0xCF, 0xF8, 0x94}, 8},
+    {2, {0x0C, 0x94, 0x00, 0x3F, 0xFF, 0xCF, 0xF8, 0x94}, 8},
+    {3, {0x0C, 0x94, 0x00, 0xFE, 0xFF, 0xCF, 0xF8, 0x94}, 8}
+};
+
+// Same signatures with distinct first bytes, to exercise the lookup table path
+static const ty_firmware_signature mixed_signatures[] = {
+    {1, {0x0C, 0x94, 0x00, 0x7E, 0xFF, 0xCF, 0xF8, 0x94}, 8},
+    {2, {0x94, 0x00, 0x3F, 0xFF, 0xCF, 0xF8, 0x94, 0x00}, 8},
+    {3, {0xCF, 0xF8, 0x94, 0x0C, 0x94, 0x00, 0xFE, 0xFF}, 8}
+};
+
+static uint64_t read_uint64_le(const uint8_t *ptr)
+{
+    return (uint64_t)ptr[0] |
+           ((uint64_t)ptr[1] << 8) |
+           ((uint64_t)ptr[2] << 16) |
+           ((uint64_t)ptr[3] << 24) |
+           ((uint64_t)ptr[4] << 32) |
+           ((uint64_t)ptr[5] << 40) |
+           ((uint64_t)ptr[6] << 48) |
+           ((uint64_t)ptr[7] << 56);
+}
+
+static int legacy_scan(const uint8_t *mem, size_t len)
+{
+    for (size_t j = 0; j < len - sizeof(uint64_t); j++) {
+        switch (read_uint64_le(mem + j)) {
+            case 0x94F8CFFF7E00940C: { return 1; } break;
+            case 0x94F8CFFF3F00940C: { return 2; } break;
+            case 0x94F8CFFFFE00940C: { return 3; } break;
+        }
+    }
+
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    size_t size = 1024 * 1024;
+    unsigned int rounds = 50;
+    uint8_t *mem;
+    uint64_t start, legacy_time, avr_time, mixed_time;
+    unsigned int matches = 0;
+
+    if (argc > 1)
+        size = (size_t)strtoul(argv[1], NULL, 10) * 1024;
+    if (argc > 2)
+        rounds = (unsigned int)strtoul(argv[2], NULL, 10);
+    if (size < 16 || !rounds) {
+        fprintf(stderr, "Invalid image size or round count\n");
+        return 1;
+    }
+
+    mem = malloc(size);
+    if (!mem)
+        return 1;
+
+    /* Pseudo-random data, with a jmp opcode (0x0C 0x94) every 64 bytes like in AVR vector
+       tables and code, so that the first-byte filter has candidates to check. */
+    {
+        uint32_t x = 42;
+        for (size_t i = 0; i < size; i++) {
+            x = x * 1103515245 + 12345;
+            mem[i] = (uint8_t)(x >> 16);
+        }
+        for (size_t i = 0; i + 4 <= size; i += 64) {
+            mem[i] = 0x0C;
+            mem[i + 1] = 0x94;
+            mem[i + 2] = 0x00;
+            mem[i + 3] = 0x00;
+        }
+    }
+
+    start = ty_micros();
+    for (unsigned int i = 0; i < rounds; i++)
+        matches += (unsigned int)legacy_scan(mem, size);
+    legacy_time = ty_micros() - start;
+
+    start = ty_micros();
+    for (unsigned int i = 0; i < rounds; i++)
+        matches += !!ty_firmware_search_signatures(mem, size, avr_signatures,
+                                                   TY_COUNTOF(avr_signatures), NULL);
+    avr_time = ty_micros() - start;
+
+    start = ty_micros();
+    for (unsigned int i = 0; i < rounds; i++)
+        matches += !!ty_firmware_search_signatures(mem, size, mixed_signatures,
+                                                   TY_COUNTOF(mixed_signatures), NULL);
+    mixed_time = ty_micros() - start;
+
+    printf("%zu KiB image, %u rounds%s\n", size / 1024, rounds,
+           matches ? " (unexpected matches)" : "");
+    printf("  %-32s %8.1f us/scan %8.1f MiB/s\n", "sliding uint64 + switch",
+           (double)legacy_time / rounds, (double)size * rounds / (double)legacy_time / 1.048576);
+    printf("  %-32s %8.1f us/scan %8.1f MiB/s\n", "signatures (memchr filter)",
+           (double)avr_time / rounds, (double)size * rounds / (double)avr_time / 1.048576);
+    printf("  %-32s %8.1f us/scan %8.1f MiB/s\n", "signatures (table filter)",
+           (double)mixed_time / rounds, (double)size * rounds / (double)mixed_time / 1.048576);
+
+    free(mem);
+    return 0;
+}
@@ -0,0 +1,416 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://koromix.dev/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#include "test_libty.h"
+#include "../../src/libty/firmware.h"
+
+static const ty_firmware_signature same_first_byte[] = {
+    {1, {0x0C, 0x94, 0x00, 0x7E}, 4},
+    {2, {0x0C, 0x94, 0x00, 0x3F}, 4}
+};
+
+static const ty_firmware_signature mixed_first_bytes[] = {
+    {1, {0xAA, 0xBB}, 2},
+    {2, {0x11, 0x22, 0x33}, 3},
+    {3, {0x11, 0x22}, 2}
+};
+
+static void test_firmware_search_same_first_byte(void)
+{
+    uint8_t mem[64] = {0};
+    const ty_firmware_signature *sig;
+    size_t offset;
+
+    // Near-misses sharing the first bytes must not stop the search
+    memcpy(mem + 3, "\x0C\x94\x00\x00", 4);
+    memcpy(mem + 20, "\x0C\x94\x00\x3F", 4);
+    sig = ty_firmware_search_signatures(mem, sizeof(mem), same_first_byte,
+                                        TY_COUNTOF(same_first_byte), &offset);
+    ASSERT(sig == &same_first_byte[1]);
+    ASSERT(offset == 20);
+
+    // Match at the very end of the buffer
+    memset(mem, 0, sizeof(mem));
+    memcpy(mem + sizeof(mem) - 4, "\x0C\x94\x00\x7E", 4);
+    sig = ty_firmware_search_signatures(mem, sizeof(mem), same_first_byte,
+                                        TY_COUNTOF(same_first_byte), &offset);
+    ASSERT(sig == &same_first_byte[0]);
+    ASSERT(offset == sizeof(mem) - 4);
+
+    // Truncated signature
+    sig = ty_firmware_search_signatures(mem, sizeof(mem) - 1, same_first_byte,
+                                        TY_COUNTOF(same_first_byte), NULL);
+    ASSERT(!sig);
+}
+
+static void test_firmware_search_mixed_first_bytes(void)
+{
+    const uint8_t mem[] = {0x00, 0x11, 0x22, 0x44, 0xAA, 0x11, 0x22, 0x33};
+    const ty_firmware_signature *sig;
+    size_t offset;
+
+    // First match wins, then the first signature in table order
+    sig = ty_firmware_search_signatures(mem, sizeof(mem), mixed_first_bytes,
+                                        TY_COUNTOF(mixed_first_bytes), &offset);
+    ASSERT(sig == &mixed_first_bytes[2]);
+    ASSERT(offset == 1);
+
+    sig = ty_firmware_search_signatures(mem + 2, sizeof(mem) - 2, mixed_first_bytes,
+                                        TY_COUNTOF(mixed_first_bytes), &offset);
+    ASSERT(sig == &mixed_first_bytes[1]);
+    ASSERT(offset == 3);
+
+    sig = ty_firmware_search_signatures(mem, 1, mixed_first_bytes,
+                                        TY_COUNTOF(mixed_first_bytes), NULL);
+    ASSERT(!sig);
+}
+
+static void test_firmware_find_signature(void)
+{
+    ty_firmware *fw;
+    uint8_t buf[32];
+    const ty_firmware_signature *sig;
+    int r;
+
+    r = ty_firmware_new("test.hex", &fw);
+    ASSERT(!r);
+
+    memset(buf, 0x00, sizeof(buf));
+    r = ty_firmware_write(fw, 0, buf, sizeof(buf));
+    ASSERT(!r);
+    memcpy(buf + 30, "\xAA\xBB", 2);
+    r = ty_firmware_write(fw, 0x10000, buf, sizeof(buf));
+    ASSERT(!r);
+
+    sig = ty_firmware_find_signature(fw, mixed_first_bytes, TY_COUNTOF(mixed_first_bytes));
+    ASSERT(sig == &mixed_first_bytes[0]);
+
+    ty_firmware_unref(fw);
+
+    // Signature split between two contiguous pages
+    r = ty_firmware_new("test.hex", &fw);
+    ASSERT(!r);
+
+    memset(buf, 0x00, sizeof(buf));
+    memcpy(buf + 15, "\x11\x22\x33", 3);
+    r = ty_firmware_write(fw, TY_FIRMWARE_PAGE_SIZE - 16, buf, sizeof(buf));
+    ASSERT(!r);
+    ASSERT(fw->pages_count == 2);
+
+    sig = ty_firmware_find_signature(fw, mixed_first_bytes, 2);
+    ASSERT(sig == &mixed_first_bytes[1]);
+
+    ty_firmware_unref(fw);
+}
+
+static void test_firmware_sparse(void)
+{
+    ty_firmware *fw;
+    uint8_t data[300];
+    uint8_t buf[16];
+    size_t len;
+    int r;
+
+    r = ty_firmware_new("test.hex", &fw);
+    ASSERT(!r);
+
+    for (size_t i = 0; i < sizeof(data); i++)
+        data[i] = (uint8_t)i;
+
+    // Written out of order, far apart, and across a page boundary
+    r = ty_firmware_write(fw, 0x60000000 - 100, data, sizeof(data));
+    ASSERT(!r);
+    r = ty_firmware_write(fw, 0x10, data, 4);
+    ASSERT(!r);
+    r = ty_firmware_write(fw, 0x20, data, 4);
+    ASSERT(!r);
+
+    ASSERT(fw->pages_count == 3);
+    ASSERT(fw->total_size == sizeof(data) + 20);
+    ASSERT(fw->max_address == 0x60000000 - 100 + sizeof(data));
+
+    ASSERT(!ty_firmware_find_page(fw, 0x0));
+    ASSERT(ty_firmware_find_page(fw, 0x10));
+    ASSERT(ty_firmware_find_page(fw, 0x60000000 - 1));
+    ASSERT(ty_firmware_find_page(fw, 0x60000000));
+    ASSERT(!ty_firmware_find_page(fw, 0x60000000 + 200));
+
+    // Holes inside a page read as erased flash
+    memset(buf, 0, sizeof(buf));
+    len = ty_firmware_extract(fw, 0x10, buf, sizeof(buf));
+    ASSERT(len == 16);
+    ASSERT(!memcmp(buf, "\x00\x01\x02\x03\xFF\xFF", 6));
+
+    // Holes between pages are skipped
+    memset(buf, 0, sizeof(buf));
+    len = ty_firmware_extract(fw, 0x60000000 - 108, buf, sizeof(buf));
+    ASSERT(len == 8);
+    ASSERT(!buf[0] && buf[8] == 0 && buf[9] == 1);
+
+    len = ty_firmware_extract(fw, 0x60000000 - 4, buf, sizeof(buf));
+    ASSERT(len == 16);
+    ASSERT(buf[0] == 96 && buf[15] == 111);
+
+    ty_error_mask(TY_ERROR_RANGE);
+    r = ty_firmware_write(fw, 0xFFFFFFF0, data, 32);
+    ty_error_unmask();
+    ASSERT(r == TY_ERROR_RANGE);
+
+    ty_firmware_unref(fw);
+}
+
+static const char ihex_sample[] =
+    ":020000040000FA\r\n"
+    ":10000000000102030405060708090A0B0C0D0E0F78\r\n"
+    "\r\n"
+    ":0400100010111213A6\n"
+    ":020000041000EA\n"
+    ":02FFFE00AABB9C\n"
+    ":00000001FF";
+
+static ty_firmware *load_ihex_chunks(const char *hex, size_t len, size_t chunk_size)
+{
+    ty_firmware *fw;
+    ty_firmware_ihex_parser *parser;
+    int r;
+
+    r = ty_firmware_new("test.hex", &fw);
+    ASSERT(!r);
+    r = ty_firmware_ihex_parser_new(fw, &parser);
+    ASSERT(!r);
+
+    for (size_t offset = 0; offset < len; offset += chunk_size) {
+        r = ty_firmware_ihex_parser_feed(parser, (const uint8_t *)hex + offset,
+                                         TY_MIN(chunk_size, len - offset));
+        if (r < 0)
+            break;
+    }
+    if (!r)
+        r = ty_firmware_ihex_parser_finish(parser);
+    ty_firmware_ihex_parser_free(parser);
+
+    if (r < 0) {
+        ty_firmware_unref(fw);
+        return NULL;
+    }
+    return fw;
+}
+
+static void test_firmware_ihex_stream(void)
+{
+    ty_firmware *fw;
+    uint8_t buf[20];
+
+    // Same result whatever the chunk size, even when lines and CRLF pairs are split
+    for (size_t chunk_size = 1; chunk_size <= sizeof(ihex_sample); chunk_size++) {
+        fw = load_ihex_chunks(ihex_sample, strlen(ihex_sample), chunk_size);
+        ASSERT(fw);
+
+        ASSERT(fw->total_size == 22);
+        ASSERT(fw->max_address == 0x10010000);
+        ASSERT(ty_firmware_extract(fw, 0, buf, sizeof(buf)) == 20);
+        ASSERT(buf[0] == 0x00 && buf[15] == 0x0F && buf[16] == 0x10 && buf[19] == 0x13);
+        ASSERT(ty_firmware_extract(fw, 0x1000FFFE, buf, 2) == 2);
+        ASSERT(buf[0] == 0xAA && buf[1] == 0xBB);
+
+        ty_firmware_unref(fw);
+    }
+
+    ty_error_mask(TY_ERROR_PARSE);
+
+    // Missing EOF record
+    fw = load_ihex_chunks(ihex_sample, strlen(ihex_sample) - 11, 7);
+    ASSERT(!fw);
+
+    // Lines longer than any valid record are rejected before buffering them
+    {
+        char line[1024];
+
+        memset(line, '0', sizeof(line));
+        line[0] = ':';
+        fw = load_ihex_chunks(line, sizeof(line), 100);
+        ASSERT(!fw);
+    }
+
+    ty_error_unmask();
+}
+
+static void test_firmware_image(void)
+{
+    ty_firmware *fw, *fw2;
+    uint8_t data[3000];
+    uint8_t *image;
+    size_t image_size;
+    uint8_t buf1[4096], buf2[4096];
+    ty_model models[4];
+    int r;
+
+    r = ty_firmware_new("test.hex", &fw);
+    ASSERT(!r);
+
+    // Teensy 4 FlexSPI configuration block, a blank area and some code
+    memset(data, 0xFF, sizeof(data));
+    memcpy(data, "FCFB\x00\x00\x01\x56", 8);
+    for (size_t i = 2048; i < sizeof(data); i++)
+        data[i] = (uint8_t)i;
+    r = ty_firmware_write(fw, 0x60000000, data, sizeof(data));
+    ASSERT(!r);
+
+    r = ty_firmware_build_image(fw, TY_MODEL_TEENSY_40, &image, &image_size);
+    ASSERT(!r);
+    // Header, model names, bitmap and two 1024-byte blocks (the blank one is skipped)
+    ASSERT(!memcmp(image, "TYFI", 4));
+    ASSERT(image_size < 24 + 64 + 1 + 3 * 1024);
+
+    r = ty_firmware_load_mem("test.tyi", image, image_size, NULL, &fw2);
+    ASSERT(!r);
+    ASSERT(ty_firmware_identify(fw2, models, TY_COUNTOF(models)) == 2);
+    ASSERT(models[0] == TY_MODEL_TEENSY_40);
+
+    memset(buf1, 0xFF, sizeof(buf1));
+    memset(buf2, 0xFF, sizeof(buf2));
+    ty_firmware_extract(fw, 0x60000000, buf1, sizeof(buf1));
+    ty_firmware_extract(fw2, 0x60000000, buf2, sizeof(buf2));
+    ASSERT(!memcmp(buf1, buf2, sizeof(buf1)));
+
+    // Truncated images are rejected
+    ty_error_mask(TY_ERROR_PARSE);
+    ty_firmware_unref(fw2);
+    r = ty_firmware_load_mem("test.tyi", image, image_size - 1, NULL, &fw2);
+    ASSERT(r == TY_ERROR_PARSE);
+
+    // Block count too big for the file, (blocks_count + 7) / 8 must not wrap around
+    {
+        uint8_t header[24] = "TYFI\x01\0\0\0\0\0\0\0\x01\0\0\0\xFF\xFF\xFF\xFF";
+
+        r = ty_firmware_load_mem("test.tyi", header, sizeof(header), NULL, &fw2);
+        ASSERT(r == TY_ERROR_PARSE);
+    }
+    ty_error_unmask();
+
+    free(image);
+    ty_firmware_unref(fw);
+}
+
+static size_t build_elf(uint8_t *elf, bool big_endian)
+{
+    // One PT_NOTE and two PT_LOAD headers, the second one being empty (.bss)
+    static const uint32_t phdrs[3][8] = {
+        {4, 0x94, 0, 0, 4, 4, 0, 4},
+        {1, 0x98, 0x1000, 0x1000, 8, 8, 5, 4},
+        {1, 0, 0x2000, 0x2000, 0, 16, 6, 4}
+    };
+
+    memset(elf, 0, 0xA0);
+    memcpy(elf, "\x7F" "ELF\x01", 5);
+    elf[5] = big_endian ? 2 : 1;
+    elf[6] = 1;
+
+#define PUT(off, value, size) \
+        for (unsigned int k = 0; k < (size); k++) \
+            elf[(off) + (big_endian ? (size) - 1 - k : k)] = (uint8_t)((value) >> (8 * k))
+
+    PUT(28, 52, 4); // e_phoff
+    PUT(42, 32, 2); // e_phentsize
+    PUT(44, 3, 2); // e_phnum
+    for (unsigned int i = 0; i < 3; i++) {
+        for (unsigned int j = 0; j < 8; j++)
+            PUT(52 + i * 32 + j * 4, phdrs[i][j], 4);
+    }
+
+#undef PUT
+
+    memcpy(elf + 0x98, "\x01\x02\x03\x04\x05\x06\x07\x08", 8);
+
+    return 0xA0;
+}
+
+static void test_firmware_elf(void)
+{
+    uint8_t elf[0xA0];
+    size_t elf_size;
+    uint8_t buf[8];
+    ty_firmware *fw;
+    int r;
+
+    for (int big_endian = 0; big_endian < 2; big_endian++) {
+        FILE *fp;
+
+        elf_size = build_elf(elf, big_endian);
+
+        r = ty_firmware_load_mem("test.elf", elf, elf_size, NULL, &fw);
+        ASSERT(!r);
+        ASSERT(fw->total_size == 8);
+        ASSERT(ty_firmware_extract(fw, 0x1000, buf, sizeof(buf)) == 8);
+        ASSERT(!memcmp(buf, "\x01\x02\x03\x04\x05\x06\x07\x08", 8));
+        ty_firmware_unref(fw);
+
+        // Seekable files only get the headers and PT_LOAD data read
+        fp = tmpfile();
+        ASSERT(fp);
+        ASSERT(fwrite(elf, 1, elf_size, fp) == elf_size);
+        rewind(fp);
+        r = ty_firmware_new("test.elf", &fw);
+        ASSERT(!r);
+        r = ty_firmware_load_elf_file(fw, fp);
+        ASSERT(!r);
+        ASSERT(fw->total_size == 8);
+        ASSERT(ty_firmware_extract(fw, 0x1000, buf, sizeof(buf)) == 8);
+        ASSERT(!memcmp(buf, "\x01\x02\x03\x04\x05\x06\x07\x08", 8));
+        ty_firmware_unref(fw);
+        fclose(fp);
+
+        ty_error_mask(TY_ERROR_PARSE);
+
+        // Truncated PT_LOAD data
+        fp = tmpfile();
+        ASSERT(fp);
+        ASSERT(fwrite(elf, 1, elf_size - 1, fp) == elf_size - 1);
+        rewind(fp);
+        r = ty_firmware_new("test.elf", &fw);
+        ASSERT(!r);
+        r = ty_firmware_load_elf_file(fw, fp);
+        ASSERT(r == TY_ERROR_PARSE);
+        ty_firmware_unref(fw);
+        fclose(fp);
+        r = ty_firmware_load_mem("test.elf", elf, elf_size - 1, NULL, &fw);
+        ASSERT(r == TY_ERROR_PARSE);
+
+        // PT_LOAD data wrapping around the 32-bit offset space
+        for (unsigned int k = 0; k < 4; k++)
+            elf[52 + 32 + 4 + (big_endian ? 3 - k : k)] = (uint8_t)(0xFFFFFFFCu >> (8 * k));
+        fp = tmpfile();
+        ASSERT(fp);
+        ASSERT(fwrite(elf, 1, elf_size, fp) == elf_size);
+        rewind(fp);
+        r = ty_firmware_new("test.elf", &fw);
+        ASSERT(!r);
+        r = ty_firmware_load_elf_file(fw, fp);
+        ASSERT(r == TY_ERROR_PARSE);
+        ty_firmware_unref(fw);
+        r = ty_firmware_load_mem("test.elf", elf, elf_size, NULL, &fw);
+        ASSERT(r == TY_ERROR_PARSE);
+
+        ty_error_unmask();
+
+        fclose(fp);
+    }
+}
+
+void test_firmware(void)
+{
+    test_firmware_search_same_first_byte();
+    test_firmware_search_mixed_first_bytes();
+    test_firmware_find_signature();
+    test_firmware_sparse();
+    test_firmware_ihex_stream();
+    test_firmware_image();
+    test_firmware_elf();
+}
@@ -0,0 +1,132 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://koromix.dev/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#include "test_libty.h"
+#include "../../src/libhs/htable.h"
+
+static void test_htable_grow(void)
+{
+    static int values[1000];
+    _hs_htable table;
+    int r;
+
+    r = _hs_htable_init(&table, 8);
+    ASSERT(!r);
+
+    for (size_t i = 0; i < TY_COUNTOF(values); i++) {
+        r = _hs_htable_add(&table, _hs_htable_hash_ptr(&values[i]), &values[i]);
+        ASSERT(!r);
+    }
+    ASSERT(table.count == TY_COUNTOF(values));
+    ASSERT(table.capacity >= TY_COUNTOF(values));
+
+    {
+        size_t found = 0;
+        for (size_t i = 0; i < TY_COUNTOF(values); i++) {
+            _hs_htable_foreach_hash(cur, &table, _hs_htable_hash_ptr(&values[i])) {
+                if (cur == &values[i]) {
+                    found++;
+                    break;
+                }
+            }
+        }
+        ASSERT(found == TY_COUNTOF(values));
+    }
+
+    {
+        size_t count = 0;
+        _hs_htable_foreach(cur, &table) {
+            TY_UNUSED(cur);
+            count++;
+        }
+        ASSERT(count == TY_COUNTOF(values));
+    }
+
+    _hs_htable_release(&table);
+}
+
+static void test_htable_remove(void)
+{
+    static int values[64];
+    _hs_htable table;
+    int r;
+
+    r = _hs_htable_init(&table, 0);
+    ASSERT(!r);
+
+    // Force collisions, the table has to keep values with the same hash apart
+    for (size_t i = 0; i < TY_COUNTOF(values); i++) {
+        r = _hs_htable_add(&table, (uint32_t)(i % 4), &values[i]);
+        ASSERT(!r);
+    }
+
+    for (size_t i = 0; i < TY_COUNTOF(values); i += 2)
+        ASSERT(_hs_htable_remove(&table, (uint32_t)(i % 4), &values[i]));
+    ASSERT(!_hs_htable_remove(&table, 0, &values[0]));
+    ASSERT(table.count == TY_COUNTOF(values) / 2);
+
+    {
+        size_t count = 0;
+        bool odd = true;
+        _hs_htable_foreach_hash(cur, &table, 1) {
+            odd &= ((int *)cur - values) % 2 == 1;
+            count++;
+        }
+        ASSERT(count == TY_COUNTOF(values) / 4);
+        ASSERT(odd);
+    }
+
+    // Removing the current value while iterating must not skip the others
+    {
+        size_t count = 0;
+        _hs_htable_foreach_hash(cur, &table, 3) {
+            _hs_htable_remove(&table, 3, cur);
+            count++;
+        }
+        ASSERT(count == TY_COUNTOF(values) / 4);
+        ASSERT(table.count == TY_COUNTOF(values) / 4);
+    }
+
+    {
+        bool found = false;
+        _hs_htable_foreach_hash(cur, &table, 3) {
+            TY_UNUSED(cur);
+            found = true;
+        }
+        ASSERT(!found);
+    }
+
+    _hs_htable_clear(&table);
+    ASSERT(!table.count);
+    {
+        bool found = false;
+        _hs_htable_foreach(cur, &table) {
+            TY_UNUSED(cur);
+            found = true;
+        }
+        ASSERT(!found);
+    }
+
+    _hs_htable_release(&table);
+}
+
+static void test_htable_hash_str(void)
+{
+    ASSERT(_hs_htable_hash_str("") == 2166136261u);
+    ASSERT(_hs_htable_hash_str("a") == 0xe40c292cu);
+    ASSERT(_hs_htable_hash_str("foobar") == 0xbf9cf968u);
+}
+
+void test_htable(void)
+{
+    test_htable_grow();
+    test_htable_remove();
+    test_htable_hash_str();
+}
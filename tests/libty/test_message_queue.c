@@ -0,0 +1,132 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://koromix.dev/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#include "test_libty.h"
+#include "../../src/libty/thread.h"
+
+#define PRODUCERS 4
+#define MESSAGES 20000
+
+struct producer_state {
+    ty_thread thread;
+    unsigned int received;
+    bool ordered;
+};
+
+static struct producer_state producers[PRODUCERS];
+static unsigned int progress_received;
+
+static ty_mutex done_mutex;
+static unsigned int done_count;
+
+static int produce(void *udata)
+{
+    struct producer_state *producer = udata;
+    char ctx[16];
+
+    snprintf(ctx, sizeof(ctx), "%d", (int)(producer - producers));
+
+    for (unsigned int i = 0; i < MESSAGES; i++) {
+        ty_message_data msg = {0};
+        char buf[32];
+
+        snprintf(buf, sizeof(buf), "%u", i);
+        msg.ctx = ctx;
+        msg.type = TY_MESSAGE_LOG;
+        msg.u.log.level = TY_LOG_DEBUG;
+        msg.u.log.msg = buf;
+        ty_message(&msg);
+
+        memset(&msg, 0, sizeof(msg));
+        msg.ctx = ctx;
+        msg.type = TY_MESSAGE_PROGRESS;
+        msg.u.progress.action = "Producing";
+        msg.u.progress.value = i;
+        msg.u.progress.max = MESSAGES;
+        ty_message(&msg);
+    }
+
+    ty_mutex_lock(&done_mutex);
+    done_count++;
+    ty_mutex_unlock(&done_mutex);
+
+    return 0;
+}
+
+static void handle_message(const ty_message_data *msg, void *udata)
+{
+    TY_UNUSED(udata);
+
+    if (msg->type == TY_MESSAGE_LOG) {
+        struct producer_state *producer = &producers[atoi(msg->ctx)];
+
+        if ((unsigned int)atoi(msg->u.log.msg) != producer->received)
+            producer->ordered = false;
+        producer->received++;
+    } else if (msg->type == TY_MESSAGE_PROGRESS) {
+        progress_received++;
+    }
+}
+
+static void test_message_queue_producers(void)
+{
+    ty_message_queue *queue;
+    unsigned int dropped;
+    int r;
+
+    // Small ring to make sure some messages end up in the overflow stack
+    r = ty_message_queue_new(64, NULL, NULL, &queue);
+    ASSERT(!r);
+    r = ty_mutex_init(&done_mutex);
+    ASSERT(!r);
+
+    ty_message_redirect(handle_message, NULL);
+    ty_message_redirect_queue(queue);
+
+    for (unsigned int i = 0; i < PRODUCERS; i++) {
+        producers[i].ordered = true;
+        r = ty_thread_create(&producers[i].thread, produce, &producers[i]);
+        ASSERT(!r);
+    }
+    // Consume while the producers are running
+    while (true) {
+        bool done;
+
+        ty_mutex_lock(&done_mutex);
+        done = done_count == PRODUCERS;
+        ty_mutex_unlock(&done_mutex);
+        if (done)
+            break;
+
+        ty_message_queue_dispatch(queue, 256);
+    }
+    for (unsigned int i = 0; i < PRODUCERS; i++)
+        ty_thread_join(&producers[i].thread);
+    while (ty_message_queue_dispatch(queue, UINT_MAX));
+
+    ty_message_redirect_queue(NULL);
+    ty_message_redirect(ty_message_default_handler, NULL);
+
+    // Log messages are never dropped, and arrive in order for each producer
+    for (unsigned int i = 0; i < PRODUCERS; i++) {
+        ASSERT(producers[i].received == MESSAGES);
+        ASSERT(producers[i].ordered);
+    }
+    dropped = ty_message_queue_get_dropped(queue);
+    ASSERT(progress_received + dropped == PRODUCERS * MESSAGES);
+
+    ty_message_queue_free(queue);
+    ty_mutex_release(&done_mutex);
+}
+
+void test_message_queue(void)
+{
+    test_message_queue_producers();
+}
@@ -0,0 +1,385 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://koromix.dev/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#include "test_libty.h"
+#include "../../src/libty/board_priv.h"
+#include "../../src/libty/system.h"
+#include "../../src/libty/task.h"
+#include "../../src/libty/thread.h"
+
+#define TASK_WAIT_TIMEOUT 5000
+
+static ty_mutex gate_mutex;
+static ty_cond gate_cond;
+static bool gate_open;
+static bool gate_entered;
+
+static unsigned int run_count;
+static ty_board *wait_board;
+
+static void silent_handler(const ty_message_data *msg, void *udata)
+{
+    TY_UNUSED(msg);
+    TY_UNUSED(udata);
+}
+
+static int run_gate(ty_task *task)
+{
+    TY_UNUSED(task);
+
+    ty_mutex_lock(&gate_mutex);
+    gate_entered = true;
+    ty_cond_broadcast(&gate_cond);
+    while (!gate_open)
+        ty_cond_wait(&gate_cond, &gate_mutex, -1);
+    ty_mutex_unlock(&gate_mutex);
+
+    return 0;
+}
+
+static int run_counted(ty_task *task)
+{
+    TY_UNUSED(task);
+
+    run_count++;
+    return 0;
+}
+
+static int run_suspended(ty_task *task)
+{
+    run_count++;
+    // Park forever, only a resume can bring the task back
+    _ty_task_suspend(task, -1);
+
+    return 0;
+}
+
+static int run_wait_board(ty_task *task)
+{
+    TY_UNUSED(task);
+
+    int r;
+
+    ty_error_mask(TY_ERROR_CANCELED);
+    ty_error_mask(TY_ERROR_TIMEOUT);
+    r = ty_board_wait_for(wait_board, TY_BOARD_CAPABILITY_SERIAL, -1);
+    ty_error_unmask();
+    ty_error_unmask();
+
+    return r;
+}
+
+static int run_suspended_once(ty_task *task)
+{
+    // Suspended on the first run, finished when the pool runs it again
+    if (!run_count++) {
+        _ty_task_suspend(task, 10);
+        return 0;
+    }
+
+    return 42;
+}
+
+static int run_join_inner(ty_task *task)
+{
+    ty_task *inner = NULL;
+    int r;
+
+    r = ty_task_new("inner", run_suspended_once, &inner);
+    if (r < 0)
+        return r;
+    inner->pool = task->pool;
+
+    // Executed inline on this worker, where the inner task is allowed to suspend itself
+    r = ty_task_join(inner);
+
+    ty_task_unref(inner);
+    return r;
+}
+
+static int new_pool_task(ty_pool *pool, int (*run)(ty_task *task), ty_task **rtask)
+{
+    int r;
+
+    r = ty_task_new("test", run, rtask);
+    if (r < 0)
+        return r;
+    (*rtask)->pool = pool;
+
+    return 0;
+}
+
+static void test_task_cancel_pending(void)
+{
+    ty_pool *pool = NULL;
+    ty_task *gate = NULL, *task = NULL;
+    int r;
+
+    ty_mutex_init(&gate_mutex);
+    ty_cond_init(&gate_cond);
+    gate_open = false;
+    gate_entered = false;
+    run_count = 0;
+
+    r = ty_pool_new(&pool);
+    ASSERT(!r);
+    ty_pool_set_max_threads(pool, 1);
+
+    // Keep the only worker busy so that the next task stays pending
+    r = new_pool_task(pool, run_gate, &gate);
+    ASSERT(!r);
+    r = ty_task_start(gate);
+    ASSERT(!r);
+    ty_mutex_lock(&gate_mutex);
+    while (!gate_entered)
+        ty_cond_wait(&gate_cond, &gate_mutex, -1);
+    ty_mutex_unlock(&gate_mutex);
+
+    r = new_pool_task(pool, run_counted, &task);
+    ASSERT(!r);
+    r = ty_task_start(task);
+    ASSERT(!r);
+    ASSERT(task->status == TY_TASK_STATUS_PENDING);
+
+    ty_task_cancel(task);
+
+    ty_error_mask(TY_ERROR_CANCELED);
+    r = ty_task_join(task);
+    ty_error_unmask();
+    ASSERT(r == TY_ERROR_CANCELED);
+    ASSERT(!run_count);
+
+    ty_mutex_lock(&gate_mutex);
+    gate_open = true;
+    ty_cond_broadcast(&gate_cond);
+    ty_mutex_unlock(&gate_mutex);
+    r = ty_task_join(gate);
+    ASSERT(!r);
+
+    ty_task_unref(task);
+    ty_task_unref(gate);
+    ty_pool_free(pool);
+    ty_cond_release(&gate_cond);
+    ty_mutex_release(&gate_mutex);
+}
+
+static void test_task_cancel_suspended(void)
+{
+    ty_pool *pool = NULL;
+    ty_task *task = NULL;
+    ty_pool_stats stats;
+    uint64_t start;
+    int r;
+
+    run_count = 0;
+
+    r = ty_pool_new(&pool);
+    ASSERT(!r);
+
+    r = new_pool_task(pool, run_suspended, &task);
+    ASSERT(!r);
+    r = ty_task_start(task);
+    ASSERT(!r);
+
+    start = ty_millis();
+    do {
+        ty_pool_get_stats(pool, &stats);
+        if (stats.parked_tasks)
+            break;
+        ty_delay(1);
+    } while (ty_millis() - start < TASK_WAIT_TIMEOUT);
+    ASSERT(stats.parked_tasks == 1);
+
+    // The worker reports the cancellation when the task resumes
+    ty_message_redirect(silent_handler, NULL);
+    ty_task_cancel(task);
+    r = ty_task_wait(task, TY_TASK_STATUS_FINISHED, TASK_WAIT_TIMEOUT);
+    ty_message_redirect(ty_message_default_handler, NULL);
+    ASSERT(r > 0);
+    ASSERT(task->ret == TY_ERROR_CANCELED);
+    ASSERT(run_count == 1);
+
+    ty_pool_get_stats(pool, &stats);
+    ASSERT(!stats.parked_tasks);
+
+    ty_task_unref(task);
+    ty_pool_free(pool);
+}
+
+static void test_task_join_suspended_inline(void)
+{
+    ty_pool *pool = NULL;
+    ty_task *task = NULL;
+    ty_pool_stats stats;
+    int r;
+
+    run_count = 0;
+
+    r = ty_pool_new(&pool);
+    ASSERT(!r);
+
+    r = new_pool_task(pool, run_join_inner, &task);
+    ASSERT(!r);
+    r = ty_task_start(task);
+    ASSERT(!r);
+
+    r = ty_task_wait(task, TY_TASK_STATUS_FINISHED, TASK_WAIT_TIMEOUT);
+    ASSERT(r > 0);
+    ASSERT(task->ret == 42);
+    ASSERT(run_count == 2);
+
+    ty_pool_get_stats(pool, &stats);
+    ASSERT(!stats.parked_tasks);
+
+    ty_task_unref(task);
+    ty_pool_free(pool);
+}
+
+// Sandboxes and containers may not give access to the device manager, skip these tests
+static ty_monitor *new_test_monitor(void)
+{
+    ty_monitor *monitor;
+    int r;
+
+    r = ty_monitor_new(&monitor);
+    if (r < 0) {
+        printf("  Skipping board wait test: no device monitor\n");
+        return NULL;
+    }
+
+    return monitor;
+}
+
+static int init_wait_board(ty_monitor *monitor, ty_board *board)
+{
+    int r;
+
+    memset(board, 0, sizeof(*board));
+    board->refcount = 1;
+    board->monitor = monitor;
+    board->status = TY_BOARD_STATUS_ONLINE;
+    board->tag = (char *)"test";
+
+    r = ty_mutex_init(&board->ifaces_lock);
+    if (r < 0)
+        return r;
+    r = ty_cond_init(&board->wait_cond);
+    if (r < 0) {
+        ty_mutex_release(&board->ifaces_lock);
+        return r;
+    }
+
+    return 0;
+}
+
+static void release_wait_board(ty_board *board)
+{
+    ty_cond_release(&board->wait_cond);
+    ty_mutex_release(&board->ifaces_lock);
+}
+
+// Returns true once the task is blocked in ty_board_wait_for()
+static bool wait_for_board_waiter(ty_board *board)
+{
+    uint64_t start = ty_millis();
+
+    while (ty_millis() - start < TASK_WAIT_TIMEOUT) {
+        // The refresh mutex is private to the monitor, a stale read only costs one more loop
+        if (*(volatile unsigned int *)&board->waiters)
+            return true;
+        ty_delay(1);
+    }
+
+    return false;
+}
+
+static void test_task_cancel_board_wait(void)
+{
+    ty_monitor *monitor;
+    ty_board board;
+    ty_pool *pool = NULL;
+    ty_task *task = NULL;
+    int r;
+
+    monitor = new_test_monitor();
+    if (!monitor)
+        return;
+    r = init_wait_board(monitor, &board);
+    ASSERT(!r);
+    wait_board = &board;
+
+    r = ty_pool_new(&pool);
+    ASSERT(!r);
+
+    r = new_pool_task(pool, run_wait_board, &task);
+    ASSERT(!r);
+    r = ty_task_start(task);
+    ASSERT(!r);
+    ASSERT(wait_for_board_waiter(&board));
+
+    ty_task_cancel(task);
+    r = ty_task_wait(task, TY_TASK_STATUS_FINISHED, TASK_WAIT_TIMEOUT);
+    ASSERT(r > 0);
+    ASSERT(task->ret == TY_ERROR_CANCELED);
+    ASSERT(!board.waiters);
+
+    ty_task_unref(task);
+    ty_pool_free(pool);
+    release_wait_board(&board);
+    ty_monitor_free(monitor);
+}
+
+static void test_task_deadline_board_wait(void)
+{
+    ty_monitor *monitor;
+    ty_board board;
+    ty_pool *pool = NULL;
+    ty_task *task = NULL;
+    uint64_t start;
+    int r;
+
+    monitor = new_test_monitor();
+    if (!monitor)
+        return;
+    r = init_wait_board(monitor, &board);
+    ASSERT(!r);
+    wait_board = &board;
+
+    r = ty_pool_new(&pool);
+    ASSERT(!r);
+
+    r = new_pool_task(pool, run_wait_board, &task);
+    ASSERT(!r);
+    start = ty_millis();
+    ty_task_set_deadline(task, start + 100);
+    r = ty_task_start(task);
+    ASSERT(!r);
+
+    // Nothing ever changes on the board, the deadline alone must end the wait
+    r = ty_task_wait(task, TY_TASK_STATUS_FINISHED, TASK_WAIT_TIMEOUT);
+    ASSERT(r > 0);
+    ASSERT(task->ret == TY_ERROR_TIMEOUT);
+    ASSERT(ty_millis() - start >= 100);
+    ASSERT(!board.waiters);
+
+    ty_task_unref(task);
+    ty_pool_free(pool);
+    release_wait_board(&board);
+    ty_monitor_free(monitor);
+}
+
+void test_task(void)
+{
+    test_task_cancel_pending();
+    test_task_cancel_suspended();
+    test_task_join_suspended_inline();
+    test_task_cancel_board_wait();
+    test_task_deadline_board_wait();
+}